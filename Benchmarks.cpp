@@ -0,0 +1,311 @@
+//
+//  Benchmarks.cpp
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+
+#include "TexSyn.h"
+#include "Benchmarks.h"
+
+// Returns seconds of wall clock time taken to call the given function. When
+// "repeat" is greater than 1 it returns the minimum time over that many calls.
+static double secondsToRun(std::function<void()> function, int repeat = 1)
+{
+    double fastest = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < repeat; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = finish - start;
+        fastest = std::min(fastest, elapsed.count());
+    }
+    return fastest;
+}
+
+// Time to rasterize textures of various cost at 511² and 4095². Each render
+// uses a newly constructed Texture, since rasterizeToImageCache() caches.
+void Benchmarks::rasterization()
+{
+    Uniform gray(0.5);
+    Uniform white(1);
+    std::vector<std::pair<std::string,
+                          std::function<void(int size)>>> cases =
+    {
+        {"Uniform", [&](int size)
+            { Uniform(0.5).rasterizeToImageCache(size, true); }},
+        {"Grating", [&](int size)
+            { Grating(Vec2(), gray, Vec2(0.1, 0.2), white, 0.5, 0.5)
+                  .rasterizeToImageCache(size, true); }},
+        {"ColorNoise", [&](int size)
+            { ColorNoise(Vec2(), Vec2(0.2, 0), 0.3)
+                  .rasterizeToImageCache(size, true); }},
+    };
+    for (int size : {511, 4095})
+    {
+        for (auto& c : cases)
+        {
+            double seconds = secondsToRun([&](){ c.second(size); },
+                                          size < 1000 ? 3 : 1);
+            std::cout << "rasterization: " << c.first << " " << size << "²: ";
+            std::cout << seconds * 1000 << " ms, ";
+            std::cout << seconds * 1e9 / sq(size) << " ns/pixel" << std::endl;
+        }
+    }
+}
+
+// Time to render the 101² thumbnail suite from UnitTests (one of each texture
+// type, see UnitTests::forAllTextureTypes()) with and without noise octave
+// culling according to pixel size (see Texture::setRenderFootprint()).
+void Benchmarks::noiseOctaveCulling()
+{
+    // Total time to render the suite, minimum over several trials. Excludes
+    // time to construct textures (mostly LotsOfSpots and its relatives).
+    auto render_suite = [](bool footprint)
+    {
+        Texture::setRenderFootprint(footprint);
+        double fastest = std::numeric_limits<double>::infinity();
+        for (int trial = 0; trial < 5; trial++)
+        {
+            double total = 0;
+            UnitTests::forAllTextureTypes([&](const Texture& texture)
+            {
+                total += secondsToRun([&]()
+                    { texture.rasterizeToImageCache(101, true); });
+            });
+            fastest = std::min(fastest, total);
+        }
+        return fastest;
+    };
+    bool save = Texture::getRenderFootprint();
+    double all = render_suite(false);
+    double culled = render_suite(true);
+    Texture::setRenderFootprint(save);
+    std::cout << "noiseOctaveCulling: thumbnail suite 101²: ";
+    std::cout << all * 1000 << " ms with all octaves, ";
+    std::cout << culled * 1000 << " ms culled by footprint, speedup ";
+    std::cout << all / culled << std::endl;
+}
+
+// Time to evaluate a nest of operators with opcodes (see Program.h) at 511²
+// random positions, by recursive getColors() calls and by Program::run().
+void Benchmarks::compiledProgram()
+{
+    Uniform gray(0.5);
+    Uniform blue(0, 0, 1);
+    Grating grating(Vec2(), gray, Vec2(0.1, 0.1), blue, 0.3, 0.4);
+    Spot spot(Vec2(0.1, 0), 0.2, grating, 0.6, blue);
+    Max max(spot, gray);
+    Gradation gradation(Vec2(-0.5, 0), spot, Vec2(0.5, 0.2), grating);
+    SoftMatte soft_matte(grating, gradation, max);
+    AdjustBrightness bright(1.5, soft_matte);
+    Rotate rotate(0.3, bright);
+    Scale scale(1.3, rotate);
+    Translate translate(Vec2(0.1, 0.1), scale);
+    Multiply multiply(translate, grating);
+    AbsDiff abs_diff(translate, gray);
+    Subtract subtract(multiply, abs_diff);
+    Add add(bright, subtract);
+    Min min(add, max);
+    int count = sq(511);
+    std::vector<Vec2> positions(count);
+    std::vector<Color> colors(count);
+    RandomSequence rs(12345);
+    for (auto& p : positions) p = rs.randomPointInUnitDiameterCircle() * 2;
+    const int batch = Texture::max_batch_size;
+    double tree = secondsToRun([&]()
+    {
+        for (int i = 0; i < count; i += batch)
+        {
+            int n = std::min(batch, count - i);
+            min.getColors(n, &positions[i], &colors[i]);
+        }
+    }, 3);
+    Program program(min);
+    double compiled = secondsToRun([&]()
+        { program.run(count, positions.data(), colors.data()); }, 3);
+    std::cout << "compiledProgram: " << program.instructions().size();
+    std::cout << " instructions, 511² positions: ";
+    std::cout << tree * 1000 << " ms by getColors(), ";
+    std::cout << compiled * 1000 << " ms by Program::run()" << std::endl;
+}
+
+// Time per sample, in nanoseconds, for operators which precompute values that
+// do not vary per sample. Each warps (or blurs) a Uniform, so the time is
+// mostly the operator's own. Samples are random positions, by getColors().
+void Benchmarks::operatorSamples()
+{
+    Uniform gray(0.5);
+    Uniform white(1);
+    std::vector<std::pair<std::string, std::shared_ptr<Texture>>> cases =
+    {
+        {"Uniform", std::make_shared<Uniform>(0.5)},
+        {"Wrap", std::make_shared<Wrap>(2, Vec2(0.1, 0.2), Vec2(0.3, 1), gray)},
+        {"CotsMap", std::make_shared<CotsMap>(Vec2(-0.5, -0.4),
+                                              Vec2(-0.3, 0.6),
+                                              Vec2(0.5, 0.4),
+                                              Vec2(0.4, -0.5), gray)},
+        {"MobiusTransform", std::make_shared<MobiusTransform>(Vec2(1, 0.3),
+                                                              Vec2(0.2, 1),
+                                                              Vec2(0.5, 0.1),
+                                                              Vec2(0.8, 1),
+                                                              gray)},
+        {"Ring", std::make_shared<Ring>(7, Vec2(0.3, 0.4), Vec2(0.1, 0), gray)},
+        {"Blur", std::make_shared<Blur>(0.1, gray)},
+        {"LotsOfSpots", std::make_shared<LotsOfSpots>(0.8, 0.02, 0.2, 0.01,
+                                                      0.02, white, gray)},
+        {"ColoredSpots", std::make_shared<ColoredSpots>(0.8, 0.02, 0.2, 0.01,
+                                                        0.02, white, gray)},
+        {"LotsOfButtons", std::make_shared<LotsOfButtons>(0.8, 0.02, 0.2,
+                                                          0.01, 0.02, Vec2(),
+                                                          white, 1, gray)},
+    };
+    const int batch = Texture::max_batch_size;
+    RandomSequence rs(23456);
+    for (auto& c : cases)
+    {
+        // Fewer samples for Blur, which takes many subsamples per sample.
+        int count = (c.first == "Blur") ? sq(63) : sq(511);
+        std::vector<Vec2> positions(count);
+        std::vector<Color> colors(count);
+        for (auto& p : positions) p = rs.randomPointInUnitDiameterCircle() * 2;
+        double seconds = secondsToRun([&]()
+        {
+            for (int i = 0; i < count; i += batch)
+            {
+                int n = std::min(batch, count - i);
+                c.second->getColors(n, &positions[i], &colors[i]);
+            }
+        }, 5);
+        std::cout << "operatorSamples: " << c.first << ": ";
+        std::cout << seconds * 1e9 / count << " ns/sample" << std::endl;
+    }
+}
+
+// Time, samples per pixel, and largest pixel difference, for fixed and adaptive
+// 8x8 anti-aliasing of textures with sharp edges and with smooth regions, at
+// 255². Adaptive renders should take fewer samples and nearly match fixed.
+void Benchmarks::adaptiveAntiAliasing()
+{
+    Uniform black(0);
+    Uniform white(1);
+    ColorNoise noise(Vec2(), Vec2(0.2, 0), 0.3);
+    Grating grating(Vec2(), black, Vec2(0.1, 0.2), white, 0, 0.5);
+    Spot spot(Vec2(), 0.4, noise, 0.45, black);
+    Noise smooth(Vec2(), Vec2(1, 0), black, white);
+    std::vector<std::pair<std::string, const Texture*>> cases =
+    {
+        {"Grating", &grating},
+        {"Spot", &spot},
+        {"ColorNoise", &noise},
+        {"Noise", &smooth},
+    };
+    int saved_n = Texture::sqrt_of_aa_subsample_count;
+    float saved_threshold = Texture::getAdaptiveAAThreshold();
+    Texture::sqrt_of_aa_subsample_count = 8;
+    for (auto& c : cases)
+    {
+        // Render into the cache of a new Texture (an Add of the case and
+        // black) so that each rendering starts with an empty cache.
+        auto render = [&](float threshold, Add& add, float& samples)
+        {
+            Texture::setAdaptiveAAThreshold(threshold);
+            double s = secondsToRun([&](){ add.rasterizeToImageCache(255,
+                                                                    true); });
+            samples = Texture::getRenderSamplesPerPixel();
+            return s;
+        };
+        Add fixed(*c.second, black);
+        Add adaptive(*c.second, black);
+        float fixed_samples = 0;
+        float adaptive_samples = 0;
+        double fixed_seconds = render(0, fixed, fixed_samples);
+        double adaptive_seconds = render(adaptive_aa_threshold,
+                                         adaptive,
+                                         adaptive_samples);
+        std::cout << "adaptiveAntiAliasing: " << c.first << ": fixed ";
+        std::cout << fixed_seconds * 1000 << " ms, " << fixed_samples;
+        std::cout << " samples/pixel; adaptive " << adaptive_seconds * 1000;
+        std::cout << " ms, " << adaptive_samples << " samples/pixel; ";
+        std::cout << "max pixel difference ";
+        std::cout << Texture::maxRasterDifference(fixed, adaptive) << std::endl;
+    }
+    Texture::sqrt_of_aa_subsample_count = saved_n;
+    Texture::setAdaptiveAAThreshold(saved_threshold);
+}
+
+// Time at which each stage of progressive rendering is complete, compared to
+// time for rasterizeToImageCache(), for a ColorNoise at 511² with and without
+// 3x3 anti-aliasing. (Each render uses a new Texture, see rasterization().)
+void Benchmarks::progressiveRendering()
+{
+    ColorNoise noise(Vec2(), Vec2(0.2, 0), 0.3);
+    Uniform black(0);
+    int saved_n = Texture::sqrt_of_aa_subsample_count;
+    for (int n : {1, 3})
+    {
+        Texture::sqrt_of_aa_subsample_count = n;
+        double seconds = secondsToRun([&]()
+            { Add(noise, black).rasterizeToImageCache(511, true); });
+        std::cout << "progressiveRendering: " << n << "x" << n << " AA: ";
+        std::cout << "rasterizeToImageCache " << seconds * 1000 << " ms";
+        std::cout << ", stages done at";
+        auto start = std::chrono::high_resolution_clock::now();
+        Add(noise, black).rasterizeProgressively(511, true,
+                                                 [&](int, const cv::Mat&)
+        {
+            auto now = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> elapsed = now - start;
+            std::cout << " " << elapsed.count() * 1000 << " ms";
+        });
+        std::cout << std::endl;
+    }
+    Texture::sqrt_of_aa_subsample_count = saved_n;
+}
+
+// Time to construct LotsOfSpots for a range of densities and radius ranges.
+void Benchmarks::spotConstruction()
+{
+    // Soft edge width and margin as used for LotsOfSpots below.
+    float soft_edge_width = 0.01;
+    float margin = 0.02;
+    for (float density : {0.2, 0.5, 0.8})
+    {
+        for (auto radii : {std::make_pair(0.02f, 0.1f),
+                           std::make_pair(0.02f, 0.2f),
+                           std::make_pair(0.1f, 0.4f)})
+        {
+            int spot_count = 0;
+            double seconds = secondsToRun([&]()
+            {
+                // Make the layout directly, as SpotLayout::get() would on a
+                // miss. (Its cache already holds layouts made by textures
+                // in operatorSamples(), so LotsOfSpots would just find them.)
+                SpotLayout layout(density,
+                                  radii.first + margin,
+                                  radii.second + margin,
+                                  soft_edge_width);
+                spot_count = int(layout.spots().size());
+            });
+            std::cout << "spotConstruction: density " << density;
+            std::cout << ", radius " << radii.first << " to " << radii.second;
+            std::cout << ": " << spot_count << " spots, ";
+            std::cout << seconds * 1000 << " ms" << std::endl;
+        }
+    }
+}
+
+// Run all benchmarks above.
+void Benchmarks::allBenchmarks()
+{
+    Timer timer("Run time for benchmark suite: ", "");
+    rasterization();
+    noiseOctaveCulling();
+    compiledProgram();
+    operatorSamples();
+    adaptiveAntiAliasing();
+    progressiveRendering();
+    spotConstruction();
+}
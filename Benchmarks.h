@@ -0,0 +1,37 @@
+//
+//  Benchmarks.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  Informal performance measurements, analogous to UnitTests. These are not
+//  run by default, see "run_benchmarks" in main.cpp. Each prints its results.
+
+#pragma once
+
+namespace Benchmarks
+{
+    // Run all benchmarks below.
+    void allBenchmarks();
+    // Time to rasterize textures of various cost at 511² and 4095².
+    void rasterization();
+    // Time to render the thumbnail suite, with and without octave culling.
+    void noiseOctaveCulling();
+    // Time to evaluate a Texture tree by getColors() and as a Program.
+    void compiledProgram();
+    // Nanoseconds per sample for operators which precompute per-sample
+    // invariants (Wrap, CotsMap, MobiusTransform, Ring, Blur, LotsOfSpots,
+    // ColoredSpots, LotsOfButtons).
+    void operatorSamples();
+    // Fixed versus adaptive anti-aliasing (Texture::setAdaptiveAAThreshold()).
+    void adaptiveAntiAliasing();
+    // Threshold used by adaptiveAntiAliasing().
+    const float adaptive_aa_threshold = 0.02;
+    // Time to each stage of Texture::rasterizeProgressively().
+    void progressiveRendering();
+    // Time to make the SpotLayout of a LotsOfSpots (mostly DiskOccupancyGrid
+    // relaxation) for a range of spot densities and radius ranges, bypassing
+    // the layout cache.
+    void spotConstruction();
+}
@@ -0,0 +1,156 @@
+//
+//  BudgetedLru.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/16/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  A thread safe cache of immutable values, shared by any number of "owner"
+//  objects, within one memory budget. When the budget is exceeded the least
+//  recently used values, from whichever owner, are evicted. Values are held by
+//  shared_ptr, so one in use on another thread remains valid until that use is
+//  done. Used for the tiles of MipCache and of Blur's raster, and for
+//  SpotLayout's layouts (whose owner is always nullptr).
+//
+//  A missing value is made outside the lock, so other threads are not kept
+//  waiting. If two threads make the same value at once, one result is
+//  discarded. An owner calls eraseOwner() from its destructor.
+
+#pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+template <typename Key,
+          typename Value,
+          template <typename...> class Map = std::unordered_map>
+class BudgetedLru
+{
+public:
+    // "bytes" gives the memory used by a value.
+    BudgetedLru(size_t memory_budget, size_t (*bytes)(const Value&))
+      : memory_budget_(memory_budget), bytes_(bytes) {}
+
+    // Look up value, marking it most recently used, or make it by calling
+    // "make" (outside the lock) and insert it, evicting others as needed to
+    // stay within budget. Sets "*made" to whether "make" was called.
+    template <typename Make>
+    std::shared_ptr<const Value> get(const void* owner,
+                                     const Key& key,
+                                     Make make,
+                                     bool* made = nullptr)
+    {
+        if (made) *made = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found_owner = owners_.find(owner);
+            if (found_owner != owners_.end())
+            {
+                auto found = found_owner->second.find(key);
+                if (found != found_owner->second.end())
+                {
+                    lru_.splice(lru_.begin(), lru_, found->second.lru);
+                    return found->second.value;
+                }
+            }
+        }
+        if (made) *made = true;
+        std::shared_ptr<const Value> value = make();
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto inserted = owners_[owner].insert({key, Entry()});
+        Entry& entry = inserted.first->second;
+        if (inserted.second)
+        {
+            entry.value = value;
+            entry.bytes = bytes_(*value);
+            lru_.push_front({owner, key});
+            entry.lru = lru_.begin();
+            memory_used_ += entry.bytes;
+            evict(1);
+        }
+        return entry.value;
+    }
+
+    // Remove all of this owner's values.
+    void eraseOwner(const void* owner)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found_owner = owners_.find(owner);
+        if (found_owner == owners_.end()) return;
+        for (auto& entry : found_owner->second)
+        {
+            memory_used_ -= entry.second.bytes;
+            lru_.erase(entry.second.lru);
+        }
+        owners_.erase(found_owner);
+    }
+
+    // Get/set memory budget (in bytes), and get the amount now used. Setting a
+    // smaller budget evicts values as needed.
+    size_t getMemoryBudget() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return memory_budget_;
+    }
+    void setMemoryBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        memory_budget_ = bytes;
+        evict(0);
+    }
+    size_t getMemoryUsed() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return memory_used_;
+    }
+
+    // Number of values now held for this owner, and for all owners.
+    int size(const void* owner) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found_owner = owners_.find(owner);
+        return ((found_owner == owners_.end()) ?
+                0 : int(found_owner->second.size()));
+    }
+    int size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return int(lru_.size());
+    }
+
+private:
+    // Values of all owners, most recently used first.
+    typedef std::list<std::pair<const void*, Key>> LruList;
+    class Entry
+    {
+    public:
+        std::shared_ptr<const Value> value;
+        size_t bytes = 0;
+        typename LruList::iterator lru;
+    };
+
+    // Evict values from the back of the LRU list (least recently used first)
+    // until within budget, keeping at least "keep" of the most recently used.
+    // Caller holds "mutex_".
+    void evict(size_t keep)
+    {
+        while ((lru_.size() > keep) && (memory_used_ > memory_budget_))
+        {
+            auto& back = lru_.back();
+            auto found_owner = owners_.find(back.first);
+            auto found = found_owner->second.find(back.second);
+            memory_used_ -= found->second.bytes;
+            found_owner->second.erase(found);
+            if (found_owner->second.empty()) owners_.erase(found_owner);
+            lru_.pop_back();
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::unordered_map<const void*, Map<Key, Entry>> owners_;
+    LruList lru_;
+    size_t memory_budget_;
+    size_t memory_used_ = 0;
+    size_t (*const bytes_)(const Value&);
+};
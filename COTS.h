@@ -60,6 +60,17 @@ public:
         mv = spiralScale(getA(), getD(), getB(), getC());
         // Fixed point of map.
         setF(SpiralCenter(au, mu, getA(), getD()));
+        updateInverseParameters();
+    }
+
+    // Recompute values used by Inverse() which do not depend on its argument.
+    void updateInverseParameters()
+    {
+        amin = std::min(std::min(0.0f, au + av), std::min(au, av));
+        amax = std::max(std::max(0.0f, au + av), std::max(au, av));
+        mmin = std::min(std::min(1.0f, mu * mv), std::min(mu, mv));
+        log_mv = log(mv);
+        map_inv_denominator = log(mu) * av - log_mv * au;
     }
 
     // Computes inverse COTS mapping: from the position of a point in the range
@@ -70,24 +81,20 @@ public:
     {
         Vec2 Mi;
         float x, y;
-        float amin = std::min(std::min(0.0f, au + av), std::min(au, av));
-        float amax = std::max(std::max(0.0f, au + av), std::max(au, av));
-        float mmin = std::min(std::min(1.0f, mu * mv), std::min(mu, mv));
         float pm = distance(getF(), M) / distance(getF(), getA());
         float pa = angle(getA() - getF(), M - getF());
-        auto MapInv = [&](float a, float m,
-                          Vec2 F, Vec2 A,
-                          float au, float mu,
-                          float av, float mv)
+        // Same for each angle "a" tried below.
+        auto log_pm = log(pm);
+        auto MapInv = [&](float a)
         {
-            float u = (log(m)*av-log(mv)*a) / (log(mu)*av-log(mv)*au);
+            float u = (log_pm*av-log_mv*a) / map_inv_denominator;
             float v = (a-u*au)/av;
             return Vec2(u, v);
         };
         for (int i = -2; i <= 2; i++)
         {
             float ppa = pa + (2 * pi * i);
-            Mi = MapInv(ppa, pm, getF(), getA(), au,  mu,  av,  mv);
+            Mi = MapInv(ppa);
             x = Mi.x(); y = Mi.y();
             if((amin < ppa) && (ppa < amax) && (mmin < pm) &&
                (0 <= x) && (x <= 1) && (0 <= y) && (y <= 1))
@@ -95,7 +102,7 @@ public:
                 return Mi;
             }
         }
-        return MapInv(pa, pm, getF(), getA(),  au,  mu,  av,  mv);
+        return MapInv(pa);
     }
         
     // NOTE: this is not called in TexSyn. It is used in the original Processing
@@ -139,6 +146,7 @@ public:
             au=pau+aue; av=pav+ave;
         }
         setF(SpiralCenter(au, mu, getA(), getD()));
+        updateInverseParameters();
     }
     
     // Spiral utilities.
@@ -178,4 +186,12 @@ private:
     // Should these be Vec2 ?
     float mu=1, mv=1;                       // spiral scalings
     float au=0, av=0;                       // spiral angles
+    // Cached by updateInverseParameters() for Inverse(). The logs have the
+    // type log() returns for a float here (float or double, depending on the
+    // standard library) as in the original per-sample expression, so Inverse()
+    // rounds exactly as it did.
+    typedef decltype(log(float())) LogOfFloat;
+    float amin=0, amax=0, mmin=1;           // bounds on angle and scale
+    LogOfFloat log_mv=0;                    // log(mv)
+    LogOfFloat map_inv_denominator=0;       // denominator of u in MapInv
 };
@@ -9,140 +9,195 @@
 //
 
 #include "Disk.h"
+#include "ThreadPool.h"
+#include <algorithm>
 
 // Relaxation process that attempts to reduce the overlaps in an arbitrary
 // collection of Disks. Overlapping Disks are pushed away from each other
 // along the line connecting their centers. The whole process is repeated
 // "retries" times, or until none overlap.
 //
-// This uses parallel threads and spatial data structures. For consistent
-// results, the work is broken into two sequential steps, each of which runs
-// in parallel. Step one: find overlaps and compute Disk's future position.
-// Step two: move Disk and update occupancy grid.
+// Each iteration rebuilds a spatial hash of the current positions, then (in
+// parallel) computes every Disk's next position from the current ones. When
+// done, Disks which moved are updated in the occupancy grid.
 void DiskOccupancyGrid::reduceDiskOverlap(int retries, std::vector<Disk>& disks)
 {
+    int disk_count = int(disks.size());
+    std::vector<Vec2> positions(disk_count);
+    std::vector<Vec2> next_positions(disk_count);
+    for (int i = 0; i < disk_count; i++) positions[i] = disks[i].position;
+    IndexGrid index_grid;
     // Repeat relaxation process "retries" times, or until no overlaps remain.
     for (int i = 0; i < retries; i++)
     {
-        // For each Disk, find nearest overlapping neighbor, compute minimal
-        // move to avoid overlap, save that position.
-        bool no_move = true;
-        parallelDiskUpdate(disks,
-                           [&](int first_disk_index, int disk_count)
-                           { return std::thread(&DiskOccupancyGrid::
-                                                oneThreadAdjustingSpots,
-                                                this,
-                                                first_disk_index,
-                                                disk_count,
-                                                float(i) / retries,
-                                                std::ref(no_move),
-                                                std::ref(disks)); });
-
+        buildIndexGrid(disks, positions, index_grid);
+        std::atomic<bool> moved(false);
+        parallelDiskUpdate(disk_count,
+                           [&](int first_disk_index, int block_count)
+                           { relaxDisks(first_disk_index,
+                                        block_count,
+                                        float(i) / retries,
+                                        disks,
+                                        index_grid,
+                                        positions,
+                                        next_positions,
+                                        moved); });
         // Exit adjustment loop if no overlapping Disks found.
-        if (no_move) break;
-        
-        // Now move the overlapping Disks, in a thread-safe way, to the
-        // future_position computed in the first pass. Each Disk is erased
-        // from the grid, moved, then re-inserted into the grid.
-        parallelDiskUpdate(disks,
-                           [&](int first_disk_index, int disk_count)
-                           { return std::thread(&DiskOccupancyGrid::
-                                                oneThreadMovingSpots,
-                                                this,
-                                                first_disk_index,
-                                                disk_count,
-                                                std::ref(disks)); });
+        if (!moved) break;
+        positions.swap(next_positions);
+    }
+    // Update grid and Disks for those which moved.
+    for (int i = 0; i < disk_count; i++)
+    {
+        Disk& disk = disks[i];
+        if (disk.position != positions[i])
+        {
+            eraseDiskWrap(disk);
+            disk.position = positions[i];
+            insertDiskWrap(disk);
+        }
+        disk.future_position = disk.position;
     }
 }
 
-// Runs parallel update of all Disks. Parameter is function to generate one
-// thread, given "first_disk_index" and "disk_count" in vector "disks". Each
-// thread updates this given block of disks, in parallel with other threads.
-void DiskOccupancyGrid::parallelDiskUpdate(std::vector<Disk>& disks,
-                                           std::function<std::thread(int, int)>
-                                               thread_maker)
+// Runs parallel update of "disk_count" Disks. Parameter is a function to
+// update one block of Disks, given "first_disk_index" and "disk_count".
+// Each block is a task run on the shared ThreadPool, in parallel with others.
+void DiskOccupancyGrid::parallelDiskUpdate(int disk_count,
+                                           std::function<void(int, int)>
+                                               block_updater)
 {
     // TODO I arbitrarily set this to 40 (rendering uses 512.) then noticed
     // it got faster as I reduced it, with minimum at 8. In case that is not
-    // a coincidence (my laptop has 8 hyperthreads) I left it as one thread
-    // per hardware processor.
-    int thread_count = std::thread::hardware_concurrency();
-    int disks_per_thread = int(disks.size()) / thread_count;
-    // Collection of worker threads.
-    std::vector<std::thread> all_threads;
-    for (int t = 0; t <= thread_count; t++)
-    {
-        int first_disk_index = t * disks_per_thread;
-        int disk_count = ((t == thread_count)?
-                          int(disks.size()) - first_disk_index:
-                          disks_per_thread);
-        all_threads.push_back(thread_maker(first_disk_index, disk_count));
-    }
-    // Wait for all row threads to finish.
-    for (auto& t : all_threads) t.join();
+    // a coincidence (my laptop has 8 hyperthreads) I left it as one block
+    // per hardware processor. (Now one block per ThreadPool worker.)
+    int block_count = ThreadPool::getInstance().getWorkerCount();
+    int disks_per_block = std::max(1, disk_count / block_count);
+    ThreadPool::getInstance().parallelFor(disk_count,
+                                          disks_per_block,
+                                          block_updater);
 }
 
-// Top level for each worker thread moving spots. For "disk_count" Disks
-// beginning at "first_disk_index": if the Disk's "future_position" has
-// changed, erase it from the grid, update its position, then re-insert it
-// back into the grid.
-void DiskOccupancyGrid::oneThreadMovingSpots(int first_disk_index,
-                                             int disk_count,
-                                             std::vector<Disk>& disks)
+// Counting sort of Disk indices into cells: count each cell's Disks, convert
+// counts to start offsets, then fill. Disks are visited in index order, so
+// each cell's indices are in increasing order.
+void DiskOccupancyGrid::buildIndexGrid(const std::vector<Disk>& disks,
+                                       const std::vector<Vec2>& positions,
+                                       IndexGrid& index_grid) const
 {
-    for (int disk_index = first_disk_index;
-         disk_index < (first_disk_index + disk_count);
-         disk_index++)
-    {
-        Disk& disk = disks.at(disk_index);
-        if (disk.position != disk.future_position)
-        {
-            eraseDiskWrap(disk);
-            disk.position = disk.future_position;
-            insertDiskWrap(disk);
-        }
-    }
+    std::vector<int>& starts = index_grid.cell_starts;
+    starts.assign(sq(grid_side_count_) + 1, 0);
+    for (size_t d = 0; d < disks.size(); d++)
+        forWrappedDiskCells(Disk(disks[d].radius, positions[d]),
+                            [&](int c){ starts[c + 1]++; });
+    for (size_t c = 1; c < starts.size(); c++) starts[c] += starts[c - 1];
+    index_grid.disk_indices.resize(starts.back());
+    std::vector<int> next(starts.begin(), starts.end() - 1);
+    std::vector<int>& indices = index_grid.disk_indices;
+    for (size_t d = 0; d < disks.size(); d++)
+        forWrappedDiskCells(Disk(disks[d].radius, positions[d]),
+                            [&](int c){ indices[next[c]++] = int(d); });
 }
 
-// Top level for each worker thread adjusting spot overlap. For "disk_count"
-// Disks beginning at "first_disk_index": look up nearest neighbor, if
-// overlap compute new position.
-void DiskOccupancyGrid::oneThreadAdjustingSpots(int first_disk_index,
-                                                int disk_count,
-                                                float retry_fraction,
-                                                bool& no_move,
-                                                std::vector<Disk>& disks)
+// For "disk_count" Disks beginning at "first_disk_index": find overlapping
+// neighbors at "positions", push away from them, store in next_positions.
+// Neighbors are visited in index order, so the sum of adjustments (hence the
+// result) is the same whatever the blocking.
+void DiskOccupancyGrid::relaxDisks(int first_disk_index,
+                                   int disk_count,
+                                   float retry_fraction,
+                                   const std::vector<Disk>& disks,
+                                   const IndexGrid& index_grid,
+                                   const std::vector<Vec2>& positions,
+                                   std::vector<Vec2>& next_positions,
+                                   std::atomic<bool>& moved) const
 {
-    for (int disk_index = first_disk_index;
-         disk_index < (first_disk_index + disk_count);
-         disk_index++)
+    bool block_moved = false;
+    std::vector<int> neighbors;
+    float fade = interpolate(retry_fraction, 1.0, 0.5);
+    for (int a = first_disk_index; a < first_disk_index + disk_count; a++)
     {
-        Disk& a = disks.at(disk_index);
-        std::set<Disk*> disks_near_a;
-        findNearbyDisks(a, disks_near_a);
-        for (Disk* pointer_to_disk : disks_near_a)
+        Vec2 a_position = positions[a];
+        float a_radius = disks[a].radius;
+        // Collect (unique, sorted) indices of Disks in cells a overlaps.
+        neighbors.clear();
+        Disk query(a_radius, a_position);
+        if (gridOverlapsDisk(query))
         {
-            Disk& b = *pointer_to_disk;
-            if (&a != &b)  // Ignore self overlap.
+            int i_max = xToI(a_position.x() + a_radius);
+            int j_min = xToI(a_position.y() - a_radius);
+            int j_max = xToI(a_position.y() + a_radius);
+            for (int i = xToI(a_position.x() - a_radius); i <= i_max; i++)
             {
-                Vec2 b_tile = nearestByTiling(a.position, b.position);
-                Vec2 offset = a.position - b_tile;
+                for (int j = j_min; j <= j_max; j++)
+                {
+                    int c = (i * grid_side_count_) + j;
+                    neighbors.insert(neighbors.end(),
+                        &index_grid.disk_indices[index_grid.cell_starts[c]],
+                        &index_grid.disk_indices[index_grid.cell_starts[c+1]]);
+                }
+            }
+        }
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()),
+                        neighbors.end());
+        Vec2 next = a_position;
+        for (int b : neighbors)
+        {
+            if (a != b)  // Ignore self overlap.
+            {
+                Vec2 b_tile = nearestByTiling(a_position, positions[b]);
+                Vec2 offset = a_position - b_tile;
                 float distance = offset.length();
-                float radius_sum = a.radius + b.radius;
+                float radius_sum = a_radius + disks[b].radius;
                 if (distance < radius_sum)
                 {
-                    no_move = false;
+                    block_moved = true;
                     Vec2 basis = offset / distance;
-                    float fade = interpolate(retry_fraction, 1.0, 0.5);
                     float adjust = (radius_sum - distance) * fade;
-                    a.future_position += basis * adjust;
+                    next += basis * adjust;
                 }
             }
         }
-        Vec2 before = a.future_position;
-        a.future_position = wrapToCenterTile(a.future_position);
-        if (a.future_position != before) no_move = false;
+        Vec2 before = next;
+        next = wrapToCenterTile(next);
+        if (next != before) block_moved = true;
+        next_positions[a] = next;
     }
+    if (block_moved) moved = true;
+}
+
+// Copy the grid's Disk pointers into a flat "compressed sparse row" layout:
+// one array of all cells' Disk pointers, in cell order, and for each cell the
+// offset of its first one.
+void DiskOccupancyGrid::flatten()
+{
+    cell_starts_.clear();
+    cell_disks_.clear();
+    cell_starts_.reserve(sq(grid_side_count_) + 1);
+    for (int i = 0; i < grid_side_count_; i++)
+    {
+        for (int j = 0; j < grid_side_count_; j++)
+        {
+            cell_starts_.push_back(int(cell_disks_.size()));
+            for (Disk* d : *getSetFromGrid(i, j)) cell_disks_.push_back(d);
+        }
+    }
+    cell_starts_.push_back(int(cell_disks_.size()));
+}
+
+// Approximate memory used by this grid in bytes. Each std::set entry is a
+// tree node, assumed to be the pointer plus three links and a color word.
+size_t DiskOccupancyGrid::approximateBytes() const
+{
+    size_t set_entries = 0;
+    for (auto& row : grid_)
+        for (auto& cell : row) set_entries += cell.size();
+    return (sizeof(DiskOccupancyGrid) +
+            sq(grid_side_count_) * sizeof(Cell) +
+            set_entries * 5 * sizeof(void*) +
+            cell_starts_.capacity() * sizeof(int) +
+            cell_disks_.capacity() * sizeof(const Disk*));
 }
 
 // Given a reference point (say to be rendered), and the center of a Spot,
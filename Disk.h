@@ -11,6 +11,7 @@
 #pragma once
 #include "Utilities.h"
 #include "Vec2.h"
+#include <atomic>
 #include <set>
 #include <thread>
 
@@ -106,8 +107,32 @@ public:
         applyToCellsInRect(query, collectCellDisks);
     }
     
+    // Flat, read-only copy of the grid, for fast queries once Disks stop
+    // moving. flatten() copies each cell's Disk pointers (in the same order
+    // as its std::set) into one contiguous array, indexed by an array of
+    // per-cell start offsets ("compressed sparse row" layout). Later changes
+    // to the grid are not reflected until flatten() is called again.
+    void flatten();
+    bool isFlattened() const { return !cell_starts_.empty(); }
+    // Approximate memory used by this grid (cells, sets, flat grid) in bytes.
+    size_t approximateBytes() const;
+    // Call "function" with (a const reference to) each Disk in the grid cell
+    // containing "point", using the flat grid. Each Disk is visited once, in
+    // the same order as findNearbyDisks() would return them. Makes no heap
+    // allocations, so is suitable for per-sample use.
+    template <typename F> void forDisksNearPoint(Vec2 point, F function) const
+    {
+        assert(isFlattened() && "call flatten() before forDisksNearPoint()");
+        if (gridOverlapsDisk(Disk(0, point)))
+        {
+            int cell = (xToI(point.x()) * grid_side_count_) + xToI(point.y());
+            for (int k = cell_starts_[cell]; k < cell_starts_[cell + 1]; k++)
+                function(*cell_disks_[k]);
+        }
+    }
+
     // Is any portion of the given Disk inside the bounds of our grid?
-    bool gridOverlapsDisk(const Disk& disk)
+    bool gridOverlapsDisk(const Disk& disk) const
     {
         return ((disk.position.x() + disk.radius >= minXY_.x()) &&
                 (disk.position.y() + disk.radius >= minXY_.y()) &&
@@ -188,31 +213,19 @@ public:
     // along the line connecting their centers. The whole process is repeated
     // "retries" times, or until none overlap.
     //
-    // This uses parallel threads and spatial data structures. For consistent
-    // results, the work is broken into two sequential steps, each of which runs
-    // in parallel. Step one: find overlaps and compute Disk's future position.
-    // Step two: move Disk and update occupancy grid.
+    // Each iteration is a "Jacobi" step: every Disk's next position depends
+    // only on the current positions, so results do not depend on thread count
+    // or scheduling. Positions are double buffered: a spatial hash of current
+    // positions is rebuilt from scratch (cheap, no locks) then all Disks write
+    // their next position in parallel. The occupancy grid itself is updated
+    // once, at the end, for those Disks which moved.
     void reduceDiskOverlap(int retries, std::vector<Disk>& disks);
-    // Runs parallel update of all Disks. Parameter is function to generate one
-    // thread, given "first_disk_index" and "disk_count" in vector "disks". Each
-    // thread updates this given block of disks, in parallel with other threads.
-    void parallelDiskUpdate(std::vector<Disk>& disks,
-                            std::function<std::thread(int, int)> thread_maker);
-    // Top level for each worker thread adjusting spot overlap. For "disk_count"
-    // Disks beginning at "first_disk_index": look up nearest neighbor, if
-    // overlap compute new position.
-        void oneThreadAdjustingSpots(int first_disk_index,
-                                     int disk_count,
-                                     float retry_fraction,
-                                     bool& no_move,
-                                     std::vector<Disk>& disks);
-    // Top level for each worker thread moving spots. For "disk_count" Disks
-    // beginning at "first_disk_index": if the Disk's "future_position" has
-    // changed, erase it from the grid, update its position, then re-insert it
-    // back into the grid.
-    void oneThreadMovingSpots(int first_disk_index,
-                              int disk_count,
-                              std::vector<Disk>& disks);
+    // Runs parallel update of "disk_count" Disks. Parameter is a function to
+    // update one block of Disks, given "first_disk_index" and "disk_count".
+    // Each block is a task run on the shared ThreadPool, in parallel with
+    // other blocks.
+    void parallelDiskUpdate(int disk_count,
+                            std::function<void(int, int)> block_updater);
     // Given a reference point (say to be rendered), and the center of a Spot,
     // adjust "spot_center" with regard to tiling, to be the nearest (perhaps in
     // another tile) to "reference_point".
@@ -246,6 +259,7 @@ private:
         Cell(){}
         Cell(const Cell& cell) : set_(cell.set_) {}
         std::set<Disk*>* getSet() { return &set_; }
+        size_t size() const { return set_.size(); }
         void insert(Disk* d)
         {
             // Wait to grab cell lock. (Lock released at end of block)
@@ -263,4 +277,55 @@ private:
         std::mutex cell_mutex_;
     };
     std::vector<std::vector<Cell>> grid_;
+    // Flat grid (see flatten()): Disks in cell (i, j) are cell_disks_[k] for
+    // cell_starts_[c] <= k < cell_starts_[c + 1] where c = i * side + j.
+    std::vector<int> cell_starts_;
+    std::vector<const Disk*> cell_disks_;
+    // Spatial hash used by reduceDiskOverlap(): for each cell, the indices of
+    // Disks whose (wrapped) bounding squares overlap it, in increasing order,
+    // in the same layout as the flat grid above.
+    class IndexGrid
+    {
+    public:
+        std::vector<int> cell_starts;
+        std::vector<int> disk_indices;
+    };
+    void buildIndexGrid(const std::vector<Disk>& disks,
+                        const std::vector<Vec2>& positions,
+                        IndexGrid& index_grid) const;
+    // For "disk_count" Disks beginning at "first_disk_index": find overlapping
+    // neighbors at "positions", push away from them, store in next_positions.
+    // Sets "moved" if any Disk's position changed.
+    void relaxDisks(int first_disk_index,
+                    int disk_count,
+                    float retry_fraction,
+                    const std::vector<Disk>& disks,
+                    const IndexGrid& index_grid,
+                    const std::vector<Vec2>& positions,
+                    std::vector<Vec2>& next_positions,
+                    std::atomic<bool>& moved) const;
+    // Call function(c) for flat index "c" of each cell overlapped by bounding
+    // squares of the (up to 4) wrapped images of a Disk, as diskWrapUtility().
+    // A cell may be visited more than once.
+    template <typename F>
+    void forWrappedDiskCells(const Disk& d, F function) const
+    {
+        float tile_size = maxXY_.x() - minXY_.x();
+        Vec2 wrap_x(d.position.x() > 0 ? -tile_size : tile_size, 0);
+        Vec2 wrap_y(0, d.position.y() > 0 ? -tile_size : tile_size);
+        for (Vec2 offset : {Vec2(), wrap_x, wrap_y, wrap_x + wrap_y})
+        {
+            Disk image = d.translate(offset);
+            if (gridOverlapsDisk(image))
+            {
+                int i_max = xToI(image.position.x() + image.radius);
+                int j_min = xToI(image.position.y() - image.radius);
+                int j_max = xToI(image.position.y() + image.radius);
+                for (int i = xToI(image.position.x() - image.radius);
+                     i <= i_max; i++)
+                    for (int j = j_min; j <= j_max; j++)
+                        function((i * grid_side_count_) + j);
+            }
+        }
+    }
 };
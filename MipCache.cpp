@@ -0,0 +1,147 @@
+//
+//  MipCache.cpp
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/16/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+
+#include "MipCache.h"
+
+constexpr float MipCache::default_finest_spacing;
+BudgetedLru<uint64_t, MipCache::Tile>
+MipCache::tiles_(64 * 1024 * 1024, [](const Tile&) { return tile_bytes; });
+
+// Remove this MipCache's tiles from the shared cache.
+MipCache::~MipCache()
+{
+    tiles_.eraseOwner(this);
+}
+
+// Trilinear lookup at the current SampleFootprint, or sample input directly if
+// that is unknown or finer than level 0.
+Color MipCache::getColor(Vec2 position) const
+{
+    float footprint = SampleFootprint::get();
+    if (!(footprint > finest_spacing_)) return texture_.getColor(position);
+    float level = levelForFootprint(footprint);
+    int lower = std::floor(level);
+    float fraction = level - lower;
+    Color color = levelColor(lower, position);
+    if (fraction == 0) return color;
+    return interpolate(fraction, color, levelColor(lower + 1, position));
+}
+
+// Continuous level for footprint, clamped to the range of levels.
+float MipCache::levelForFootprint(float footprint) const
+{
+    float level = std::log2(std::max(footprint, finest_spacing_) /
+                            finest_spacing_);
+    return std::min(level, float(levels - 1));
+}
+
+// Bilinear interpolation between the four texel centers around "position".
+// They may be in as many as four tiles, which are looked up only as needed.
+Color MipCache::levelColor(int level, Vec2 position) const
+{
+    float spacing = finest_spacing_ * (1 << level);
+    float gx = (position.x() / spacing) - 0.5f;
+    float gy = (position.y() / spacing) - 0.5f;
+    float fx = std::floor(gx);
+    float fy = std::floor(gy);
+    int n = tile_texels;
+    int last_x = 0;
+    int last_y = 0;
+    std::shared_ptr<const Tile> last_tile;
+    auto texel = [&](int i, int j)
+    {
+        // Tile indices, rounding toward negative infinity.
+        int x = (i >= 0) ? i / n : -((n - 1 - i) / n);
+        int y = (j >= 0) ? j / n : -((n - 1 - j) / n);
+        if (!last_tile || x != last_x || y != last_y)
+        {
+            last_tile = tile(level, x, y);
+            last_x = x;
+            last_y = y;
+        }
+        return (*last_tile)[((j - y * n) * n) + (i - x * n)];
+    };
+    int i = int(fx);
+    int j = int(fy);
+    float tx = gx - fx;
+    float ty = gy - fy;
+    return interpolate(ty,
+                       interpolate(tx, texel(i, j), texel(i + 1, j)),
+                       interpolate(tx, texel(i, j + 1), texel(i + 1, j + 1)));
+}
+
+// Look up tile, marking it most recently used, or compute it (outside the
+// lock) and insert it, evicting others as needed to stay within budget.
+std::shared_ptr<const MipCache::Tile> MipCache::tile(int level,
+                                                     int x,
+                                                     int y) const
+{
+    return tiles_.get(this,
+                      key(level, x, y),
+                      [&]() { return computeTile(level, x, y); });
+}
+
+// Sample input at 2x2 subsamples per texel, one batch per row of subsamples,
+// with the footprint set to the subsample spacing, then average each 2x2.
+std::shared_ptr<const MipCache::Tile> MipCache::computeTile(int level,
+                                                            int x,
+                                                            int y) const
+{
+    static_assert(tile_texels * 2 <= max_batch_size,
+                  "each row of subsamples must fit in a batch");
+    float spacing = finest_spacing_ * (1 << level);
+    float half = spacing / 2;
+    int n = tile_texels;
+    auto tile = std::make_shared<Tile>(n * n, Color(0, 0, 0));
+    SampleFootprint::Scope scope(half);
+    Vec2 positions[max_batch_size];
+    Color colors[max_batch_size];
+    for (int j = 0; j < n; j++)
+    {
+        for (int row = 0; row < 2; row++)
+        {
+            float py = ((y * n + j) * spacing) + ((row + 0.5f) * half);
+            for (int s = 0; s < 2 * n; s++)
+                positions[s] = Vec2(((x * n * 2 + s) + 0.5f) * half, py);
+            texture_.getColors(2 * n, positions, colors);
+            Color* texels = &(*tile)[j * n];
+            for (int i = 0; i < n; i++)
+                texels[i] += (colors[2 * i] + colors[2 * i + 1]) * 0.25f;
+        }
+    }
+    return tile;
+}
+
+// Level in top 4 bits, then 30 bits each of tile x and y indices.
+uint64_t MipCache::key(int level, int x, int y)
+{
+    uint64_t mask = (uint64_t(1) << 30) - 1;
+    return ((uint64_t(level) << 60) |
+            ((uint64_t(uint32_t(x)) & mask) << 30) |
+            (uint64_t(uint32_t(y)) & mask));
+}
+
+size_t MipCache::getMemoryBudget()
+{
+    return tiles_.getMemoryBudget();
+}
+
+void MipCache::setMemoryBudget(size_t bytes)
+{
+    tiles_.setMemoryBudget(bytes);
+}
+
+size_t MipCache::getMemoryUsed()
+{
+    return tiles_.getMemoryUsed();
+}
+
+int MipCache::tileCount() const
+{
+    return tiles_.size(this);
+}
@@ -0,0 +1,70 @@
+//
+//  MipCache.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/16/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  MipCache is an operator which may be inserted above any subtree, typically
+//  one sampled by a filtering operator (Blur, EdgeDetect, EdgeEnhance, Shader)
+//  or sampled repeatedly at coarse footprints. It keeps a pyramid of
+//  prefiltered rasters of its input (a "mipmap") and answers getColor() at the
+//  current SampleFootprint with a trilinear lookup: bilinear within the two
+//  levels whose texel sizes bracket the footprint, interpolated between them.
+//
+//  Level 0 has texels "finest_spacing" wide, each level above has texels twice
+//  as wide as the one below. Levels are stored as square tiles, computed as
+//  they are first touched, so only the region actually queried is rasterized.
+//  Each tile is sampled directly from the input (2x2 subsamples per texel, with
+//  the SampleFootprint set to the subsample spacing) rather than by reducing
+//  the level below, so a coarse query never requires a fine rasterization.
+//  When the footprint is unknown (0) or finer than level 0, the input is
+//  sampled directly, so a MipCache never adds detail or blur at fine scales.
+//
+//  Tiles of all MipCaches share one memory budget. When it is exceeded the
+//  least recently used tiles, from whichever MipCache, are evicted. A tile in
+//  use by a lookup on another thread remains valid until that lookup is done.
+
+#pragma once
+#include "Texture.h"
+#include "BudgetedLru.h"
+#include <memory>
+
+class MipCache : public Texture
+{
+public:
+    MipCache(const Texture& texture)
+      : MipCache(default_finest_spacing, texture) {}
+    MipCache(float finest_spacing, const Texture& texture)
+      : finest_spacing_(std::max(finest_spacing, 0.00001f)),
+        texture_(texture) {}
+    ~MipCache();
+    Color getColor(Vec2 position) const override;
+    // Get/set memory budget (in bytes) for tiles of all MipCaches, and get the
+    // amount now used. Setting a smaller budget evicts tiles as needed.
+    static size_t getMemoryBudget();
+    static void setMemoryBudget(size_t bytes);
+    static size_t getMemoryUsed();
+    // Number of tiles this MipCache now holds.
+    int tileCount() const;
+    // Texel size of the finest level, and level used for a given footprint.
+    float finestSpacing() const { return finest_spacing_; }
+    float levelForFootprint(float footprint) const;
+    static constexpr float default_finest_spacing = 1.0f / 256;
+    static const int levels = 12;
+    static const int tile_texels = 32;
+    static const size_t tile_bytes = tile_texels * tile_texels * sizeof(Color);
+private:
+    typedef std::vector<Color> Tile;
+    // Bilinear lookup of "position" on given level.
+    Color levelColor(int level, Vec2 position) const;
+    // Get tile at given level and indices, computing it if needed.
+    std::shared_ptr<const Tile> tile(int level, int x, int y) const;
+    std::shared_ptr<const Tile> computeTile(int level, int x, int y) const;
+    // Pack level and tile indices into one key.
+    static uint64_t key(int level, int x, int y);
+    const float finest_spacing_;
+    const Texture& texture_;
+    // Tiles of all MipCaches, each owned by the MipCache which computed it.
+    static BudgetedLru<uint64_t, Tile> tiles_;
+};
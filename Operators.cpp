@@ -11,7 +11,7 @@
 // some static data members.
 
 #include "Operators.h"
-#include <thread>
+#include "ThreadPool.h"
 
 // Compare textures, print stats, optional file, display inputs and AbsDiff.
 void Texture::diff(const Texture& t0,
@@ -20,22 +20,8 @@ void Texture::diff(const Texture& t0,
                    int size,
                    bool binary)
 {
+    diffStatistics(t0, t1, size, true);
     AbsDiff abs_diff(t0, t1);
-    int pixel_count = 0;
-    Color total_color(0, 0, 0);
-    int mismatch_count = 0;
-    Texture::rasterizeDisk(size,
-                           [&](int i, int j, Vec2 position)
-                           {
-                               Color diff = abs_diff.getColor(position);
-                               total_color += diff;
-                               pixel_count++;
-                               if (diff != Color()) mismatch_count++;
-                           });
-    debugPrint(pixel_count);
-    debugPrint(total_color);
-    debugPrint(total_color / pixel_count);
-    debugPrint(mismatch_count);
     NotEqual not_equal(t0, t1);
     const Texture* compare = (binary ?
                               (Texture*)(&not_equal) :
@@ -43,6 +29,61 @@ void Texture::diff(const Texture& t0,
     Texture::displayAndFile3(t0, t1, *compare, pathname, size);
 }
 
+// Compare textures over a disk "size" pixels in diameter, optionally printing
+// statistics. Returns the largest difference in any RGB component.
+float Texture::diffStatistics(const Texture& t0,
+                              const Texture& t1,
+                              int size,
+                              bool print)
+{
+    AbsDiff abs_diff(t0, t1);
+    // Accumulate per-column totals in parallel (on the shared ThreadPool) then
+    // sum them in column order, so results do not depend on task scheduling.
+    int half = size / 2;
+    std::vector<int> column_pixel_counts(size, 0);
+    std::vector<Color> column_total_colors(size, Color(0, 0, 0));
+    std::vector<int> column_mismatch_counts(size, 0);
+    std::vector<float> column_max_errors(size, 0);
+    ThreadPool::getInstance().parallelFor(size, [&](int column)
+    {
+        int i = column - half;
+        for (int j = -half; j <= half; j++)
+        {
+            if (std::sqrt(sq(i) + sq(j)) <= half)
+            {
+                Vec2 position(i / float(half), j / float(half));
+                Color diff = abs_diff.getColor(position);
+                column_total_colors[column] += diff;
+                column_pixel_counts[column]++;
+                if (diff != Color()) column_mismatch_counts[column]++;
+                float error = std::max({diff.r(), diff.g(), diff.b()});
+                float& max_error = column_max_errors[column];
+                max_error = std::max(max_error, error);
+            }
+        }
+    });
+    int pixel_count = 0;
+    Color total_color(0, 0, 0);
+    int mismatch_count = 0;
+    float max_error = 0;
+    for (int column = 0; column < size; column++)
+    {
+        pixel_count += column_pixel_counts[column];
+        total_color += column_total_colors[column];
+        mismatch_count += column_mismatch_counts[column];
+        max_error = std::max(max_error, column_max_errors[column]);
+    }
+    if (print)
+    {
+        debugPrint(pixel_count);
+        debugPrint(total_color);
+        debugPrint(total_color / pixel_count);
+        debugPrint(mismatch_count);
+        debugPrint(max_error);
+    }
+    return max_error;
+}
+
 // BACKWARD_COMPATIBILITY reference to new "disposable" Uniform object. This
 // is called ONLY from constructors providing backward compatibility. The
 // tiny Uniform texture object is allowed to "memory leak" for ease of use.
@@ -57,45 +98,202 @@ Texture& Texture::disposableUniform(Color color)
 // Each Blur::getColor() uses an NxN jiggled grid of subsamples, where N is:
 int Blur::sqrt_of_subsample_count = 11;
 
-// Insert random Disks until density threshold is met. Disk center positions
-// are uniformly distributed across center tile. Radii are chosen from the
-// interval [min_radius, max_radius] with a preference for smaller values.
-void LotsOfSpotsBase::insertRandomSpots()
+// Raster tiles of all Blurs, and their shared memory budget.
+BudgetedLru<int64_t, Blur::RasterTile>
+Blur::raster_tiles(64 * 1024 * 1024,
+                   [](const RasterTile&) { return raster_tile_bytes; });
+
+// Number of Blurs whose subsamples this thread is now evaluating.
+thread_local int Blur::nesting_depth = 0;
+
+// Remove this Blur's raster tiles from the shared cache.
+Blur::~Blur()
+{
+    raster_tiles.eraseOwner(this);
+}
+
+// Bank of Blur subsample patterns for NxN grids. Made on first use (under a
+// lock, since Blurs may be constructed on several threads) then kept.
+const Blur::JitterBank& Blur::JitterBank::get(int n)
+{
+    static std::mutex mutex;
+    static std::map<int, std::unique_ptr<JitterBank>> banks;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& bank = banks[n];
+    if (!bank) bank.reset(new JitterBank(n));
+    return *bank;
+}
+
+// Make "pattern_count" jittered NxN grids in a unit square. Subsamples inside
+// its unit diameter disk are kept, weighted by a sinusoid kernel (1 at center,
+// 0 at edge) as in the original per-sample version of Blur::getColor().
+Blur::JitterBank::JitterBank(int n) : patterns(pattern_count)
+{
+    RandomSequence rs(n);
+    std::vector<Vec2> offsets;
+    float radius = 0.5;
+    for (auto& pattern : patterns)
+    {
+        jittered_grid_NxN_in_square(n, 1, rs, offsets);
+        for (Vec2 offset : offsets)
+        {
+            float length = offset.length();
+            if (length <= radius)
+            {
+                float weight = 1 - sinusoid(length / radius);
+                pattern.subsamples.push_back({offset, weight});
+                pattern.sum_of_weights += weight;
+            }
+        }
+    }
+}
+
+// Blurred color at "position": bilinear interpolation between the four raster
+// grid points around it, which are always in the same tile. That tile is
+// computed if not cached, evicting least recently used tiles of all Blurs if
+// needed to stay within the raster memory budget.
+Color Blur::rasterColor(Vec2 position) const
+{
+    RasterTileRef tile_ref;
+    return rasterColor(position, tile_ref);
+}
+
+// As above, reusing "tile_ref" if it holds the tile containing "position",
+// otherwise looking up that tile and leaving it in "tile_ref".
+Color Blur::rasterColor(Vec2 position, RasterTileRef& tile_ref) const
 {
-    float total_area = 0;
-    float half = tile_size / 2;
-    // Seed the random number sequence from some operator parameters.
-    RandomSequence rs(seedForRandomSequence());
-    // Add random Disks until density threshold is met.
-    while (total_area < (spot_density * sq(tile_size)))
+    float cell = width / raster_cells_per_width;
+    float gx = position.x() / cell;
+    float gy = position.y() / cell;
+    float fx = std::floor(gx);
+    float fy = std::floor(gy);
+    int ix = int(fx);
+    int iy = int(fy);
+    int n = raster_tile_cells;
+    // Tile indices, rounding toward negative infinity, and grid point in tile.
+    int tile_x = (ix >= 0) ? ix / n : -((n - 1 - ix) / n);
+    int tile_y = (iy >= 0) ? iy / n : -((n - 1 - iy) / n);
+    int x = ix - tile_x * n;
+    int y = iy - tile_y * n;
+    int64_t key = (int64_t(tile_x) << 32) | uint32_t(tile_y);
+    if (!tile_ref.tile || (tile_ref.key != key))
     {
-        // Select radius, preferring the low end of the range.
-        float k = rs.frandom01();
-        float i = (std::pow(k, 10) + (k / 2)) / 1.5;
-        float radius = interpolate(i, min_radius, max_radius);
-        Vec2 center(rs.frandom2(-half, half), rs.frandom2(-half, half));
-        spots.push_back(Disk(radius, center));
-        total_area += spots.back().area();
+        tile_ref.key = key;
+        tile_ref.tile = rasterTile(key, tile_x, tile_y);
     }
-    // Insert each new random Disk into the DiskOccupancyGrid.
-    // (NB: very important this happens AFTER all Disks added to std::vector
-    // spots (above). Otherwise pointers will be invalidated by reallocation.)
-    for (Disk& spot : spots) disk_occupancy_grid->insertDiskWrap(spot);
+    const Color* row0 = tile_ref.tile->data() + (y * (n + 1)) + x;
+    const Color* row1 = row0 + n + 1;
+    float tx = gx - fx;
+    float ty = gy - fy;
+    return interpolate(ty,
+                       interpolate(tx, row0[0], row0[1]),
+                       interpolate(tx, row1[0], row1[1]));
+}
+
+// Color from "nested_cache" for the grid point nearest "position", so shared
+// by all outer subsamples which fall near it in this render.
+Color Blur::nestedCachedColor(Vec2 position) const
+{
+    Color color;
+    nested_cache.getColors(1, &position, &color);
+    return color;
 }
 
-void LotsOfSpotsBase::randomizeSpotRotations()
+// Number of raster tiles this Blur now holds.
+int Blur::rasterTileCount() const
 {
-    // Seed the random number sequence from some operator parameters.
-    RandomSequence rs(seedForRandomSequence());
-    // Each spot gets a random rotation on [0, 2π]
-    for (auto& spot : spots) spot.angle = rs.frandom01() * pi * 2;
+    return raster_tiles.size(this);
 }
 
-// Seed the random number sequence from some operator parameters.
-size_t LotsOfSpotsBase::seedForRandomSequence()
+// Look up tile, marking it most recently used, or compute it (outside the
+// lock) and insert it, evicting others as needed to stay within budget. If
+// two threads compute the same tile, one result is discarded.
+std::shared_ptr<const Blur::RasterTile> Blur::rasterTile(int64_t key,
+                                                         int tile_x,
+                                                         int tile_y) const
 {
-    return (hash_float(spot_density) ^
-            hash_float(min_radius) ^
-            hash_float(max_radius) ^
-            hash_float(soft_edge_width));
+    auto compute = [&]() { return computeRasterTile(tile_x, tile_y); };
+    return raster_tiles.get(this, key, compute);
+}
+
+size_t Blur::getRasterMemoryBudget()
+{
+    return raster_tiles.getMemoryBudget();
+}
+
+void Blur::setRasterMemoryBudget(size_t bytes)
+{
+    raster_tiles.setMemoryBudget(bytes);
+}
+
+size_t Blur::getRasterMemoryUsed()
+{
+    return raster_tiles.getMemoryUsed();
+}
+
+// Sample input texture on the tile's grid points plus a margin of half the
+// kernel width, then convolve with a separable kernel: horizontally into a
+// temporary array, then vertically into the tile.
+std::shared_ptr<const Blur::RasterTile>
+Blur::computeRasterTile(int tile_x, int tile_y) const
+{
+    float cell = width / raster_cells_per_width;
+    int margin = raster_cells_per_width / 2;
+    int n = raster_tile_cells + 1;
+    int size = n + 2 * margin;
+    static_assert(raster_tile_cells + 1 + raster_cells_per_width <=
+                  max_batch_size, "each row of input must fit in a batch");
+    // Kernel weights, sinusoid falloff from center to "margin", sum to one.
+    std::vector<float> kernel(2 * margin + 1);
+    float sum_of_weights = 0;
+    for (int k = -margin; k <= margin; k++)
+    {
+        float weight = 1 - sinusoid(std::abs(k) / float(margin));
+        kernel[k + margin] = weight;
+        sum_of_weights += weight;
+    }
+    for (float& weight : kernel) weight /= sum_of_weights;
+    // Input colors on size² grid, sampled at grid spacing, one row per batch.
+    // Grid points in the margins are shared (through the cache) with the
+    // neighboring tiles.
+    std::vector<Color> input(size * size);
+    int x0 = tile_x * raster_tile_cells - margin;
+    int y0 = tile_y * raster_tile_cells - margin;
+    {
+        SampleFootprint::Scope scope(cell);
+        Vec2 positions[max_batch_size];
+        for (int j = 0; j < size; j++)
+        {
+            for (int i = 0; i < size; i++)
+            {
+                positions[i] = Vec2(x0 + i, y0 + j) * cell;
+            }
+            input_cache.getColors(size, positions, &input[j * size]);
+        }
+    }
+    // Horizontal pass: size rows by n columns.
+    std::vector<Color> horizontal(size * n, Color(0, 0, 0));
+    for (int j = 0; j < size; j++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            Color sum(0, 0, 0);
+            const Color* in = &input[(j * size) + i];
+            for (int k = 0; k <= 2 * margin; k++) sum += in[k] * kernel[k];
+            horizontal[(j * n) + i] = sum;
+        }
+    }
+    // Vertical pass: n rows by n columns.
+    auto tile = std::make_shared<RasterTile>(n * n);
+    for (int j = 0; j < n; j++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            Color sum(0, 0, 0);
+            const Color* in = &horizontal[(j * n) + i];
+            for (int k = 0; k <= 2 * margin; k++) sum += in[k * n] * kernel[k];
+            (*tile)[(j * n) + i] = sum;
+        }
+    }
+    return tile;
 }
@@ -11,6 +11,15 @@
 #include "Disk.h"
 #include "COTS.h"
 #include "TwoPointTransform.h"
+#include "Simd.h"
+#include "Program.h"
+#include "SampleCache.h"
+#include "MipCache.h"
+#include "SpotLayout.h"
+#include "BudgetedLru.h"
+#include <list>
+#include <memory>
+#include <mutex>
 
 // Minimal texture, a uniform color everywhere on the texture plane. Its single
 // parameter is that color. As a convenience for hand written code, also can be
@@ -22,6 +31,18 @@ public:
     Uniform(float red, float green, float blue) : color(red, green, blue) {};
     Uniform(float _gray_value) : color(Color::gray(_gray_value)) {};
     Color getColor(Vec2 position) const override { return color; }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        for (int i = 0; i < count; i++) colors[i] = color;
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.emit(Program::Opcode::Uniform,
+                            {},
+                            {color.r(), color.g(), color.b()});
+    }
 private:
     const Color color;
 };
@@ -52,6 +73,33 @@ public:
         return interpolatePointOnTextures(sinusoid(f), position, position,
                                           inner_texture, outer_texture);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        float alphas[max_batch_size];
+        getAlphas(count, positions, alphas);
+        interpolatePointsOnTextures(count, alphas, positions,
+                                    inner_texture, outer_texture, colors);
+    }
+    // Interpolation alphas (0 inside, 1 outside) for a batch of positions.
+    void getAlphas(int count, const Vec2* positions, float* alphas) const
+    {
+        for (int i = 0; i < count; i += 4)
+        {
+            Vec2x4 p = Vec2x4::load(positions + i, count - i);
+            Float4 d = (p - Vec2x4(center)).length();
+            Float4 f = remapIntervalClip(d, inner_radius, outer_radius, 0, 1);
+            f.apply(sinusoid).store(alphas + i);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int alpha = program.emit(Program::Opcode::SpotAlpha,
+                                 {position}, {}, this);
+        return program.emitInterpolate(alpha, position,
+                                       inner_texture, outer_texture);
+    }
     // BACKWARD_COMPATIBILITY for version before inherent matting.
     Spot(Vec2 a, float b, Color c, float d, Color e)
       : Spot(a, b, disposableUniform(c), d, disposableUniform(e)){}
@@ -85,6 +133,36 @@ public:
                                           position, position,
                                           texture0, texture1);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        float alphas[max_batch_size];
+        getAlphas(count, positions, alphas);
+        interpolatePointsOnTextures(count, alphas, positions,
+                                    texture0, texture1, colors);
+    }
+    // Interpolation alphas for a batch of positions. If "local" they are
+    // already transformed into local space (see Program::emitAlpha()).
+    void getAlphas(int count,
+                   const Vec2* positions,
+                   float* alphas,
+                   bool local = false) const
+    {
+        for (int i = 0; i < count; i += 4)
+        {
+            Vec2x4 p = Vec2x4::load(positions + i, count - i);
+            Vec2x4 inside = local ? p : transform.localize(p);
+            Float4 alpha = clip01(inside.x()).apply(sinusoid);
+            (transform.scale() == 0 ? 0.5 : alpha).store(alphas + i);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int alpha = program.emitAlpha(Program::Opcode::GradationAlpha,
+                                      position, transform, this);
+        return program.emitInterpolate(alpha, position, texture0, texture1);
+    }
     // BACKWARD_COMPATIBILITY for version before inherent matting.
     Gradation(Vec2 a, Color b, Vec2 c, Color d)
       : Gradation(a, disposableUniform(b), c, disposableUniform(d)){}
@@ -126,6 +204,40 @@ public:
                                           position, position,
                                           texture0, texture1);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        float alphas[max_batch_size];
+        getAlphas(count, positions, alphas);
+        interpolatePointsOnTextures(count, alphas, positions,
+                                    texture0, texture1, colors);
+    }
+    // Interpolation alphas for a batch of positions. If "local" they are
+    // already transformed into local space (see Program::emitAlpha()).
+    void getAlphas(int count,
+                   const Vec2* positions,
+                   float* alphas,
+                   bool local = false) const
+    {
+        auto wave = [&](float x)
+        {
+            return soft_square_wave(fmod_floor(x, 1), softness, duty_cycle);
+        };
+        for (int i = 0; i < count; i += 4)
+        {
+            Vec2x4 p = Vec2x4::load(positions + i, count - i);
+            Vec2x4 inside = local ? p : transform.localize(p);
+            Float4 alpha = inside.x().apply(wave);
+            (transform.scale() == 0 ? 0.5 : alpha).store(alphas + i);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int alpha = program.emitAlpha(Program::Opcode::GratingAlpha,
+                                      position, transform, this);
+        return program.emitInterpolate(alpha, position, texture0, texture1);
+    }
     // BACKWARD_COMPATIBILITY with version before duty_cycle, inherent matting.
     Grating(Vec2 a, Color b, Vec2 c, Color d, float e)
       : Grating(a, disposableUniform(b), c, disposableUniform(d), e, 0.5) {}
@@ -152,6 +264,22 @@ public:
                                           position, position,
                                           texture0, texture1);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        float alphas[max_batch_size];
+        matte.getColors(count, positions, colors);
+        for (int i = 0; i < count; i++) alphas[i] = colors[i].luminance();
+        interpolatePointsOnTextures(count, alphas, positions,
+                                    texture0, texture1, colors);
+    }
+    int compile(Program& program, int position) const override
+    {
+        int matte_colors = program.compile(matte, position);
+        int alpha = program.emit(Program::Opcode::Luminance, {matte_colors});
+        return program.emitInterpolate(alpha, position, texture0, texture1);
+    }
 private:
     const Texture& matte;
     const Texture& texture0;
@@ -168,6 +296,26 @@ public:
     {
         return texture0.getColor(position) + texture1.getColor(position);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Color colors1[max_batch_size];
+        texture0.getColors(count, positions, colors);
+        texture1.getColors(count, positions, colors1);
+        for (int i = 0; i < count; i += 4)
+        {
+            int n = std::min(4, count - i);
+            Color4 c0 = Color4::load(colors + i, n);
+            (c0 + Color4::load(colors1 + i, n)).store(colors + i, n);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors0 = program.compile(texture0, position);
+        int colors1 = program.compile(texture1, position);
+        return program.emit(Program::Opcode::Add, {colors0, colors1});
+    }
 private:
     const Texture& texture0;
     const Texture& texture1;
@@ -183,6 +331,26 @@ public:
     {
         return texture0.getColor(position) - texture1.getColor(position);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Color colors1[max_batch_size];
+        texture0.getColors(count, positions, colors);
+        texture1.getColors(count, positions, colors1);
+        for (int i = 0; i < count; i += 4)
+        {
+            int n = std::min(4, count - i);
+            Color4 c0 = Color4::load(colors + i, n);
+            (c0 - Color4::load(colors1 + i, n)).store(colors + i, n);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors0 = program.compile(texture0, position);
+        int colors1 = program.compile(texture1, position);
+        return program.emit(Program::Opcode::Subtract, {colors0, colors1});
+    }
 private:
     const Texture& texture0;
     const Texture& texture1;
@@ -199,6 +367,26 @@ public:
     {
         return texture0.getColor(position) * texture1.getColor(position);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Color colors1[max_batch_size];
+        texture0.getColors(count, positions, colors);
+        texture1.getColors(count, positions, colors1);
+        for (int i = 0; i < count; i += 4)
+        {
+            int n = std::min(4, count - i);
+            Color4 c0 = Color4::load(colors + i, n);
+            (c0 * Color4::load(colors1 + i, n)).store(colors + i, n);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors0 = program.compile(texture0, position);
+        int colors1 = program.compile(texture1, position);
+        return program.emit(Program::Opcode::Multiply, {colors0, colors1});
+    }
 private:
     const Texture& texture0;
     const Texture& texture1;
@@ -217,6 +405,22 @@ public:
         Color c1 = texture1.getColor(position);
         return (c0.luminance() > c1.luminance()) ? c0 : c1;
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Color colors0[max_batch_size];
+        Color colors1[max_batch_size];
+        texture0.getColors(count, positions, colors0);
+        texture1.getColors(count, positions, colors1);
+        selectByLuminance(count, true, colors0, colors1, colors);
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors0 = program.compile(texture0, position);
+        int colors1 = program.compile(texture1, position);
+        return program.emit(Program::Opcode::Max, {colors0, colors1});
+    }
 private:
     const Texture& texture0;
     const Texture& texture1;
@@ -235,6 +439,22 @@ public:
         Color c1 = texture1.getColor(position);
         return (c0.luminance() < c1.luminance()) ? c0 : c1;
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Color colors0[max_batch_size];
+        Color colors1[max_batch_size];
+        texture0.getColors(count, positions, colors0);
+        texture1.getColors(count, positions, colors1);
+        selectByLuminance(count, false, colors0, colors1, colors);
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors0 = program.compile(texture0, position);
+        int colors1 = program.compile(texture1, position);
+        return program.emit(Program::Opcode::Min, {colors0, colors1});
+    }
 private:
     const Texture& texture0;
     const Texture& texture1;
@@ -255,6 +475,27 @@ public:
                      std::abs(diff.g()),
                      std::abs(diff.b()));
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Color colors1[max_batch_size];
+        texture0.getColors(count, positions, colors);
+        texture1.getColors(count, positions, colors1);
+        for (int i = 0; i < count; i += 4)
+        {
+            int n = std::min(4, count - i);
+            Color4 c0 = Color4::load(colors + i, n);
+            Color4 d = c0 - Color4::load(colors1 + i, n);
+            Color4(abs(d.r()), abs(d.g()), abs(d.b())).store(colors + i, n);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors0 = program.compile(texture0, position);
+        int colors1 = program.compile(texture1, position);
+        return program.emit(Program::Opcode::AbsDiff, {colors0, colors1});
+    }
 private:
     const Texture& texture0;
     const Texture& texture1;
@@ -294,22 +535,78 @@ public:
         texture1(texture_1) {}
     Color getColor(Vec2 position) const override
     {
-        float blend = getScalerNoise(transformIntoNoiseSpace(position));
+        float blend = noiseAt(position);
         return interpolatePointOnTextures(transform.scale() == 0 ? 0.5 : blend,
                                           position, position,
                                           texture0, texture1);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        float alphas[max_batch_size];
+        getAlphas(count, positions, alphas);
+        interpolatePointsOnTextures(count, alphas, positions,
+                                    texture0, texture1, colors);
+    }
+    // Interpolation alphas (noise values) for a batch of positions. If
+    // "local" they are already transformed into noise space, as is the
+    // SampleFootprint (see Program::emitAlpha()).
+    void getAlphas(int count,
+                   const Vec2* positions,
+                   float* alphas,
+                   bool local = false) const
+    {
+        for (int i = 0; i < count; i += 4)
+        {
+            Vec2x4 p = Vec2x4::load(positions + i, count - i);
+            Float4 blend = local ? getScalerNoisex4(p) : noiseAt(p);
+            (transform.scale() == 0 ? 0.5 : blend).store(alphas + i);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int alpha = program.emitAlpha(Program::Opcode::NoiseAlpha,
+                                      position, transform, this);
+        return program.emitInterpolate(alpha, position, texture0, texture1);
+    }
     // Get scalar noise fraction on [0, 1] for the given transformed position.
     // Overridden by other noise-based textures to customize basic behavior.
     virtual float getScalerNoise(Vec2 transformed_position) const
     {
         return PerlinNoise::unitNoise2d(transformed_position);
     }
+    // Packet version of getScalerNoise(), for four positions at once.
+    virtual Float4 getScalerNoisex4(Vec2x4 transformed_positions) const
+    {
+        return PerlinNoise::unitNoise2dx4(transformed_positions);
+    }
     // Transform a point from texture space into noise space.
     Vec2 transformIntoNoiseSpace(Vec2 position) const
     {
         return transform.localize(position);
     }
+    Vec2x4 transformIntoNoiseSpace(Vec2x4 positions) const
+    {
+        return transform.localize(positions);
+    }
+    // Current SampleFootprint, transformed from texture space to noise space.
+    float noiseSpaceFootprint() const
+    {
+        return SampleFootprint::get() / transform.scale();
+    }
+    // Scalar noise for a position in texture space, with the SampleFootprint
+    // transformed into noise space (so fractal noise can cull octaves).
+    float noiseAt(Vec2 position) const
+    {
+        SampleFootprint::Scope footprint(noiseSpaceFootprint());
+        return getScalerNoise(transformIntoNoiseSpace(position));
+    }
+    Float4 noiseAt(Vec2x4 positions) const
+    {
+        SampleFootprint::Scope footprint(noiseSpaceFootprint());
+        return getScalerNoisex4(transformIntoNoiseSpace(positions));
+    }
     // BACKWARD_COMPATIBILITY with version before "two point" specification.
     Noise(float a, Vec2 b, const Texture& c, const Texture& d)
       : Noise(b, b + Vec2(a, 0), c, d) {};
@@ -335,6 +632,10 @@ public:
     {
         return PerlinNoise::brownian2d(transformed_position);
     }
+    Float4 getScalerNoisex4(Vec2x4 transformed_positions) const override
+    {
+        return PerlinNoise::brownian2dx4(transformed_positions);
+    }
     // BACKWARD_COMPATIBILITY with version before "two point" specification.
     Brownian(float a, Vec2 b, const Texture& c, const Texture& d)
       : Brownian(b, b + Vec2(a, 0), c, d) {};
@@ -356,6 +657,10 @@ public:
     {
         return PerlinNoise::turbulence2d(transformed_position);
     }
+    Float4 getScalerNoisex4(Vec2x4 transformed_positions) const override
+    {
+        return PerlinNoise::turbulence2dx4(transformed_positions);
+    }
     // BACKWARD_COMPATIBILITY with version before "two point" specification.
     Turbulence(float a, Vec2 b, const Texture& c, const Texture& d)
       : Turbulence(b, b + Vec2(a, 0), c, d) {};
@@ -378,6 +683,10 @@ public:
     {
         return PerlinNoise::furbulence2d(transformed_position);
     }
+    Float4 getScalerNoisex4(Vec2x4 transformed_positions) const override
+    {
+        return PerlinNoise::furbulence2dx4(transformed_positions);
+    }
     // BACKWARD_COMPATIBILITY with version before "two point" specification.
     Furbulence(float a, Vec2 b, const Texture& c, const Texture& d)
       : Furbulence(b, b + Vec2(a, 0), c, d) {};
@@ -400,6 +709,10 @@ public:
     {
         return PerlinNoise::wrapulence2d(transformed_position);
     }
+    Float4 getScalerNoisex4(Vec2x4 transformed_positions) const override
+    {
+        return PerlinNoise::wrapulence2dx4(transformed_positions);
+    }
     // BACKWARD_COMPATIBILITY with version before "two point" specification.
     Wrapulence(float a, Vec2 b, const Texture& c, const Texture& d)
       : Wrapulence(b, b + Vec2(a, 0), c, d) {};
@@ -428,6 +741,10 @@ public:
     {
         return PerlinNoise::multiNoise2d(transformed_position, which);
     }
+    Float4 getScalerNoisex4(Vec2x4 transformed_positions) const override
+    {
+        return PerlinNoise::multiNoise2dx4(transformed_positions, which);
+    }
     // BACKWARD_COMPATIBILITY with version before "two point" specification.
     MultiNoise(float a, Vec2 b, const Texture& c, const Texture& d, float e)
       : MultiNoise(b, b + Vec2(a, 0), c, d, e) {};
@@ -449,6 +766,7 @@ public:
     
     Color getColor(Vec2 position) const override
     {
+        SampleFootprint::Scope footprint(noiseSpaceFootprint());
         Vec2 tp1 = transformIntoNoiseSpace(position + offset1).rotate(0.3);
         Vec2 tp2 = transformIntoNoiseSpace(position + offset2).rotate(0.6);
         Vec2 tp3 = transformIntoNoiseSpace(position + offset3).rotate(0.9);
@@ -456,6 +774,28 @@ public:
                      PerlinNoise::multiNoise2d(tp2, which),
                      PerlinNoise::multiNoise2d(tp3, which));
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        SampleFootprint::Scope footprint(noiseSpaceFootprint());
+        for (int i = 0; i < count; i += 4)
+        {
+            Vec2x4 p = Vec2x4::load(positions + i, count - i);
+            Vec2x4 tp1 = transformIntoNoiseSpace(p + offset1).rotate(0.3);
+            Vec2x4 tp2 = transformIntoNoiseSpace(p + offset2).rotate(0.6);
+            Vec2x4 tp3 = transformIntoNoiseSpace(p + offset3).rotate(0.9);
+            Color4 noise(PerlinNoise::multiNoise2dx4(tp1, which),
+                         PerlinNoise::multiNoise2dx4(tp2, which),
+                         PerlinNoise::multiNoise2dx4(tp3, which));
+            noise.store(colors + i, count - i);
+        }
+    }
+    // Not a blend of two textures (as are other Noise types) so use Fallback.
+    int compile(Program& program, int position) const override
+    {
+        return Texture::compile(program, position);
+    }
     // BACKWARD_COMPATIBILITY with version before "two point" specification.
     ColorNoise(float a, Vec2 b, float c) : ColorNoise(b, b + Vec2(a, 0), c) {};
 private:
@@ -473,12 +813,21 @@ public:
         : huePhase (_huePhase), texture (_texture) {}
     Color getColor(Vec2 position) const override
     {
-        float luminance = texture.getColor(position).luminance();
+        return mapColor(texture.getColor(position));
+    }
+    // Map color sampled from "texture" to this operator's color.
+    Color mapColor(Color color) const
+    {
+        float luminance = color.luminance();
         float red, green, blue;
         Color::convertHSVtoRGB(luminance + huePhase, 1.0f, 1.0f,
                                red, green, blue);
         return Color(red, green, blue);
     }
+    int compile(Program& program, int position) const override
+    {
+        return program.emitMapColor(program.compile(texture, position), this);
+    }
 private:
     const float huePhase;
     const Texture& texture;
@@ -504,14 +853,25 @@ public:
       : width(_width),
         center(_center),
         fixed_ray(_fixed_ray),
+        new_y(fixed_ray.normalize()),
+        new_x(new_y.rotate90degCW()),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        // Nonlinear warp, so the footprint in "texture" is unknown.
+        SampleFootprint::Scope footprint(0);
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 0));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         // Position relative to "center".
         Vec2 p = position - center;
-        // X and Y basis vectors of transformed space.
-        Vec2 new_y = fixed_ray.normalize();
-        Vec2 new_x = new_y.rotate90degCW();
         // Measure angle (0 parallel to new_y axis, pi/2 parallel to new_x).
         float angle = Vec2(p.dot(new_x), p.dot(new_y)).atan2();
         // Distance from "center".
@@ -519,12 +879,15 @@ public:
         Vec2 new_point = (center +
                           new_x * remapInterval(angle, -pi, pi, -width, width) +
                           new_y * radius);
-        return texture.getColor(new_point);
+        return new_point;
     }
 private:
     const float width;
     const Vec2 center;
     const Vec2 fixed_ray;
+    // X and Y basis vectors of transformed space.
+    const Vec2 new_y;
+    const Vec2 new_x;
     const Texture& texture;
 };
 
@@ -543,13 +906,25 @@ public:
         center(_center),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        // Magnification varies across the spot: treat footprint as unknown.
+        SampleFootprint::Scope footprint(0);
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 0));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float r = offset.length();  // radius from center
         float rr = clip01(r / spot_radius);  // "relative radius" on [0, 1]
         float taper = interpolate(std::pow(rr, 5), rr, sinusoid(rr));
         float scale = interpolate(taper, center_magnification, 1.0f);
-        return texture.getColor((offset / scale) + center);
+        return (offset / scale) + center;
     }
 private:
     const float center_magnification;
@@ -573,14 +948,44 @@ public:
         center(_center),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        // Footprint shrinks along "main_basis" when stretch is greater than 1.
+        SampleFootprint::Scope footprint(SampleFootprint::get() /
+                                         std::max(scale, 1.0f));
+        return texture.getColor(warp(position));
+    }
+    // Compiles to a Warp instruction or, when optimizing, a Matrix instruction
+    // (which can be fused with other transforms) since warp() is affine: the
+    // offset from "center" is scaled along "main_basis", then offset back.
+    // That is (M * position) + (center - M * center) for 2×2 matrix M.
+    int compile(Program& program, int position) const override
+    {
+        float footprint_scale = std::max(scale, 1.0f);
+        if (!program.optimizing())
+            return program.compile(texture,
+                                   program.emitWarp(position, this,
+                                                    footprint_scale));
+        Vec2 main = main_basis / scale;
+        Vec2 m0(main.x() * main_basis.x() + perp_basis.x() * perp_basis.x(),
+                main.x() * main_basis.y() + perp_basis.x() * perp_basis.y());
+        Vec2 m1(main.y() * main_basis.x() + perp_basis.y() * perp_basis.x(),
+                main.y() * main_basis.y() + perp_basis.y() * perp_basis.y());
+        Vec2 offset = center - Vec2(m0.dot(center), m1.dot(center));
+        int stretched = program.emit(Program::Opcode::Matrix,
+                                     {position},
+                                     {m0.x(), m0.y(), offset.x(),
+                                      m1.x(), m1.y(), offset.y(),
+                                      footprint_scale});
+        return program.compile(texture, stretched);
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float main_distance = offset.dot(main_basis);
         float perp_distance = offset.dot(perp_basis);
         float stretched = main_distance / scale;
-        return texture.getColor(center +
-                                main_basis * stretched +
-                                perp_basis * perp_distance);
+        return center + main_basis * stretched + perp_basis * perp_distance;
     }
 private:
     const float scale;
@@ -603,10 +1008,22 @@ public:
         center(_center),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        // Samples lie along a line: no footprint across it.
+        SampleFootprint::Scope footprint(0);
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 0));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float projection = offset.dot(slice_tangent);
-        return texture.getColor(center + (slice_tangent * projection));
+        return center + (slice_tangent * projection);
     }
 private:
     const Vec2 slice_tangent;
@@ -628,11 +1045,23 @@ public:
         center(_center),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        // Samples lie along a line: no footprint across it.
+        SampleFootprint::Scope footprint(0);
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 0));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float angle = std::atan2(offset.dot(perpendicular),
                                  offset.dot(slice_tangent));
-        return texture.getColor(center + (slice_tangent * angle));
+        return center + (slice_tangent * angle);
     }
 private:
     const Vec2 slice_tangent;
@@ -662,6 +1091,8 @@ public:
         perpendicular(shear_tangent.rotate90degCCW()) {}
     Color getColor(Vec2 position) const override
     {
+        // Slice sampling and shear are not affine, footprint is unknown.
+        SampleFootprint::Scope footprint(0);
         // Find point on texture_to_shear: decompose into x,y in shear space,
         // offset x by luminince from slice sample, recombine to new position.
         Vec2 shear_offset = position - shear_center;
@@ -707,6 +1138,7 @@ public:
         float luminance = original.luminance();
         // Look up color by luminance along slice in texture_for_slice.
         Vec2 on_slice = center + (slice_tangent * luminance);
+        SampleFootprint::Scope footprint(0);  // Unrelated to "position".
         return texture_for_slice.getColor(on_slice);
     }
 private:
@@ -733,10 +1165,25 @@ public:
         d(Vec2ToComplex(_d)),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        SampleFootprint::Scope footprint(0);  // Scaling varies, unknown.
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 0));
+    }
+    // Map "position" to where "texture" is sampled. Computes the inverse map
+    // inline, exactly as inverse_mobius_transform() does (including its
+    // diagnostic for a zero denominator) so it can be optimized in place.
+    Vec2 warp(Vec2 position) const
     {
         Complex z = Vec2ToComplex(position);
-        Complex imt = inverse_mobius_transform(z, a, b, c, d);
-        return texture.getColor(ComplexToVec2(imt));
+        Complex numerator = (d * z) - b;
+        Complex denominator = a - (c * z);
+        if (denominator == Complex(0, 0)) debugPrint(denominator);
+        return ComplexToVec2(numerator / denominator);
     }
     static Vec2 ComplexToVec2(Complex z) { return {z.real(), z.imag()}; }
     static Complex Vec2ToComplex(Vec2 v) { return {v.x(), v.y()}; }
@@ -758,8 +1205,29 @@ public:
         : scale(_scale), texture(_texture) {}
     Color getColor(Vec2 position) const override
     {
+        SampleFootprint::Scope footprint(SampleFootprint::get() /
+                                         std::abs(scale));
         return texture.getColor(position / scale);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Vec2 transformed[max_batch_size];
+        for (int i = 0; i < count; i++)
+        {
+            Vec2 position = positions[i];
+            transformed[i] = position / scale;
+        }
+        SampleFootprint::Scope footprint(SampleFootprint::get() /
+                                         std::abs(scale));
+        texture.getColors(count, transformed, colors);
+    }
+    int compile(Program& program, int position) const override
+    {
+        int scaled = program.emit(Program::Opcode::Scale, {position}, {scale});
+        return program.compile(texture, scaled);
+    }
 private:
     const float scale;
     const Texture& texture;
@@ -777,6 +1245,25 @@ public:
     {
         return texture.getColor(position.rotate(-angle));
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Vec2 transformed[max_batch_size];
+        for (int i = 0; i < count; i++)
+        {
+            Vec2 position = positions[i];
+            transformed[i] = position.rotate(-angle);
+        }
+        texture.getColors(count, transformed, colors);
+    }
+    int compile(Program& program, int position) const override
+    {
+        int rotated = program.emit(Program::Opcode::Rotate,
+                                   {position},
+                                   {std::sin(-angle), std::cos(-angle)});
+        return program.compile(texture, rotated);
+    }
 private:
     const float angle;
     const Texture& texture;
@@ -794,6 +1281,25 @@ public:
     {
         return texture.getColor(position - translation);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Vec2 transformed[max_batch_size];
+        for (int i = 0; i < count; i++)
+        {
+            Vec2 position = positions[i];
+            transformed[i] = position - translation;
+        }
+        texture.getColors(count, transformed, colors);
+    }
+    int compile(Program& program, int position) const override
+    {
+        int translated = program.emit(Program::Opcode::Translate,
+                                      {position},
+                                      {translation.x(), translation.y()});
+        return program.compile(texture, translated);
+    }
 private:
     const Vec2 translation;
     const Texture& texture;
@@ -808,33 +1314,182 @@ class Blur : public Texture
 {
 public:
     Blur(const float _width, const Texture& _texture)
-        : width(_width), texture(_texture) {}
+      : width(_width),
+        texture(_texture),
+        jitter_bank(JitterBank::get(sqrt_of_subsample_count)),
+        input_cache(_width / raster_cells_per_width, _texture),
+        subsampled(*this),
+        nested_cache(_width / raster_cells_per_width, subsampled) {}
+    ~Blur();
     Color getColor(Vec2 position) const override
     {
-        float radius = width / 2;
-        std::vector<Vec2> offsets;
-        RandomSequence rs(position.hash());
-        jittered_grid_NxN_in_square(sqrt_of_subsample_count, width, rs, offsets);
+        if (useRaster()) return rasterColor(position);
+        if (useNestedCache()) return nestedCachedColor(position);
+        return subsampledColor(position);
+    }
+    // Weighted average of input colors at subsamples of a jittered pattern.
+    Color subsampledColor(Vec2 position) const
+    {
+        NestingScope nesting;
+        const auto& pattern = jitter_bank.pattern(position.hash());
         Color sum_of_weighted_colors(0, 0, 0);
-        float sum_of_weights = 0;
-        for (Vec2 offset : offsets)
+        for (auto& subsample : pattern.subsamples)
         {
-            float length = offset.length();
-            if (length <= radius)
-            {
-                float weight = 1 - sinusoid(length / radius);
-                Color color_at_offset = texture.getColor(position + offset);
-                sum_of_weighted_colors += color_at_offset * weight;
-                sum_of_weights += weight;
-            }
+            Vec2 offset = subsample.offset * width;
+            Color color_at_offset = texture.getColor(position + offset);
+            sum_of_weighted_colors += color_at_offset * subsample.weight;
         }
-        return sum_of_weighted_colors / sum_of_weights;
+        return sum_of_weighted_colors / pattern.sum_of_weights;
+    }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        if (!useRaster()) return Texture::getColors(count, positions, colors);
+        // Consecutive samples usually fall in the same raster tile.
+        RasterTileRef tile;
+        for (int i = 0; i < count; i++)
+            colors[i] = rasterColor(positions[i], tile);
+    }
+    // Blur of a constant color is that color, otherwise uses getColors().
+    int compile(Program& program, int position) const override
+    {
+        int colors = program.compile(texture, position);
+        return (program.isConstant(colors) ?
+                colors : Texture::compile(program, position));
     }
     // Each Blur::getColor() uses an NxN jiggled grid of subsamples, where N is:
     static int sqrt_of_subsample_count;
+    // A bank of precomputed subsample patterns, each an NxN jittered grid (see
+    // jittered_grid_NxN_in_square()) in a unit square, keeping those inside
+    // its unit diameter disk, with their kernel weights. Each sample uses the
+    // pattern selected by its position's hash, so neighboring samples use
+    // uncorrelated patterns, without generating one (and allocating memory
+    // for it) per sample. Shared by all Blurs with the same N.
+    class JitterBank
+    {
+    public:
+        class Subsample
+        {
+        public:
+            Vec2 offset;
+            float weight;
+        };
+        class Pattern
+        {
+        public:
+            std::vector<Subsample> subsamples;
+            float sum_of_weights = 0;
+        };
+        // Bank for NxN grids, made on first use, never deleted.
+        static const JitterBank& get(int n);
+        const Pattern& pattern(size_t hash) const
+            { return patterns[hash % pattern_count]; }
+        static const int pattern_count = 64;
+    private:
+        JitterBank(int n);
+        std::vector<Pattern> patterns;
+    };
+    // While rendering (see Texture::getRenderBlurRaster()) Blur instead reads
+    // from a blurred raster of its input: a grid with "raster_cells_per_width"
+    // cells across the kernel, computed in square tiles of "raster_tile_cells"
+    // cells as they are first touched, then bilinearly interpolated. Each tile
+    // samples its input once per grid point (plus a margin of half the kernel)
+    // and is blurred with a separable sinusoid kernel, so cost is per pixel,
+    // not per subsample. This is an alternative rendering mode, off by default.
+    // Tiles of all Blurs share one memory budget, beyond which the least
+    // recently used tiles, from whichever Blur, are evicted (and recomputed if
+    // needed again) as in MipCache.
+    static const int raster_cells_per_width = 8;
+    static const int raster_tile_cells = 32;
+    static const size_t raster_tile_bytes =
+        (raster_tile_cells + 1) * (raster_tile_cells + 1) * sizeof(Color);
+    // True if this sample should come from the raster: while rendering, when
+    // the kernel is wider than the SampleFootprint (else subsamples cost less).
+    bool useRaster() const
+    {
+        float footprint = SampleFootprint::get();
+        return (getRenderBlurRaster() && rendering() && (width > 0) &&
+                ((footprint == 0) || (width > footprint)));
+    }
+    // Blurred color at "position" interpolated from the raster.
+    Color rasterColor(Vec2 position) const;
+    // Number of raster tiles this Blur now holds.
+    int rasterTileCount() const;
+    // Get/set memory budget (in bytes) for raster tiles of all Blurs, and get
+    // the amount now used. Setting a smaller budget evicts tiles as needed.
+    static size_t getRasterMemoryBudget();
+    static void setRasterMemoryBudget(size_t bytes);
+    static size_t getRasterMemoryUsed();
+    // Cache of input colors on the raster's grid (see SampleCache.h) used to
+    // make raster tiles, whose margins overlap their neighbors.
+    const SampleCache& inputCache() const { return input_cache; }
+    // True if this sample should come from "nested_cache": while rendering,
+    // when this Blur is evaluated within the subsamples of another (so once
+    // per outer subsample, rather than once per pixel). Otherwise a nested
+    // Blur's cost multiplies with each level of nesting. The cached color is
+    // subsampledColor() at the nearest point of a grid with spacing 1/8 of
+    // the kernel width, so is offset by at most 0.088 width. This Blur's
+    // output is smooth on that scale: for EdgeDetect of EdgeEnhance of Noise
+    // the error is under 0.015 per RGB component (see blur_nested_cache() in
+    // UnitTests.cpp), about the variation due to subsample jitter. A Blur not
+    // nested within another is unchanged.
+    bool useNestedCache() const
+    {
+        return (getRenderBlurCache() && rendering() && (width > 0) &&
+                (nesting_depth > 0));
+    }
+    // Color from "nested_cache" for the grid point nearest "position".
+    Color nestedCachedColor(Vec2 position) const;
+    // Number of Blurs whose subsamples this thread is now evaluating.
+    static int nestingDepth() { return nesting_depth; }
 private:
+    // Counts this thread's nesting of subsampledColor() calls.
+    class NestingScope
+    {
+    public:
+        NestingScope() { nesting_depth++; }
+        ~NestingScope() { nesting_depth--; }
+    };
+    static thread_local int nesting_depth;
+    // View of this Blur as a Texture whose colors are subsampledColor(), for
+    // "nested_cache" to compute its misses with.
+    class Subsampled : public Texture
+    {
+    public:
+        Subsampled(const Blur& blur) : blur_(blur) {}
+        Color getColor(Vec2 position) const override
+            { return blur_.subsampledColor(position); }
+    private:
+        const Blur& blur_;
+    };
+    // Blurred colors at the (raster_tile_cells + 1)² grid points of one tile,
+    // including those on its far edges, so interpolation needs only one tile.
+    typedef std::vector<Color> RasterTile;
+    // A tile and its key, used to skip lookups while samples stay in it.
+    class RasterTileRef
+    {
+    public:
+        int64_t key = 0;
+        std::shared_ptr<const RasterTile> tile;
+    };
+    Color rasterColor(Vec2 position, RasterTileRef& tile_ref) const;
+    // Get the tile with the given indices (marking it most recently used),
+    // computing it if needed.
+    std::shared_ptr<const RasterTile> rasterTile(int64_t key,
+                                                 int tile_x,
+                                                 int tile_y) const;
+    std::shared_ptr<const RasterTile> computeRasterTile(int tile_x,
+                                                        int tile_y) const;
     const float width;
     const Texture& texture;
+    const JitterBank& jitter_bank;
+    const SampleCache input_cache;
+    const Subsampled subsampled;
+    const SampleCache nested_cache;
+    // Raster tiles of all Blurs, each owned by the Blur which computed it,
+    // keyed on their packed indices.
+    static BudgetedLru<int64_t, RasterTile> raster_tiles;
 };
 
 // Given two intensity thresholds and an input texture, remap the texture colors
@@ -852,13 +1507,21 @@ public:
         texture(_texture) {}
     Color getColor(Vec2 position) const override
     {
-        Color color = texture.getColor(position);
+        return mapColor(texture.getColor(position));
+    }
+    // Map color sampled from "texture" to this operator's color.
+    Color mapColor(Color color) const
+    {
         float hue, saturation, value;
         color.getHSV(hue, saturation, value);
         float new_v = remapIntervalClip(value, intensity0, intensity1, 0, 1);
         color.setHSV(hue, saturation, new_v);
         return color;
     }
+    int compile(Program& program, int position) const override
+    {
+        return program.emitMapColor(program.compile(texture, position), this);
+    }
 private:
     const float intensity0;
     const float intensity1;
@@ -923,12 +1586,20 @@ public:
         texture(_texture) {}
     Color getColor(Vec2 position) const override
     {
-        Color color = texture.getColor(position);
+        return mapColor(texture.getColor(position));
+    }
+    // Map color sampled from "texture" to this operator's color.
+    Color mapColor(Color color) const
+    {
         float hue, saturation, value;
         color.getHSV(hue, saturation, value);
         color.setHSV(std::fmod(hue + offset, 1), saturation, value);
         return color;
     }
+    int compile(Program& program, int position) const override
+    {
+        return program.emitMapColor(program.compile(texture, position), this);
+    }
 private:
     const float offset;
     const Texture& texture;
@@ -943,12 +1614,20 @@ public:
         texture(_texture) {}
     Color getColor(Vec2 position) const override
     {
-        Color color = texture.getColor(position);
+        return mapColor(texture.getColor(position));
+    }
+    // Map color sampled from "texture" to this operator's color.
+    Color mapColor(Color color) const
+    {
         float hue, saturation, value;
         color.getHSV(hue, saturation, value);
         color.setHSV(hue, clip(saturation * factor, 0, 1), value);
         return color;
     }
+    int compile(Program& program, int position) const override
+    {
+        return program.emitMapColor(program.compile(texture, position), this);
+    }
 private:
     const float factor;
     const Texture& texture;
@@ -968,6 +1647,23 @@ public:
     {
         return texture.getColor(position) * factor;
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        texture.getColors(count, positions, colors);
+        for (int i = 0; i < count; i += 4)
+        {
+            int n = std::min(4, count - i);
+            (Color4::load(colors + i, n) * factor).store(colors + i, n);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors = program.compile(texture, position);
+        return program.emit(Program::Opcode::AdjustBrightness,
+                            {colors}, {factor});
+    }
 private:
     const float factor;
     const Texture& texture;
@@ -993,12 +1689,23 @@ public:
         center(_center),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        SampleFootprint::Scope footprint(0);  // Shear near center, unknown.
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 0));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float radius = offset.length();
         float angle = angle_scale / ((radius * radius_scale) + 1);
         Vec2 rotated_offset = offset.rotate(angle);
-        return texture.getColor(center + rotated_offset);
+        return center + rotated_offset;
     }
 private:
     const float angle_scale;
@@ -1025,7 +1732,15 @@ public:
         texture(_texture) {}
     Color getColor(Vec2 position) const override
     {
-        Color color = texture.getColor(position);
+        return mapColor(texture.getColor(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.emitMapColor(program.compile(texture, position), this);
+    }
+    // Map color sampled from "texture" to this operator's color.
+    Color mapColor(Color color) const
+    {
         float hue, saturation, value;
         color.getHSV(hue, saturation, value);
         float new_v = value;
@@ -1056,13 +1771,21 @@ public:
         center(_center),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 1));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float along = offset.dot(line_tangent);
         float across = std::abs(offset.dot(perpendicular));
-        return texture.getColor(center +
-                                (line_tangent * along) +
-                                (perpendicular * across));
+        return center + (line_tangent * along) + (perpendicular * across);
     }
 private:
     const Vec2 line_tangent;
@@ -1083,23 +1806,34 @@ class Ring : public Texture
 public:
     Ring(float _copies, Vec2 _basis, Vec2 _center, const Texture& _texture)
       : copies(std::max(1.0f, std::round(std::abs(_copies)))),
+        segment_angle(2 * pi / copies),
         basis(_basis),
         basis_angle(basis.atan2()),
         center(_center),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 1));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float angle = offset.atan2() - basis_angle;
-        float segment_angle = 2 * pi / copies;
         int segment_index = std::round(angle / segment_angle);
         float lookup_angle = angle - (segment_angle * segment_index);
         float radius = offset.length();
         Vec2 spoke = basis.rotate(lookup_angle).normalize() * radius;
-        return texture.getColor(center + spoke);
+        return center + spoke;
     }
 private:
     const float copies;
+    const float segment_angle;
     const Vec2 basis;
     const float basis_angle;
     const Vec2 center;
@@ -1124,14 +1858,22 @@ public:
         center(_center - basis * width / 2),
         texture(_texture) {}
     Color getColor(Vec2 position) const override
+    {
+        return texture.getColor(warp(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.compile(texture,
+                               program.emitWarp(position, this, 1));
+    }
+    // Map "position" to where "texture" is sampled.
+    Vec2 warp(Vec2 position) const
     {
         Vec2 offset = position - center;
         float basis_proj = basis.dot(offset);
         float perp_proj = perpendicular.dot(offset);
         float within_stripe = fmod_floor(basis_proj, width);
-        return texture.getColor(center +
-                                basis * within_stripe +
-                                perpendicular * perp_proj);
+        return center + basis * within_stripe + perpendicular * perp_proj;
     }
 private:
     const float width;
@@ -1181,7 +1923,10 @@ public:
             offset = offset.rotate(2 * pi / 3);
             // 2d position of vertex on bump map.
             Vec2 vertex2d = position + offset;
-            // Form 3d triangle vertex using Z from bump map luminance.
+            // Form 3d triangle vertex using Z from bump map luminance. Keep
+            // bump detail down to triangle size (often smaller than a pixel).
+            SampleFootprint::Scope footprint(std::min(SampleFootprint::get(),
+                                                      offset.length()));
             float height = bump_texture.getColor(vertex2d).luminance();
             return Vec3(vertex2d.x(), vertex2d.y(), height);
         };
@@ -1236,60 +1981,91 @@ public:
         max_radius(std::max(_min_radius, _max_radius) + _margin),
         soft_edge_width(_soft_edge_width),
         margin(_margin),
-        disk_occupancy_grid
-            (std::make_shared<DiskOccupancyGrid>(Vec2(-5, -5), Vec2(5, 5), 60))
-    {
-        Timer timer("LotsOfSpots constructor");  // TODO temp
-        insertRandomSpots();
-        disk_occupancy_grid->reduceDiskOverlap(200, spots);
-    }
+        layout(SpotLayout::get(spot_density,
+                               min_radius,
+                               max_radius,
+                               soft_edge_width)) {}
+    // Number of spots, and the spot with a given index.
+    int spotCount() const { return int(layout->spots().size()); }
+    const Disk& spot(int index) const { return layout->spots().at(index); }
+    // Spot layout, which may be shared with other textures.
+    std::shared_ptr<const SpotLayout> spotLayout() const { return layout; }
     // Find nearest spot (Dot) and the soft-edged opacity at "position".
     typedef std::pair<Disk, float> DiskAndSoft;
     DiskAndSoft getSpot(Vec2 position) const
+    {
+        Vec2 tiled_pos = layout->grid().wrapToCenterTile(position);
+        if (!layout->candidatesExact()) return getSpotFromGrid(tiled_pos);
+        // Candidates are in reverse grid order, so the first which contains
+        // "tiled_pos" is the spot getSpotFromGrid() would return. Once opacity
+        // reaches 1 no further candidate can change the result.
+        float gray_level = 0;
+        int nearest_index = -1;
+        auto candidates = layout->candidatesNearPoint(tiled_pos);
+        for (auto c = candidates.first;
+             (c != candidates.second) && (gray_level < 1);
+             c++)
+        {
+            float radius = c->radius - margin;
+            float d_squared = (tiled_pos - c->center).lengthSquared();
+            // Cheap rejection (with slack for rounding) before exact test.
+            if (d_squared > sq(radius) * 1.001f) continue;
+            float d = std::sqrt(d_squared);
+            if (d <= radius)
+            {
+                gray_level = std::max(gray_level, spotLevel(d, radius));
+                if (nearest_index < 0) nearest_index = c->index;
+            }
+        }
+        Disk nearest_spot;
+        if (nearest_index >= 0)
+        {
+            nearest_spot = layout->spots()[nearest_index];
+            nearest_spot.radius -= margin;
+        }
+        return std::make_pair(nearest_spot, gray_level);
+    }
+    // Same as getSpot() using the occupancy grid, for the rare layouts whose
+    // spots are too large for precomputed candidates. "tiled_pos" is on the
+    // center tile.
+    DiskAndSoft getSpotFromGrid(Vec2 tiled_pos) const
     {
         float gray_level = 0;
         Disk nearest_spot;
-        Vec2 tiled_pos = disk_occupancy_grid->wrapToCenterTile(position);
-        std::set<Disk*> disks;
-        disk_occupancy_grid->findNearbyDisks(tiled_pos, disks);
-        for (auto& disk : disks)
+        const DiskOccupancyGrid& grid = layout->grid();
+        grid.forDisksNearPoint(tiled_pos, [&](const Disk& disk)
         {
-            Disk spot = *disk;
+            Disk spot = disk;
             spot.radius -= margin;
             // Adjust spot center to be nearest "tiled_pos" maybe in other tile.
-            Vec2 tiled_spot =
-                disk_occupancy_grid->nearestByTiling(tiled_pos, spot.position);
+            Vec2 tiled_spot = grid.nearestByTiling(tiled_pos, spot.position);
             // Distance from sample position to spot center. Ignore if too far.
             float d = (tiled_pos - tiled_spot).length();
             if (d <= spot.radius)
             {
-                float inner = std::max(0.0f, spot.radius - soft_edge_width);
-                // Interpolation fraction: 0 inside, 1 outside, ramp between.
-                float f = remapIntervalClip(d, inner, spot.radius, 0, 1);
-                // Sinusoidal interpolation between inner and outer colors.
-                float spot_level = interpolate(sinusoid(f), 1.0f, 0.0f);
-                gray_level = std::max(gray_level, spot_level);
+                gray_level = std::max(gray_level, spotLevel(d, spot.radius));
                 nearest_spot = spot;
             }
-        }
+        });
         return std::make_pair(nearest_spot, gray_level);
     }
-    // Insert random Disks until density threshold is met. Disk center positions
-    // are uniformly distributed across center tile. Radii are chosen from the
-    // interval [min_radius, max_radius] with a preference for smaller values.
-    void insertRandomSpots();
-    void randomizeSpotRotations();
-    size_t seedForRandomSequence();
+    // Opacity of a spot with given radius at distance "d" from its center.
+    float spotLevel(float d, float radius) const
+    {
+        float inner = std::max(0.0f, radius - soft_edge_width);
+        // Interpolation fraction: 0 inside, 1 outside, ramp between.
+        float f = remapIntervalClip(d, inner, radius, 0, 1);
+        // Sinusoidal interpolation between inner and outer colors.
+        return interpolate(sinusoid(f), 1.0f, 0.0f);
+    }
 private:
-    std::vector<Disk> spots;
-    std::shared_ptr<DiskOccupancyGrid> disk_occupancy_grid;
-    const float tile_size = 10;
-    const int move_count = 200;
     const float spot_density;
     const float min_radius;
     const float max_radius;
     const float soft_edge_width;
     const float margin;
+    // Spots and their occupancy grid, from SpotLayout's cache.
+    const std::shared_ptr<const SpotLayout> layout;
 };
 
 // Collection of spots matte "spot_texture" over "background_texture".
@@ -1375,10 +2151,7 @@ public:
         button_center(_button_center),
         button_texture(_button_texture),
         button_random_rotate(_button_random_rotate),
-        background_texture(_background_texture)
-    {
-        if (button_random_rotate > 0.5) randomizeSpotRotations();
-    }
+        background_texture(_background_texture) {}
     // BACKWARD_COMPATIBILITY for version before "margin", "background_texture"
     LotsOfButtons(float a, float b, float c, float d,
                   Vec2 e, const Texture& f, float g, Color h)
@@ -1388,7 +2161,9 @@ public:
         DiskAndSoft das = getSpot(position);
         float matte = das.second;
         Vec2 spot_center = das.first.position;
-        Vec2 rotated = (position - spot_center).rotate(das.first.angle);
+        // Each spot in the layout has a random angle, used only if enabled.
+        float angle = (button_random_rotate > 0.5) ? das.first.angle : 0;
+        Vec2 rotated = (position - spot_center).rotate(angle);
         Vec2 button_sample_point = button_center + rotated;
         return interpolatePointOnTextures(matte,
                                           position,
@@ -1420,6 +2195,22 @@ public:
     {
         return texture.getColor(position).gamma(exponent);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        texture.getColors(count, positions, colors);
+        for (int i = 0; i < count; i += 4)
+        {
+            int n = std::min(4, count - i);
+            Color4::load(colors + i, n).gamma(exponent).store(colors + i, n);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors = program.compile(texture, position);
+        return program.emit(Program::Opcode::Gamma, {colors}, {exponent});
+    }
 private:
     const float exponent;
     const Texture& texture;
@@ -1450,6 +2241,28 @@ public:
                      remapInterval(input.g(), 0, 1, min_g, max_g),
                      remapInterval(input.b(), 0, 1, min_b, max_b));
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        texture.getColors(count, positions, colors);
+        for (int i = 0; i < count; i += 4)
+        {
+            int n = std::min(4, count - i);
+            Color4 input = Color4::load(colors + i, n).clipToUnitRGB();
+            Color4 box(remapInterval(input.r(), 0, 1, min_r, max_r),
+                       remapInterval(input.g(), 0, 1, min_g, max_g),
+                       remapInterval(input.b(), 0, 1, min_b, max_b));
+            box.store(colors + i, n);
+        }
+    }
+    int compile(Program& program, int position) const override
+    {
+        int colors = program.compile(texture, position);
+        return program.emit(Program::Opcode::RgbBox,
+                            {colors},
+                            {min_r, max_r, min_g, max_g, min_b, max_b});
+    }
 private:
     const float min_r;
     const float max_r;
@@ -1472,6 +2285,7 @@ public:
         texture(_texture) {}
     Color getColor(Vec2 position) const override
     {
+        SampleFootprint::Scope footprint(0);  // Scaling varies, unknown.
         return texture.getColor(cots_map.Inverse(position));
     }
 private:
@@ -1514,9 +2328,13 @@ public:
         Vec2 offset = (position - center) / radius;
         float relative_radius = offset.length();
         float e = std::pow(relative_radius, exponent);
-        return ((relative_radius < 1) ?
-                texture_to_warp.getColor(offset / (scale * (1 - e))) :
-                background_texture.getColor(position));
+        if (relative_radius < 1)
+        {
+            // Magnification varies with radius: treat footprint as unknown.
+            SampleFootprint::Scope footprint(0);
+            return texture_to_warp.getColor(offset / (scale * (1 - e)));
+        }
+        return background_texture.getColor(position);
     }
 private:
     const Vec2 center;
@@ -1539,8 +2357,35 @@ public:
     Color getColor(Vec2 position) const override
     {
         Vec2 inside = transform.localize(position);
+        SampleFootprint::Scope footprint(localFootprint());
         return texture.getColor(transform.scale() == 0 ? position : inside);
     }
+    void getColors(int count,
+                   const Vec2* positions,
+                   Color* colors) const override
+    {
+        Vec2 transformed[max_batch_size];
+        for (int i = 0; i < count; i++)
+        {
+            Vec2 inside = transform.localize(positions[i]);
+            transformed[i] = transform.scale() == 0 ? positions[i] : inside;
+        }
+        SampleFootprint::Scope footprint(localFootprint());
+        texture.getColors(count, transformed, colors);
+    }
+    // SampleFootprint transformed into the space of the input texture.
+    float localFootprint() const
+    {
+        float scale = transform.scale();
+        return SampleFootprint::get() / (scale == 0 ? 1 : scale);
+    }
+    // Compiles to an Affine instruction, or nothing if transform is degenerate.
+    int compile(Program& program, int position) const override
+    {
+        if (transform.scale() == 0) return program.compile(texture, position);
+        return program.compile(texture,
+                               program.emitLocalize(position, transform));
+    }
 private:
     const TwoPointTransform transform;
     const Texture& texture;
@@ -1556,7 +2401,15 @@ public:
       : saturation(_saturation), value(_value), texture(_texture) {}
     Color getColor(Vec2 position) const override
     {
-        Color input = texture.getColor(position);
+        return mapColor(texture.getColor(position));
+    }
+    int compile(Program& program, int position) const override
+    {
+        return program.emitMapColor(program.compile(texture, position), this);
+    }
+    // Map color sampled from "texture" to this operator's color.
+    Color mapColor(Color input) const
+    {
         Color clipped = input.clipToUnitRGB();
         float h, s, v;
         Color::convertRGBtoHSV(clipped.r(), clipped.g(), clipped.b(), h, s, v);
@@ -0,0 +1,493 @@
+//
+//  Parser.cpp
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+
+#include "Parser.h"
+#include "Operators.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+
+// Destroy objects in reverse order of construction, then free memory.
+Arena::~Arena()
+{
+    for (Header* h = last_; h; h = h->previous) h->destroy(h + 1);
+    std::free(memory_);
+}
+
+// Bytes of arena needed to hold an object of "size" bytes.
+size_t Arena::slotSize(size_t size)
+{
+    static_assert(sizeof(Header) <= alignment, "Header must fit alignment");
+    return alignment + roundUp(size);
+}
+
+// Allocate the arena's memory. Only called once, before allocate().
+void Arena::reserve(size_t bytes)
+{
+    assert(memory_ == nullptr);
+    memory_ = static_cast<char*>(std::malloc(bytes));
+    assert(memory_ != nullptr);
+    capacity_ = bytes;
+}
+
+// Return address for an object of "size" bytes, after a Header.
+void* Arena::allocate(size_t size, void (*destroy)(void*))
+{
+    size_t slot = slotSize(size);
+    assert(used_ + slot <= capacity_);
+    char* address = memory_ + used_;
+    used_ += slot;
+    // Header goes just before the object, at end of alignment-sized prefix.
+    Header* header = reinterpret_cast<Header*>(address + alignment) - 1;
+    header->destroy = destroy;
+    header->previous = last_;
+    last_ = header;
+    return address + alignment;
+}
+
+namespace
+{
+    // A parsed argument: a number, Vec2, Vec3, or Texture (nested operator).
+    class Argument
+    {
+    public:
+        // Type code, as used in Constructor::signature: 'f' (float), 'v'
+        // (Vec2), 'V' (Vec3), or 't' (Texture).
+        char type = 0;
+        float numbers[3] = {0, 0, 0};
+        const Texture* texture = nullptr;
+        // Texture's node index in Parser, identifies equal subtrees.
+        int node = -1;
+        float f() const { return numbers[0]; }
+        Vec2 v() const { return Vec2(numbers[0], numbers[1]); }
+        Vec3 V() const { return Vec3(numbers[0], numbers[1], numbers[2]); }
+        const Texture& t() const { return *texture; }
+    };
+
+    // One operator constructor: name, types of its arguments, size, and
+    // functions to construct it (at a given address) and destroy it.
+    class Constructor
+    {
+    public:
+        const char* name;
+        const char* signature;
+        size_t size;
+        Texture* (*construct)(void* address, const Argument* a);
+        void (*destroy)(void* address);
+    };
+
+    template <typename T>
+    Constructor entry(const char* name,
+                      const char* signature,
+                      Texture* (*construct)(void*, const Argument*))
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "alignment");
+        return {name, signature, sizeof(T), construct,
+                [](void* address){ static_cast<T*>(address)->~T(); }};
+    }
+
+    // All operators which can be parsed. (Each constructor in Operators.h
+    // whose parameters are floats, Vec2s, Vec3s, and Textures.)
+    const std::vector<Constructor>& constructors()
+    {
+        typedef const Argument* A;
+        static const std::vector<Constructor> table =
+        {
+            entry<Uniform>("Uniform", "f", [](void* m, A a) -> Texture*
+                { return new (m) Uniform(a[0].f()); }),
+            entry<Uniform>("Uniform", "fff", [](void* m, A a) -> Texture*
+                { return new (m) Uniform(a[0].f(), a[1].f(), a[2].f()); }),
+            entry<Spot>("Spot", "vftft", [](void* m, A a) -> Texture*
+                { return new (m) Spot(a[0].v(), a[1].f(), a[2].t(),
+                                      a[3].f(), a[4].t()); }),
+            entry<Gradation>("Gradation", "vtvt", [](void* m, A a) -> Texture*
+                { return new (m) Gradation(a[0].v(), a[1].t(),
+                                           a[2].v(), a[3].t()); }),
+            entry<Grating>("Grating", "vtvtff", [](void* m, A a) -> Texture*
+                { return new (m) Grating(a[0].v(), a[1].t(), a[2].v(),
+                                         a[3].t(), a[4].f(), a[5].f()); }),
+            entry<SoftMatte>("SoftMatte", "ttt", [](void* m, A a) -> Texture*
+                { return new (m) SoftMatte(a[0].t(), a[1].t(), a[2].t()); }),
+            entry<Add>("Add", "tt", [](void* m, A a) -> Texture*
+                { return new (m) Add(a[0].t(), a[1].t()); }),
+            entry<Subtract>("Subtract", "tt", [](void* m, A a) -> Texture*
+                { return new (m) Subtract(a[0].t(), a[1].t()); }),
+            entry<Multiply>("Multiply", "tt", [](void* m, A a) -> Texture*
+                { return new (m) Multiply(a[0].t(), a[1].t()); }),
+            entry<Max>("Max", "tt", [](void* m, A a) -> Texture*
+                { return new (m) Max(a[0].t(), a[1].t()); }),
+            entry<Min>("Min", "tt", [](void* m, A a) -> Texture*
+                { return new (m) Min(a[0].t(), a[1].t()); }),
+            entry<AbsDiff>("AbsDiff", "tt", [](void* m, A a) -> Texture*
+                { return new (m) AbsDiff(a[0].t(), a[1].t()); }),
+            entry<NotEqual>("NotEqual", "tt", [](void* m, A a) -> Texture*
+                { return new (m) NotEqual(a[0].t(), a[1].t()); }),
+            entry<Noise>("Noise", "vvtt", [](void* m, A a) -> Texture*
+                { return new (m) Noise(a[0].v(), a[1].v(),
+                                       a[2].t(), a[3].t()); }),
+            entry<Noise>("Noise", "fvtt", [](void* m, A a) -> Texture*
+                { return new (m) Noise(a[0].f(), a[1].v(),
+                                       a[2].t(), a[3].t()); }),
+            entry<Brownian>("Brownian", "vvtt", [](void* m, A a) -> Texture*
+                { return new (m) Brownian(a[0].v(), a[1].v(),
+                                          a[2].t(), a[3].t()); }),
+            entry<Brownian>("Brownian", "fvtt", [](void* m, A a) -> Texture*
+                { return new (m) Brownian(a[0].f(), a[1].v(),
+                                          a[2].t(), a[3].t()); }),
+            entry<Turbulence>("Turbulence", "vvtt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Turbulence(a[0].v(), a[1].v(),
+                                            a[2].t(), a[3].t()); }),
+            entry<Turbulence>("Turbulence", "fvtt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Turbulence(a[0].f(), a[1].v(),
+                                            a[2].t(), a[3].t()); }),
+            entry<Furbulence>("Furbulence", "vvtt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Furbulence(a[0].v(), a[1].v(),
+                                            a[2].t(), a[3].t()); }),
+            entry<Furbulence>("Furbulence", "fvtt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Furbulence(a[0].f(), a[1].v(),
+                                            a[2].t(), a[3].t()); }),
+            entry<Wrapulence>("Wrapulence", "vvtt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Wrapulence(a[0].v(), a[1].v(),
+                                            a[2].t(), a[3].t()); }),
+            entry<Wrapulence>("Wrapulence", "fvtt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Wrapulence(a[0].f(), a[1].v(),
+                                            a[2].t(), a[3].t()); }),
+            entry<MultiNoise>("MultiNoise", "vvttf", [](void* m, A a)
+                -> Texture*
+                { return new (m) MultiNoise(a[0].v(), a[1].v(), a[2].t(),
+                                            a[3].t(), a[4].f()); }),
+            entry<MultiNoise>("MultiNoise", "fvttf", [](void* m, A a)
+                -> Texture*
+                { return new (m) MultiNoise(a[0].f(), a[1].v(), a[2].t(),
+                                            a[3].t(), a[4].f()); }),
+            entry<ColorNoise>("ColorNoise", "vvf", [](void* m, A a)
+                -> Texture*
+                { return new (m) ColorNoise(a[0].v(), a[1].v(), a[2].f()); }),
+            entry<ColorNoise>("ColorNoise", "fvf", [](void* m, A a)
+                -> Texture*
+                { return new (m) ColorNoise(a[0].f(), a[1].v(), a[2].f()); }),
+            entry<BrightnessToHue>("BrightnessToHue", "ft", [](void* m, A a)
+                -> Texture*
+                { return new (m) BrightnessToHue(a[0].f(), a[1].t()); }),
+            entry<Wrap>("Wrap", "fvvt", [](void* m, A a) -> Texture*
+                { return new (m) Wrap(a[0].f(), a[1].v(),
+                                      a[2].v(), a[3].t()); }),
+            entry<StretchSpot>("StretchSpot", "ffvt", [](void* m, A a)
+                -> Texture*
+                { return new (m) StretchSpot(a[0].f(), a[1].f(),
+                                             a[2].v(), a[3].t()); }),
+            entry<Stretch>("Stretch", "vvt", [](void* m, A a) -> Texture*
+                { return new (m) Stretch(a[0].v(), a[1].v(), a[2].t()); }),
+            entry<SliceGrating>("SliceGrating", "vvt", [](void* m, A a)
+                -> Texture*
+                { return new (m) SliceGrating(a[0].v(), a[1].v(), a[2].t()); }),
+            entry<SliceToRadial>("SliceToRadial", "vvt", [](void* m, A a)
+                -> Texture*
+                { return new (m) SliceToRadial(a[0].v(), a[1].v(),
+                                               a[2].t()); }),
+            entry<SliceShear>("SliceShear", "vvtvvt", [](void* m, A a)
+                -> Texture*
+                { return new (m) SliceShear(a[0].v(), a[1].v(), a[2].t(),
+                                            a[3].v(), a[4].v(), a[5].t()); }),
+            entry<Colorize>("Colorize", "vvtt", [](void* m, A a) -> Texture*
+                { return new (m) Colorize(a[0].v(), a[1].v(),
+                                          a[2].t(), a[3].t()); }),
+            entry<MobiusTransform>("MobiusTransform", "vvvvt", [](void* m, A a)
+                -> Texture*
+                { return new (m) MobiusTransform(a[0].v(), a[1].v(), a[2].v(),
+                                                 a[3].v(), a[4].t()); }),
+            entry<Scale>("Scale", "ft", [](void* m, A a) -> Texture*
+                { return new (m) Scale(a[0].f(), a[1].t()); }),
+            entry<Rotate>("Rotate", "ft", [](void* m, A a) -> Texture*
+                { return new (m) Rotate(a[0].f(), a[1].t()); }),
+            entry<Translate>("Translate", "vt", [](void* m, A a) -> Texture*
+                { return new (m) Translate(a[0].v(), a[1].t()); }),
+            entry<Blur>("Blur", "ft", [](void* m, A a) -> Texture*
+                { return new (m) Blur(a[0].f(), a[1].t()); }),
+            entry<SoftThreshold>("SoftThreshold", "fft", [](void* m, A a)
+                -> Texture*
+                { return new (m) SoftThreshold(a[0].f(), a[1].f(),
+                                               a[2].t()); }),
+            entry<EdgeDetect>("EdgeDetect", "ft", [](void* m, A a) -> Texture*
+                { return new (m) EdgeDetect(a[0].f(), a[1].t()); }),
+            entry<EdgeEnhance>("EdgeEnhance", "fft", [](void* m, A a)
+                -> Texture*
+                { return new (m) EdgeEnhance(a[0].f(), a[1].f(), a[2].t()); }),
+            entry<MipCache>("MipCache", "t", [](void* m, A a) -> Texture*
+                { return new (m) MipCache(a[0].t()); }),
+            entry<MipCache>("MipCache", "ft", [](void* m, A a) -> Texture*
+                { return new (m) MipCache(a[0].f(), a[1].t()); }),
+            entry<AdjustHue>("AdjustHue", "ft", [](void* m, A a) -> Texture*
+                { return new (m) AdjustHue(a[0].f(), a[1].t()); }),
+            entry<AdjustSaturation>("AdjustSaturation", "ft", [](void* m, A a)
+                -> Texture*
+                { return new (m) AdjustSaturation(a[0].f(), a[1].t()); }),
+            entry<AdjustBrightness>("AdjustBrightness", "ft", [](void* m, A a)
+                -> Texture*
+                { return new (m) AdjustBrightness(a[0].f(), a[1].t()); }),
+            entry<Twist>("Twist", "ffvt", [](void* m, A a) -> Texture*
+                { return new (m) Twist(a[0].f(), a[1].f(),
+                                       a[2].v(), a[3].t()); }),
+            entry<BrightnessWrap>("BrightnessWrap", "fft", [](void* m, A a)
+                -> Texture*
+                { return new (m) BrightnessWrap(a[0].f(), a[1].f(),
+                                                a[2].t()); }),
+            entry<Mirror>("Mirror", "vvt", [](void* m, A a) -> Texture*
+                { return new (m) Mirror(a[0].v(), a[1].v(), a[2].t()); }),
+            entry<Ring>("Ring", "fvvt", [](void* m, A a) -> Texture*
+                { return new (m) Ring(a[0].f(), a[1].v(),
+                                      a[2].v(), a[3].t()); }),
+            entry<Row>("Row", "vvt", [](void* m, A a) -> Texture*
+                { return new (m) Row(a[0].v(), a[1].v(), a[2].t()); }),
+            entry<Shader>("Shader", "Vftt", [](void* m, A a) -> Texture*
+                { return new (m) Shader(a[0].V(), a[1].f(),
+                                        a[2].t(), a[3].t()); }),
+            entry<LotsOfSpots>("LotsOfSpots", "ffffftt", [](void* m, A a)
+                -> Texture*
+                { return new (m) LotsOfSpots(a[0].f(), a[1].f(), a[2].f(),
+                                             a[3].f(), a[4].f(),
+                                             a[5].t(), a[6].t()); }),
+            entry<ColoredSpots>("ColoredSpots", "ffffftt", [](void* m, A a)
+                -> Texture*
+                { return new (m) ColoredSpots(a[0].f(), a[1].f(), a[2].f(),
+                                              a[3].f(), a[4].f(),
+                                              a[5].t(), a[6].t()); }),
+            entry<LotsOfButtons>("LotsOfButtons", "fffffvtft", [](void* m, A a)
+                -> Texture*
+                { return new (m) LotsOfButtons(a[0].f(), a[1].f(), a[2].f(),
+                                               a[3].f(), a[4].f(), a[5].v(),
+                                               a[6].t(), a[7].f(),
+                                               a[8].t()); }),
+            entry<Gamma>("Gamma", "ft", [](void* m, A a) -> Texture*
+                { return new (m) Gamma(a[0].f(), a[1].t()); }),
+            entry<RgbBox>("RgbBox", "fffffft", [](void* m, A a) -> Texture*
+                { return new (m) RgbBox(a[0].f(), a[1].f(), a[2].f(),
+                                        a[3].f(), a[4].f(), a[5].f(),
+                                        a[6].t()); }),
+            entry<CotsMap>("CotsMap", "vvvvt", [](void* m, A a) -> Texture*
+                { return new (m) CotsMap(a[0].v(), a[1].v(), a[2].v(),
+                                         a[3].v(), a[4].t()); }),
+            entry<Hyperbolic>("Hyperbolic", "vffftt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Hyperbolic(a[0].v(), a[1].f(), a[2].f(),
+                                            a[3].f(), a[4].t(), a[5].t()); }),
+            entry<Hyperbolic>("Hyperbolic", "vftt", [](void* m, A a)
+                -> Texture*
+                { return new (m) Hyperbolic(a[0].v(), a[1].f(),
+                                            a[2].t(), a[3].t()); }),
+            entry<Affine>("Affine", "vvt", [](void* m, A a) -> Texture*
+                { return new (m) Affine(a[0].v(), a[1].v(), a[2].t()); }),
+            entry<HueOnly>("HueOnly", "fft", [](void* m, A a) -> Texture*
+                { return new (m) HueOnly(a[0].f(), a[1].f(), a[2].t()); }),
+        };
+        return table;
+    }
+
+    // Recursive descent parser for the textual form of a Texture tree. With
+    // no Arena it only checks the text and totals the arena bytes needed.
+    // Given an Arena (reserved to that size) it constructs the operators.
+    class Parser
+    {
+    public:
+        Parser(const std::string& source, Arena* arena)
+          : text_(source.c_str()), next_(text_), arena_(arena) {}
+        // Parse the whole string as one Texture. Returns the root (or in the
+        // sizing pass, nullptr) and true, or false on error.
+        bool parse(const Texture*& root)
+        {
+            int node = parseTexture();
+            skipSpace();
+            if (node >= 0 && *next_) return fail("unexpected text after end");
+            root = (node < 0) ? nullptr : nodes_[node];
+            return node >= 0;
+        }
+        const std::string& error() const { return error_; }
+        size_t bytes() const { return bytes_; }
+        int operatorCount() const { return int(nodes_.size()); }
+    private:
+        // Record the first error, noting position in text, return false.
+        bool fail(const std::string& message)
+        {
+            if (error_.empty())
+                error_ = (message + " at character " +
+                          std::to_string(next_ - text_));
+            return false;
+        }
+        void skipSpace() { while (std::isspace(*next_)) next_++; }
+        // Skip space then consume given character if present.
+        bool accept(char c)
+        {
+            skipSpace();
+            if (*next_ != c) return false;
+            next_++;
+            return true;
+        }
+        // Read an identifier, or return empty string.
+        std::string parseName()
+        {
+            skipSpace();
+            const char* start = next_;
+            while (std::isalnum(*next_) || *next_ == '_') next_++;
+            return std::string(start, next_);
+        }
+        // Read a number as double then round to float, as a C++ compiler does
+        // for a floating point literal passed as a float parameter.
+        bool parseNumber(float& number)
+        {
+            skipSpace();
+            char* end = nullptr;
+            number = float(std::strtod(next_, &end));
+            if (end == next_) return false;
+            next_ = end;
+            return true;
+        }
+        // Parse a parenthesized list of "count" numbers, as in Vec2(x, y).
+        bool parseNumbers(int count, float* numbers)
+        {
+            if (!accept('(')) return fail("expected \"(\"");
+            for (int i = 0; i < count; i++)
+            {
+                if (i > 0 && !accept(',')) return fail("expected \",\"");
+                if (!parseNumber(numbers[i])) return fail("expected number");
+            }
+            if (!accept(')')) return fail("expected \")\"");
+            return true;
+        }
+        bool parseArgument(Argument& argument)
+        {
+            skipSpace();
+            if (std::isalpha(*next_))
+            {
+                const char* start = next_;
+                std::string name = parseName();
+                if (name == "Vec2")
+                {
+                    argument.type = 'v';
+                    return parseNumbers(2, argument.numbers);
+                }
+                if (name == "Vec3")
+                {
+                    argument.type = 'V';
+                    return parseNumbers(3, argument.numbers);
+                }
+                next_ = start;
+                argument.type = 't';
+                argument.node = parseTexture();
+                if (argument.node < 0) return false;
+                argument.texture = nodes_[argument.node];
+                return true;
+            }
+            argument.type = 'f';
+            return parseNumber(argument.numbers[0]) || fail("expected number");
+        }
+        // Parse comma separated arguments, up to closing parenthesis. Writes
+        // types of arguments, as a string, to "signature".
+        static const int max_arguments = 9;
+        bool parseArguments(Argument* arguments, char* signature)
+        {
+            if (accept(')')) return true;
+            int count = 0;
+            do
+            {
+                if (count == max_arguments) return fail("too many arguments");
+                if (!parseArgument(arguments[count])) return false;
+                signature[count] = arguments[count].type;
+                count++;
+            }
+            while (accept(','));
+            return accept(')') || fail("expected \")\"");
+        }
+        // Parse an operator and its arguments, look up the Constructor whose
+        // name and signature match. Returns index of node (in "nodes_") for
+        // the operator, or -1 on error. Hash-consing: a subtree equal to one
+        // parsed earlier (same Constructor, numbers, and subtree nodes) gets
+        // that earlier node, so evolved programs with repeated subtrees build
+        // a DAG in which each is constructed (and evaluated) just once.
+        int parseTexture()
+        {
+            std::string name = parseName();
+            if (name.empty() || !accept('('))
+            {
+                fail("expected operator");
+                return -1;
+            }
+            Argument arguments[max_arguments];
+            char signature[max_arguments + 1] = {0};
+            if (!parseArguments(arguments, signature)) return -1;
+            const std::vector<Constructor>& table = constructors();
+            for (int c = 0; c < int(table.size()); c++)
+            {
+                if (name == table[c].name &&
+                    std::strcmp(signature, table[c].signature) == 0)
+                {
+                    // Key is bytes of Constructor index and arguments.
+                    std::string key;
+                    auto append = [&](const void* data, size_t size)
+                        { key.append(static_cast<const char*>(data), size); };
+                    append(&c, sizeof(c));
+                    for (int i = 0; signature[i]; i++)
+                    {
+                        append(arguments[i].numbers,
+                               sizeof(arguments[i].numbers));
+                        append(&arguments[i].node, sizeof(arguments[i].node));
+                    }
+                    auto found = node_for_key_.find(key);
+                    if (found != node_for_key_.end()) return found->second;
+                    const Texture* texture = nullptr;
+                    bytes_ += Arena::slotSize(table[c].size);
+                    if (arena_)
+                    {
+                        void* address = arena_->allocate(table[c].size,
+                                                         table[c].destroy);
+                        texture = table[c].construct(address, arguments);
+                    }
+                    int node = int(nodes_.size());
+                    nodes_.push_back(texture);
+                    node_for_key_[key] = node;
+                    return node;
+                }
+            }
+            fail("no " + name + " with arguments (" + signature + ")");
+            return -1;
+        }
+        const char* text_;
+        const char* next_;
+        Arena* arena_;
+        std::string error_;
+        size_t bytes_ = 0;
+        // Operators parsed so far, each distinct subtree once (in the sizing
+        // pass, nullptr placeholders), and lookup table for hash-consing.
+        std::vector<const Texture*> nodes_;
+        std::unordered_map<std::string, int> node_for_key_;
+    };
+}
+
+// Parse "source" once to check it and size the Arena, then again to build.
+ParsedTexture::ParsedTexture(const std::string& source)
+{
+    Parser sizing(source, nullptr);
+    const Texture* root = nullptr;
+    if (!sizing.parse(root))
+    {
+        error_ = sizing.error();
+        return;
+    }
+    arena_.reserve(sizing.bytes());
+    Parser building(source, &arena_);
+    building.parse(root_);
+    assert(root_ && arena_.used() == arena_.capacity());
+    operator_count_ = building.operatorCount();
+}
@@ -0,0 +1,87 @@
+//
+//  Parser.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  Build a Texture tree at run time from its textual form, the same C++-like
+//  syntax used for the random programs at the end of main.cpp, for example:
+//
+//      Twist(-1.5, -3.1, Vec2(0.38, 0.83), Scale(0.2, Uniform(0.3, 0.7, 1)))
+//
+//  Arguments are numbers, Vec2(x, y), Vec3(x, y, z), or nested operators. An
+//  operator name plus the types of its arguments must match a constructor in
+//  Operators.h which takes Textures (not Colors) for its texture parameters.
+//
+//  A ParsedTexture owns all of the operator objects in its tree. They are
+//  allocated in an Arena: a single block of memory, sized by a first parsing
+//  pass which checks syntax and sums the sizes of operators, then filled in by
+//  a second pass which constructs them. (Some operators, like LotsOfSpots,
+//  still make heap allocations of their own.) Repeated subtrees, common in
+//  evolved programs, are merged: each distinct subtree is constructed once and
+//  shared, making the tree a DAG. (Program then evaluates each node once.)
+
+#pragma once
+#include "Texture.h"
+#include <cstddef>
+#include <string>
+
+// Storage for a group of objects allocated and freed together. Memory is
+// reserved all at once, then objects are constructed in it one after another.
+// The destructor destroys them in reverse order then frees the memory.
+class Arena
+{
+public:
+    Arena() {}
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    // Bytes of arena needed to hold an object of "size" bytes.
+    static size_t slotSize(size_t size);
+    // Allocate the arena's memory. Only called once, before allocate().
+    void reserve(size_t bytes);
+    // Return address for an object of "size" bytes, which must then be
+    // constructed there. Its destructor is called with that address.
+    void* allocate(size_t size, void (*destroy)(void*));
+    // Bytes reserved, and bytes allocated so far.
+    size_t capacity() const { return capacity_; }
+    size_t used() const { return used_; }
+private:
+    // Precedes each object, so they can be destroyed in reverse order.
+    class Header
+    {
+    public:
+        void (*destroy)(void*);
+        Header* previous;
+    };
+    static const size_t alignment = alignof(std::max_align_t);
+    static size_t roundUp(size_t size)
+        { return (size + alignment - 1) / alignment * alignment; }
+    char* memory_ = nullptr;
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+    Header* last_ = nullptr;
+};
+
+// A Texture tree constructed by parsing a string. Check valid() before using
+// texture(). When parsing fails, error() describes the problem.
+class ParsedTexture
+{
+public:
+    ParsedTexture(const std::string& source);
+    ParsedTexture(const ParsedTexture&) = delete;
+    ParsedTexture& operator=(const ParsedTexture&) = delete;
+    bool valid() const { return root_ != nullptr; }
+    const Texture& texture() const { assert(valid()); return *root_; }
+    const std::string& error() const { return error_; }
+    // Number of distinct operators in tree (after merging repeated subtrees)
+    // and bytes of arena used to hold them.
+    int operatorCount() const { return operator_count_; }
+    size_t arenaBytes() const { return arena_.capacity(); }
+private:
+    Arena arena_;
+    const Texture* root_ = nullptr;
+    int operator_count_ = 0;
+    std::string error_;
+};
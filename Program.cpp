@@ -0,0 +1,825 @@
+//
+//  Program.cpp
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+
+#include "Program.h"
+#include "Operators.h"
+
+namespace
+{
+    // Type of register written by each opcode: position, alpha, or color.
+    enum class RegisterType { Position, Alpha, Color };
+    RegisterType outputType(Program::Opcode opcode)
+    {
+        switch (opcode)
+        {
+            case Program::Opcode::Scale:
+            case Program::Opcode::Rotate:
+            case Program::Opcode::Translate:
+            case Program::Opcode::Affine:
+            case Program::Opcode::Matrix:
+            case Program::Opcode::Warp:
+            case Program::Opcode::Subset:
+                return RegisterType::Position;
+            case Program::Opcode::SpotAlpha:
+            case Program::Opcode::GradationAlpha:
+            case Program::Opcode::GratingAlpha:
+            case Program::Opcode::NoiseAlpha:
+            case Program::Opcode::Luminance:
+                return RegisterType::Alpha;
+            default:
+                return RegisterType::Color;
+        }
+    }
+    // Types of registers read by "opcode", in order: P, A, or C for each of
+    // Instruction::inputs. See comments on Program::Opcode.
+    const char* inputTypes(Program::Opcode opcode)
+    {
+        switch (opcode)
+        {
+            case Program::Opcode::Uniform:
+                return "";
+            case Program::Opcode::Luminance:
+            case Program::Opcode::Gather:
+            case Program::Opcode::EndSubset:
+            case Program::Opcode::AdjustBrightness:
+            case Program::Opcode::Gamma:
+            case Program::Opcode::RgbBox:
+            case Program::Opcode::MapColor:
+                return "C";
+            case Program::Opcode::Subset:
+                return "PA";
+            case Program::Opcode::Interpolate:
+                return "ACC";
+            case Program::Opcode::Add:
+            case Program::Opcode::Subtract:
+            case Program::Opcode::Multiply:
+            case Program::Opcode::AbsDiff:
+            case Program::Opcode::Max:
+            case Program::Opcode::Min:
+                return "CC";
+            default:
+                return "P";
+        }
+    }
+    RegisterType registerType(char type_code)
+    {
+        return (type_code == 'P' ? RegisterType::Position :
+                (type_code == 'A' ? RegisterType::Alpha : RegisterType::Color));
+    }
+    // A Texture evaluated by running a Program, for Program::verify().
+    class ProgramTexture : public Texture
+    {
+    public:
+        ProgramTexture(const Program& _program) : program(_program) {}
+        Color getColor(Vec2 position) const override
+        {
+            Color color;
+            program.run(1, &position, &color);
+            return color;
+        }
+        void getColors(int count,
+                       const Vec2* positions,
+                       Color* colors) const override
+        {
+            program.run(count, positions, colors);
+        }
+    private:
+        const Program& program;
+    };
+}
+
+// Compile the tree rooted at "texture", then allocate registers.
+Program::Program(const Texture& texture, bool optimize) : optimize_(optimize)
+{
+    result_ = compile(texture, input_position);
+    if (optimize_) removeDeadInstructions();
+    allocateRegisters();
+}
+
+// Compile "texture" (at the positions in register "position") unless it was
+// already compiled for those positions, in which case return that register.
+// Subtrees shared in a DAG of Textures (see ParsedTexture) compile just once.
+// Inside a Subset, if "texture" was already compiled for the enclosing batch,
+// its colors are gathered from there rather than computed again.
+int Program::compile(const Texture& texture, int position)
+{
+    int scope = currentScope();
+    auto found = compiled_.find(std::make_tuple(&texture, position, scope));
+    if (found != compiled_.end()) return found->second;
+    int colors = -1;
+    if (scope >= 0 && position == instructions_[scope].output)
+    {
+        int outer_position = instructions_[scope].inputs[0];
+        int outer_scope = ((open_subsets_.size() > 1) ?
+                           open_subsets_[open_subsets_.size() - 2] : -1);
+        auto outer = compiled_.find(std::make_tuple(&texture,
+                                                    outer_position,
+                                                    outer_scope));
+        if (outer != compiled_.end())
+            colors = emit(Opcode::Gather, {outer->second});
+    }
+    if (colors < 0) colors = texture.compile(*this, position);
+    compiled_[std::make_tuple(&texture, position, scope)] = colors;
+    return colors;
+}
+
+// Add an Instruction, returning its "output" register. Each output is a new
+// "virtual" register, mapped onto storage later by allocateRegisters(). When
+// an identical instruction was emitted before (same opcode, inputs, constants
+// and operator, inside the same Subset) its register is returned instead.
+int Program::emit(Instruction instruction)
+{
+    if (optimize_)
+    {
+        int folded = fold(instruction);
+        if (folded >= 0) return folded;
+    }
+    Opcode opcode = instruction.opcode;
+    bool shareable = (opcode != Opcode::Subset && opcode != Opcode::EndSubset);
+    std::string key;
+    if (shareable)
+    {
+        // Bytes which determine the instruction's value. (Constants compare
+        // bitwise, so for example 0 and -0 are considered distinct.)
+        int scope = currentScope();
+        auto append = [&](const void* data, size_t size)
+            { key.append(static_cast<const char*>(data), size); };
+        append(&opcode, sizeof(opcode));
+        append(instruction.inputs, sizeof(instruction.inputs));
+        append(instruction.constants, sizeof(instruction.constants));
+        append(&instruction.texture, sizeof(instruction.texture));
+        append(&scope, sizeof(scope));
+        auto found = emitted_.find(key);
+        if (found != emitted_.end())
+        {
+            shared_instruction_count_++;
+            return found->second;
+        }
+    }
+    int pc = int(instructions_.size());
+    switch (outputType(opcode))
+    {
+        case RegisterType::Position: instruction.output = position_count_++;
+                                     position_sources_.push_back(pc);
+                                     break;
+        case RegisterType::Alpha:    instruction.output = alpha_count_++;
+                                     alpha_sources_.push_back(pc);
+                                     break;
+        case RegisterType::Color:    instruction.output = color_count_++;
+                                     color_sources_.push_back(pc);
+                                     break;
+    }
+    instructions_.push_back(instruction);
+    if (shareable) emitted_[key] = instruction.output;
+    return instruction.output;
+}
+
+// Return a register holding the value of "instruction" computed more cheaply,
+// or -1 if there is none. Instructions which would only copy their input are
+// replaced by it, as are Max or Min of the same input twice. An affine
+// transform of positions from another is fused with it into one Matrix.
+// Instructions with all inputs constant are evaluated now, becoming a Uniform.
+int Program::fold(const Instruction& instruction)
+{
+    const float* k = instruction.constants;
+    const int* in = instruction.inputs;
+    double b[6], a[6], b_footprint, a_footprint;
+    if (outputType(instruction.opcode) == RegisterType::Position &&
+        isAffine(in[0]) &&
+        getMatrix(instruction, b, b_footprint))
+    {
+        const Instruction& previous = instructions_[position_sources_[in[0]]];
+        getMatrix(previous, a, a_footprint);
+        // Matrix product: apply "a" then "b".
+        auto product = [&](int row, int column)
+        {
+            return float(b[row * 3] * a[column] +
+                         b[row * 3 + 1] * a[3 + column] +
+                         (column == 2 ? b[row * 3 + 2] : 0));
+        };
+        return emit(Opcode::Matrix,
+                    {previous.inputs[0]},
+                    {product(0, 0), product(0, 1), product(0, 2),
+                     product(1, 0), product(1, 1), product(1, 2),
+                     float(a_footprint * b_footprint)});
+    }
+    auto isColor = [&](int colors, Color color)
+        { return isConstant(colors) && constantColor(colors) == color; };
+    Color black(0, 0, 0);
+    Color white(1, 1, 1);
+    switch (instruction.opcode)
+    {
+        case Opcode::Scale:
+            if (k[0] == 1) return in[0];
+            break;
+        case Opcode::Rotate:
+            if (k[0] == 0 && k[1] == 1) return in[0];
+            break;
+        case Opcode::Translate:
+            if (k[0] == 0 && k[1] == 0) return in[0];
+            break;
+        case Opcode::Affine:
+            if (k[0] == 0 && k[1] == 0 && k[2] == 1 && k[3] == 0 &&
+                k[4] == 0 && k[5] == 1 && k[6] == 1) return in[0];
+            break;
+        case Opcode::AdjustBrightness:
+            if (k[0] == 1) return in[0];
+            break;
+        case Opcode::Add:
+            if (isColor(in[0], black)) return in[1];
+            if (isColor(in[1], black)) return in[0];
+            break;
+        case Opcode::Subtract:
+            if (isColor(in[1], black)) return in[0];
+            break;
+        case Opcode::Multiply:
+            if (isColor(in[0], white)) return in[1];
+            if (isColor(in[1], white)) return in[0];
+            break;
+        case Opcode::Max:
+        case Opcode::Min:
+            if (in[0] == in[1]) return in[0];
+            break;
+        default:
+            break;
+    }
+    // Color from constant colors (not an alpha, or a Subset's scatter) is a
+    // constant. Within a Subset, Gather of a constant is the same constant.
+    Opcode opcode = instruction.opcode;
+    if (outputType(opcode) != RegisterType::Color) return -1;
+    if (opcode == Opcode::EndSubset || opcode == Opcode::Uniform) return -1;
+    const char* in_types = inputTypes(opcode);
+    if (!in_types[0]) return -1;
+    for (int i = 0; in_types[i]; i++)
+        if (in_types[i] != 'C' || !isConstant(in[i])) return -1;
+    Color color = ((opcode == Opcode::Gather) ?
+                   constantColor(in[0]) :
+                   evaluate(instruction));
+    return emit(Opcode::Uniform, {}, {color.r(), color.g(), color.b()});
+}
+
+// While compiling: true if position register "position" was written by an
+// affine transform instruction.
+bool Program::isAffine(int position) const
+{
+    double matrix[6], footprint_scale;
+    int source = position_sources_[position];
+    return (optimize_ &&
+            source >= 0 &&
+            getMatrix(instructions_[source], matrix, footprint_scale));
+}
+
+// If "instruction" is an affine transform, get it as a 2×3 matrix and the
+// factor by which it divides SampleFootprint. (Not for Scale by zero.)
+bool Program::getMatrix(const Instruction& instruction,
+                        double m[6],
+                        double& footprint_scale)
+{
+    const float* k = instruction.constants;
+    auto set = [&](double m0, double m1, double m2,
+                   double m3, double m4, double m5, double footprint)
+    {
+        m[0] = m0; m[1] = m1; m[2] = m2;
+        m[3] = m3; m[4] = m4; m[5] = m5;
+        footprint_scale = footprint;
+        return true;
+    };
+    switch (instruction.opcode)
+    {
+        case Opcode::Scale:
+            if (k[0] == 0) return false;
+            return set(1.0 / k[0], 0, 0, 0, 1.0 / k[0], 0, std::abs(k[0]));
+        case Opcode::Rotate:
+            return set(k[1], k[0], 0, -k[0], k[1], 0, 1);
+        case Opcode::Translate:
+            return set(1, 0, -k[0], 0, 1, -k[1], 1);
+        case Opcode::Affine:
+            return set(k[2], k[3], -(double(k[0]) * k[2] + double(k[1]) * k[3]),
+                       k[4], k[5], -(double(k[0]) * k[4] + double(k[1]) * k[5]),
+                       k[6]);
+        case Opcode::Matrix:
+            return set(k[0], k[1], k[2], k[3], k[4], k[5], k[6]);
+        default:
+            return false;
+    }
+}
+
+// While compiling: true if color register "colors" was written by a Uniform.
+bool Program::isConstant(int colors) const
+{
+    return (optimize_ &&
+            colors < int(color_sources_.size()) &&
+            instructions_[color_sources_[colors]].opcode == Opcode::Uniform);
+}
+
+// Color in register "colors", for which isConstant() is true.
+Color Program::constantColor(int colors) const
+{
+    assert(isConstant(colors));
+    const float* k = instructions_[color_sources_[colors]].constants;
+    return Color(k[0], k[1], k[2]);
+}
+
+// True if alpha register "alpha" is the Luminance of a constant color.
+bool Program::isConstantAlpha(int alpha, float& value) const
+{
+    const Instruction& source = instructions_[alpha_sources_[alpha]];
+    bool constant = (optimize_ &&
+                     source.opcode == Opcode::Luminance &&
+                     isConstant(source.inputs[0]));
+    if (constant) value = constantColor(source.inputs[0]).luminance();
+    return constant;
+}
+
+// Value of color "instruction" whose inputs are all constant. To get exactly
+// the result it would have at run time, it is run in a tiny Program of its
+// own, after Uniform instructions for each input.
+Color Program::evaluate(const Instruction& instruction) const
+{
+    Program tiny;
+    Instruction copy = instruction;
+    const char* in_types = inputTypes(copy.opcode);
+    int inputs = 0;
+    for (; in_types[inputs]; inputs++)
+    {
+        Color color = constantColor(copy.inputs[inputs]);
+        Instruction uniform;
+        uniform.opcode = Opcode::Uniform;
+        uniform.output = inputs;
+        uniform.constants[0] = color.r();
+        uniform.constants[1] = color.g();
+        uniform.constants[2] = color.b();
+        tiny.instructions_.push_back(uniform);
+        copy.inputs[inputs] = inputs;
+    }
+    copy.output = inputs;
+    tiny.instructions_.push_back(copy);
+    tiny.color_count_ = inputs + 1;
+    tiny.result_ = inputs;
+    Vec2 position;
+    Color color;
+    tiny.run(1, &position, &color);
+    return color;
+}
+
+// Remove instructions whose outputs are not used. Walking backward from the
+// end, an instruction is kept if a kept instruction reads its output, or if
+// it writes the result. A Subset is kept only if its EndSubset is.
+void Program::removeDeadInstructions()
+{
+    const int types = 3;
+    std::vector<bool> live[types];
+    live[int(RegisterType::Position)].resize(position_count_, false);
+    live[int(RegisterType::Alpha)].resize(alpha_count_, false);
+    live[int(RegisterType::Color)].resize(color_count_, false);
+    live[int(RegisterType::Color)][result_] = true;
+    int count = int(instructions_.size());
+    std::vector<bool> keep(count, false);
+    for (int pc = count - 1; pc >= 0; pc--)
+    {
+        const Instruction& instruction = instructions_[pc];
+        int t = int(outputType(instruction.opcode));
+        keep[pc] = ((instruction.opcode == Opcode::Subset) ?
+                    keep[instruction.end] :
+                    live[t][instruction.output]);
+        if (!keep[pc]) continue;
+        const char* in_types = inputTypes(instruction.opcode);
+        for (int i = 0; in_types[i]; i++)
+            live[int(registerType(in_types[i]))][instruction.inputs[i]] = true;
+    }
+    // Compact kept instructions, renumbering the "end" of each Subset.
+    std::vector<int> new_index(count, -1);
+    int kept = 0;
+    for (int pc = 0; pc < count; pc++)
+    {
+        if (!keep[pc]) continue;
+        new_index[pc] = kept;
+        instructions_[kept++] = instructions_[pc];
+    }
+    instructions_.resize(kept);
+    for (auto& instruction : instructions_)
+        if (instruction.opcode == Opcode::Subset)
+            instruction.end = new_index[instruction.end];
+}
+
+// Verification mode for optimization: compare "texture" evaluated as a tree
+// of operators with the same Texture compiled into an optimized Program.
+float Program::verify(const Texture& texture, int size, bool display)
+{
+    Program program(texture);
+    ProgramTexture optimized(program);
+    if (display) Texture::diff(texture, optimized, "", size);
+    return Texture::diffStatistics(texture, optimized, size, false);
+}
+
+// Map virtual registers onto as few as possible, to keep the register file
+// small enough to stay in cache. Walking instructions in order, each output
+// is assigned a free register, and each input is freed after its last use.
+// The output is assigned before inputs are freed, so never aliases them
+// (EndSubset's scatter depends on that). The input and result registers are
+// never freed.
+void Program::allocateRegisters()
+{
+    const int types = 3;
+    int counts[types] = {position_count_, alpha_count_, color_count_};
+    // Index of last instruction to read each virtual register, by type.
+    std::vector<int> last_use[types];
+    for (int t = 0; t < types; t++) last_use[t].resize(counts[t], -1);
+    int forever = int(instructions_.size());
+    last_use[int(RegisterType::Position)][input_position] = forever;
+    last_use[int(RegisterType::Color)][result_] = forever;
+    for (int pc = 0; pc < int(instructions_.size()); pc++)
+    {
+        const Instruction& instruction = instructions_[pc];
+        const char* in_types = inputTypes(instruction.opcode);
+        for (int i = 0; in_types[i]; i++)
+        {
+            int t = int(registerType(in_types[i]));
+            last_use[t][instruction.inputs[i]] = pc;
+        }
+    }
+    // Virtual to allocated register, free registers, and count, by type.
+    std::vector<int> allocated[types];
+    std::vector<int> free_list[types];
+    int allocated_count[types] = {1, 0, 0};
+    for (int t = 0; t < types; t++) allocated[t].resize(counts[t], -1);
+    allocated[int(RegisterType::Position)][input_position] = input_position;
+    auto release = [&](int t, int r)
+    {
+        free_list[t].push_back(allocated[t][r]);
+        last_use[t][r] = -1;
+    };
+    for (int pc = 0; pc < int(instructions_.size()); pc++)
+    {
+        Instruction& instruction = instructions_[pc];
+        int t = int(outputType(instruction.opcode));
+        int r = instruction.output;
+        if (free_list[t].empty())
+        {
+            allocated[t][r] = allocated_count[t]++;
+        }
+        else
+        {
+            allocated[t][r] = free_list[t].back();
+            free_list[t].pop_back();
+        }
+        instruction.output = allocated[t][r];
+        const char* in_types = inputTypes(instruction.opcode);
+        for (int i = 0; in_types[i]; i++)
+        {
+            int ti = int(registerType(in_types[i]));
+            int ri = instruction.inputs[i];
+            instruction.inputs[i] = allocated[ti][ri];
+            if (last_use[ti][ri] == pc) release(ti, ri);
+        }
+        // Output never read (except final result) can be reused at once.
+        if (last_use[t][r] == -1) release(t, r);
+    }
+    result_ = allocated[int(RegisterType::Color)][result_];
+    position_count_ = allocated_count[int(RegisterType::Position)];
+    alpha_count_ = allocated_count[int(RegisterType::Alpha)];
+    color_count_ = allocated_count[int(RegisterType::Color)];
+}
+
+// Shorthand to emit an Instruction given its parts.
+int Program::emit(Opcode opcode,
+                  std::initializer_list<int> inputs,
+                  std::initializer_list<float> constants,
+                  const Texture* texture)
+{
+    Instruction instruction;
+    instruction.opcode = opcode;
+    assert(inputs.size() <= 3 && constants.size() <= 8);
+    std::copy(inputs.begin(), inputs.end(), instruction.inputs);
+    std::copy(constants.begin(), constants.end(), instruction.constants);
+    instruction.texture = texture;
+    return emit(instruction);
+}
+
+// Emit an Affine instruction mapping positions into the local space of
+// "transform". (Its scale must be nonzero.)
+int Program::emitLocalize(int position, const TwoPointTransform& transform)
+{
+    float scale = transform.scale();
+    assert(scale != 0);
+    Vec2 x = transform.xBasis() / sq(scale);
+    Vec2 y = transform.yBasis() / sq(scale);
+    Vec2 origin = transform.origin();
+    return emit(Opcode::Affine,
+                {position},
+                {origin.x(), origin.y(), x.x(), x.y(), y.x(), y.y(), scale});
+}
+
+// Emit an alpha instruction for an operator whose getAlphas() localizes
+// positions by "transform". If positions come from an affine transform, then
+// "transform" is fused with it (by fold()) and applied before getAlphas().
+int Program::emitAlpha(Opcode opcode,
+                       int position,
+                       const TwoPointTransform& transform,
+                       const Texture* texture)
+{
+    if (!isAffine(position) || transform.scale() == 0)
+        return emit(opcode, {position}, {}, texture);
+    return emit(opcode, {emitLocalize(position, transform)}, {1}, texture);
+}
+
+// Emit instructions to blend textures "t0" and "t1" according to alphas in
+// register "alpha". Like interpolatePointsOnTextures(), "t0" is evaluated (on
+// a Subset) only where alpha is not 1, "t1" only where alpha is not 0.
+int Program::emitInterpolate(int alpha,
+                             int position,
+                             const Texture& t0,
+                             const Texture& t1)
+{
+    // With a constant alpha, each texture is needed everywhere or nowhere.
+    float constant_alpha = 0;
+    if (isConstantAlpha(alpha, constant_alpha))
+    {
+        if (constant_alpha == 0) return compile(t0, position);
+        if (constant_alpha == 1) return compile(t1, position);
+        return emit(Opcode::Interpolate, {alpha,
+                                          compile(t0, position),
+                                          compile(t1, position)});
+    }
+    if (optimize_ && &t0 == &t1) return compile(t0, position);
+    auto subset = [&](const Texture& texture, bool where_not_one)
+    {
+        int start = int(instructions_.size());
+        int gathered = emit(Opcode::Subset,
+                            {position, alpha},
+                            {where_not_one ? 1.0f : 0.0f});
+        open_subsets_.push_back(start);
+        max_subset_depth_ = std::max(max_subset_depth_,
+                                     int(open_subsets_.size()));
+        int colors = compile(texture, gathered);
+        open_subsets_.pop_back();
+        int scattered = emit(Opcode::EndSubset, {colors});
+        instructions_[start].end = int(instructions_.size()) - 1;
+        // A constant needs no Subset. (The unused one is removed later.)
+        if (!isConstant(colors)) return scattered;
+        Color color = constantColor(colors);
+        return emit(Opcode::Uniform, {}, {color.r(), color.g(), color.b()});
+    };
+    int colors0 = subset(t0, true);
+    int colors1 = subset(t1, false);
+    return emit(Opcode::Interpolate, {alpha, colors0, colors1});
+}
+
+// Evaluate the compiled Texture at "count" positions (any number).
+// Registers are reused by later calls on the same thread, unless a Fallback
+// instruction leads to a nested call, which then allocates its own.
+void Program::run(int count, const Vec2* positions, Color* colors) const
+{
+    thread_local Registers reused;
+    thread_local bool reused_busy = false;
+    Registers nested;
+    bool nested_call = reused_busy;
+    Registers& registers = nested_call ? nested : reused;
+    reused_busy = true;
+    const int batch = Texture::max_batch_size;
+    auto fit = [&](auto& v, size_t size)
+        { if (v.size() < size) v.resize(size); };
+    fit(registers.positions, position_count_ * batch);
+    fit(registers.alphas, alpha_count_ * batch);
+    fit(registers.colors, color_count_ * batch);
+    fit(registers.footprints, position_count_);
+    fit(registers.subsets, max_subset_depth_);
+    for (int first = 0; first < count; first += batch)
+    {
+        int n = std::min(count - first, batch);
+        runBatch(n, positions + first, colors + first, registers);
+    }
+    if (!nested_call) reused_busy = false;
+}
+
+// Evaluate batch of up to Texture::max_batch_size positions. Registers are
+// arrays of max_batch_size values. Instructions inside a Subset use only the
+// first "count" of them, where "count" is the size of that subset.
+void Program::runBatch(int count,
+                       const Vec2* positions,
+                       Color* colors,
+                       Registers& registers) const
+{
+    const int batch = Texture::max_batch_size;
+    Vec2* const positions_base = registers.positions.data();
+    float* const alphas_base = registers.alphas.data();
+    Color* const colors_base = registers.colors.data();
+    float* const footprints = registers.footprints.data();
+    auto p = [=](int r) { return positions_base + r * batch; };
+    auto a = [=](int r) { return alphas_base + r * batch; };
+    auto c = [=](int r) { return colors_base + r * batch; };
+    std::copy(positions, positions + count, p(input_position));
+    footprints[input_position] = SampleFootprint::get();
+    // Depth of current Subset in stack of nested Subsets.
+    int depth = 0;
+    for (int pc = 0; pc < int(instructions_.size()); pc++)
+    {
+        const Instruction& instruction = instructions_[pc];
+        const float* k = instruction.constants;
+        const int* in = instruction.inputs;
+        int out = instruction.output;
+        auto both = [&](auto function)
+        {
+            for (int i = 0; i < count; i += 4)
+            {
+                int n = std::min(4, count - i);
+                Color4 c0 = Color4::load(c(in[0]) + i, n);
+                Color4 c1 = Color4::load(c(in[1]) + i, n);
+                function(c0, c1).store(c(out) + i, n);
+            }
+        };
+        auto each = [&](auto function)
+        {
+            for (int i = 0; i < count; i += 4)
+            {
+                int n = std::min(4, count - i);
+                function(Color4::load(c(in[0]) + i, n)).store(c(out) + i, n);
+            }
+        };
+        switch (instruction.opcode)
+        {
+            case Opcode::Scale:
+                for (int i = 0; i < count; i++) p(out)[i] = p(in[0])[i] / k[0];
+                footprints[out] = footprints[in[0]] / std::abs(k[0]);
+                break;
+            case Opcode::Rotate:
+                for (int i = 0; i < count; i++)
+                    p(out)[i] = p(in[0])[i].rotate(k[0], k[1]);
+                footprints[out] = footprints[in[0]];
+                break;
+            case Opcode::Translate:
+                for (int i = 0; i < count; i++)
+                    p(out)[i] = p(in[0])[i] - Vec2(k[0], k[1]);
+                footprints[out] = footprints[in[0]];
+                break;
+            case Opcode::Affine:
+                for (int i = 0; i < count; i++)
+                {
+                    Vec2 offset = p(in[0])[i] - Vec2(k[0], k[1]);
+                    p(out)[i] = Vec2(offset.dot(Vec2(k[2], k[3])),
+                                     offset.dot(Vec2(k[4], k[5])));
+                }
+                footprints[out] = footprints[in[0]] / k[6];
+                break;
+            case Opcode::Matrix:
+                for (int i = 0; i < count; i++)
+                {
+                    Vec2 v = p(in[0])[i];
+                    p(out)[i] = Vec2(k[0] * v.x() + k[1] * v.y() + k[2],
+                                     k[3] * v.x() + k[4] * v.y() + k[5]);
+                }
+                footprints[out] = footprints[in[0]] / k[6];
+                break;
+            case Opcode::Warp:
+                for (int i = 0; i < count; i++)
+                    p(out)[i] = instruction.warp(instruction.texture,
+                                                 p(in[0])[i]);
+                footprints[out] = (k[0] == 0) ? 0 : footprints[in[0]] / k[0];
+                break;
+            case Opcode::SpotAlpha:
+                static_cast<const Spot*>(instruction.texture)->
+                    getAlphas(count, p(in[0]), a(out));
+                break;
+            case Opcode::GradationAlpha:
+                static_cast<const Gradation*>(instruction.texture)->
+                    getAlphas(count, p(in[0]), a(out), k[0] == 1);
+                break;
+            case Opcode::GratingAlpha:
+                static_cast<const Grating*>(instruction.texture)->
+                    getAlphas(count, p(in[0]), a(out), k[0] == 1);
+                break;
+            case Opcode::NoiseAlpha:
+            {
+                SampleFootprint::Scope footprint(footprints[in[0]]);
+                static_cast<const Noise*>(instruction.texture)->
+                    getAlphas(count, p(in[0]), a(out), k[0] == 1);
+                break;
+            }
+            case Opcode::Luminance:
+                for (int i = 0; i < count; i++)
+                    a(out)[i] = c(in[0])[i].luminance();
+                break;
+            case Opcode::Uniform:
+                for (int i = 0; i < count; i++)
+                    c(out)[i] = Color(k[0], k[1], k[2]);
+                break;
+            case Opcode::Fallback:
+            {
+                SampleFootprint::Scope footprint(footprints[in[0]]);
+                instruction.texture->getColors(count, p(in[0]), c(out));
+                break;
+            }
+            case Opcode::Subset:
+            {
+                Subset& subset = registers.subsets[depth++];
+                subset.outer_count = count;
+                subset.count = 0;
+                bool where_not_one = k[0] == 1;
+                for (int i = 0; i < count; i++)
+                {
+                    float alpha = a(in[1])[i];
+                    if (where_not_one ? alpha != 1 : alpha != 0)
+                    {
+                        p(out)[subset.count] = p(in[0])[i];
+                        subset.indices[subset.count++] = i;
+                    }
+                }
+                footprints[out] = footprints[in[0]];
+                count = subset.count;
+                // For an empty subset, skip ahead to its EndSubset.
+                if (count == 0) pc = instruction.end - 1;
+                break;
+            }
+            case Opcode::Gather:
+            {
+                const Subset& subset = registers.subsets[depth - 1];
+                for (int i = 0; i < count; i++)
+                    c(out)[i] = c(in[0])[subset.indices[i]];
+                break;
+            }
+            case Opcode::EndSubset:
+            {
+                const Subset& subset = registers.subsets[--depth];
+                for (int i = 0; i < subset.count; i++)
+                    c(out)[subset.indices[i]] = c(in[0])[i];
+                count = subset.outer_count;
+                break;
+            }
+            case Opcode::Interpolate:
+                for (int i = 0; i < count; i++)
+                {
+                    float alpha = a(in[0])[i];
+                    Color c0 = c(in[1])[i];
+                    Color c1 = c(in[2])[i];
+                    c(out)[i] = ((alpha == 0) ?
+                                 c0 :
+                                 ((alpha == 1) ?
+                                  c1 :
+                                  interpolate(alpha, c0, c1)));
+                }
+                break;
+            case Opcode::Add:
+                both([](Color4 c0, Color4 c1){ return c0 + c1; });
+                break;
+            case Opcode::Subtract:
+                both([](Color4 c0, Color4 c1){ return c0 - c1; });
+                break;
+            case Opcode::Multiply:
+                both([](Color4 c0, Color4 c1){ return c0 * c1; });
+                break;
+            case Opcode::AbsDiff:
+                both([](Color4 c0, Color4 c1)
+                {
+                    Color4 d = c0 - c1;
+                    return Color4(abs(d.r()), abs(d.g()), abs(d.b()));
+                });
+                break;
+            case Opcode::Max:
+            case Opcode::Min:
+                Texture::selectByLuminance(count,
+                                           instruction.opcode == Opcode::Max,
+                                           c(in[0]), c(in[1]), c(out));
+                break;
+            case Opcode::AdjustBrightness:
+                each([&](Color4 color){ return color * k[0]; });
+                break;
+            case Opcode::Gamma:
+                if (k[0] == 1)
+                {
+                    // pow(x, 1) is x, so just clip negative components to 0.
+                    Float4 zero(0);
+                    each([&](Color4 color)
+                    {
+                        return Color4(max(color.r(), zero),
+                                      max(color.g(), zero),
+                                      max(color.b(), zero));
+                    });
+                }
+                else
+                {
+                    each([&](Color4 color){ return color.gamma(k[0]); });
+                }
+                break;
+            case Opcode::RgbBox:
+                each([&](Color4 color)
+                {
+                    Color4 input = color.clipToUnitRGB();
+                    return Color4(remapInterval(input.r(), 0, 1, k[0], k[1]),
+                                  remapInterval(input.g(), 0, 1, k[2], k[3]),
+                                  remapInterval(input.b(), 0, 1, k[4], k[5]));
+                });
+                break;
+            case Opcode::MapColor:
+                for (int i = 0; i < count; i++)
+                    c(out)[i] = instruction.map_color(instruction.texture,
+                                                      c(in[0])[i]);
+                break;
+        }
+    }
+    std::copy(c(result_), c(result_) + count, colors);
+}
@@ -0,0 +1,285 @@
+//
+//  Program.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  A Texture tree compiled into a flat "bytecode" Program. A Texture is a deep
+//  nest of operator objects linked by const references, evaluated by recursive
+//  virtual calls. The Program constructor walks that tree once (see
+//  Texture::compile()) emitting an array of Instructions in topological order
+//  (each follows those which compute its inputs). Program::run() interprets
+//  them over a batch of positions, each instruction processing the whole batch
+//  before the next. Its registers each hold a batch of values: positions,
+//  alphas (blending weights) or colors. Dispatch is a switch on the opcode,
+//  with no virtual call except for operators which have no opcode of their
+//  own. Those compile into a Fallback instruction which calls getColors().
+//  Operators which warp positions, or map colors, one at a time (like Twist or
+//  HueOnly) compile into Warp or MapColor instructions calling their warp()
+//  or mapColor(), so their subtextures are compiled too.
+//
+//  Operators which blend two textures (such as Spot or Noise) sample each only
+//  where it contributes, as interpolatePointsOnTextures() does. They compile
+//  into a Subset instruction which gathers the positions where a texture is
+//  needed, the instructions for that texture, and an EndSubset instruction to
+//  scatter the resulting colors. Results match those of Texture::getColors()
+//  except that beneath a Warp or MapColor, subtextures are sampled in batches
+//  rather than by getColor(), which for noise may differ by rounding error.
+//
+//  Common subexpressions are computed once. A Texture which appears more than
+//  once in the tree (a DAG, like those built by ParsedTexture, which merges
+//  equal subtrees) is compiled once, as is any instruction identical to an
+//  earlier one, like the Uniform for two separate but equal Uniform objects.
+//  Inside a Subset, colors already computed for the enclosing batch are
+//  gathered rather than computed again. Once compiled, registers are allocated
+//  so each is reused after its last use, keeping the register file small.
+//
+//  Unless disabled, the Program is also optimized as it is compiled: nodes
+//  whose output is constant are evaluated once (e.g. Add of two Uniforms, or
+//  Blur of a Uniform, become a Uniform), identities are removed (e.g. Scale by
+//  1, AdjustBrightness by 1, Multiply by white, Add of black), and blends with
+//  a constant matte (SoftMatte of a Uniform) sample only the textures needed.
+//  A chain of affine transforms (such as Scale, Rotate, Translate, Affine and
+//  Stretch) is fused into one Matrix instruction, as is the TwoPointTransform
+//  of a Gradation, Grating or Noise which follows such a chain. Instructions
+//  whose results are then unused are removed. Program::verify() compares an
+//  optimized Program with the original tree. (Results may differ by rounding
+//  error, for example when transforms are fused.)
+
+#pragma once
+#include "Texture.h"
+#include "TwoPointTransform.h"
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+class Program
+{
+public:
+    // Kinds of Instruction. Each writes one register: P (position), A (alpha)
+    // or C (color). Instruction::inputs are listed in order, e.g. "A, C, C".
+    enum class Opcode
+    {
+        // Position from position: P.
+        Scale,              // divide by constants[0]
+        Rotate,             // rotate by sin and cos in constants[0, 1]
+        Translate,          // subtract (constants[0], constants[1])
+        Affine,             // localize: origin, x basis/s², y basis/s², s
+        Matrix,             // 2×3 matrix in constants[0-5], footprint / [6]
+        Warp,               // operator's warp(), footprint / constants[0]
+        // Alpha from position, by operator's getAlphas(): P. If constants[0]
+        // is 1, positions are already in the operator's local space.
+        SpotAlpha,
+        GradationAlpha,
+        GratingAlpha,
+        NoiseAlpha,
+        // Alpha from color: C.
+        Luminance,
+        // Color from nothing, constant RGB in constants[0, 1, 2].
+        Uniform,
+        // Color from position, calls operator's getColors(): P.
+        Fallback,
+        // Start a subset of the batch, selecting positions where alpha is not
+        // 1 (if constants[0] is 1) or not 0. Output is the gathered positions:
+        // P, A. Followed by instructions run on the subset, then an EndSubset.
+        Subset,
+        // Gather colors, computed on the full batch, for the current subset: C.
+        Gather,
+        // Scatter colors computed on a subset back to the full batch: C.
+        EndSubset,
+        // Color from colors.
+        Interpolate,        // A, C, C
+        Add,                // C, C
+        Subtract,           // C, C
+        Multiply,           // C, C
+        AbsDiff,            // C, C
+        Max,                // C, C
+        Min,                // C, C
+        AdjustBrightness,   // C, times constants[0]
+        Gamma,              // C, exponent constants[0]
+        RgbBox,             // C, remap into box given by constants[0-5]
+        MapColor,           // C, operator's mapColor()
+    };
+    // One step of a Program: an opcode, its constant operands, registers for
+    // its inputs and output, and (for some opcodes) the operator it came from.
+    class Instruction
+    {
+    public:
+        Opcode opcode;
+        // Index of register written, in the register file for its type.
+        int output = -1;
+        // Indices of registers read, see comments on Opcode.
+        int inputs[3] = {-1, -1, -1};
+        // Constant operands, see comments on Opcode.
+        float constants[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        // Operator providing constants and code for some opcodes (e.g. Spot's
+        // center, radii, and getAlphas()). For Fallback, the tree to evaluate.
+        const Texture* texture = nullptr;
+        // For Subset: index of its matching EndSubset instruction.
+        int end = -1;
+        // For Warp and MapColor: calls operator's warp() or mapColor().
+        Vec2 (*warp)(const Texture* texture, Vec2 position) = nullptr;
+        Color (*map_color)(const Texture* texture, Color color) = nullptr;
+    };
+    // Compile the tree rooted at "texture", optimizing unless told not to.
+    Program(const Texture& texture, bool optimize = true);
+    // Evaluate the compiled Texture at "count" positions (any number).
+    void run(int count, const Vec2* positions, Color* colors) const;
+    // Position register holding the batch of positions passed to run().
+    static const int input_position = 0;
+    // Called from Texture::compile() overrides to compile their subtextures.
+    // Compiles "texture" once for each position register (within a Subset)
+    // no matter how many times it appears in the tree. Returns color register.
+    int compile(const Texture& texture, int position);
+    // Called from Texture::compile() overrides to add an Instruction, whose
+    // "output" register is allocated here and returned. Duplicates of earlier
+    // instructions are not added, instead the earlier output is returned.
+    int emit(Instruction instruction);
+    // Shorthand to emit an Instruction given its parts.
+    int emit(Opcode opcode,
+             std::initializer_list<int> inputs,
+             std::initializer_list<float> constants = {},
+             const Texture* texture = nullptr);
+    // Emit a Warp instruction which maps positions by T::warp(), a function
+    // of one position. A footprint_scale of 0 means the warp's effect on
+    // SampleFootprint is unknown, otherwise the footprint is divided by it.
+    template <typename T>
+    int emitWarp(int position, const T* texture, float footprint_scale)
+    {
+        Instruction instruction;
+        instruction.opcode = Opcode::Warp;
+        instruction.inputs[0] = position;
+        instruction.constants[0] = footprint_scale;
+        instruction.texture = texture;
+        instruction.warp = [](const Texture* t, Vec2 p)
+            { return static_cast<const T*>(t)->warp(p); };
+        return emit(instruction);
+    }
+    // Emit a MapColor instruction which applies T::mapColor() to each color.
+    template <typename T>
+    int emitMapColor(int colors, const T* texture)
+    {
+        Instruction instruction;
+        instruction.opcode = Opcode::MapColor;
+        instruction.inputs[0] = colors;
+        instruction.texture = texture;
+        instruction.map_color = [](const Texture* t, Color c)
+            { return static_cast<const T*>(t)->mapColor(c); };
+        return emit(instruction);
+    }
+    // Emit an Affine instruction mapping positions into the local space of
+    // "transform", by TwoPointTransform::localize().
+    int emitLocalize(int position, const TwoPointTransform& transform);
+    // Emit an alpha instruction (such as GradationAlpha) for an operator whose
+    // getAlphas() localizes positions by "transform". If "position" is from an
+    // affine transform, the two are fused, and getAlphas() is given positions
+    // already in local space.
+    int emitAlpha(Opcode opcode,
+                  int position,
+                  const TwoPointTransform& transform,
+                  const Texture* texture);
+    // Emit instructions to blend textures "t0" and "t1" according to alphas
+    // in register "alpha", sampling each only where needed.
+    int emitInterpolate(int alpha,
+                        int position,
+                        const Texture& t0,
+                        const Texture& t1);
+    // While compiling: true if color register "colors" is known to hold the
+    // same color at every position, as written by a Uniform instruction.
+    bool isConstant(int colors) const;
+    // Verification mode for optimization: render "texture" as a tree and as an
+    // optimized Program, compare them with Texture::diff() (over a disk "size"
+    // pixels in diameter) and return the maximum error, the largest difference
+    // in any RGB component. When "display" is false, just compute the error.
+    static float verify(const Texture& texture, int size, bool display = true);
+    // True if this Program is optimized as it is compiled.
+    bool optimizing() const { return optimize_; }
+    // Read-only access to instructions, e.g. for printing or testing.
+    const std::vector<Instruction>& instructions() const
+        { return instructions_; }
+    // Number of duplicate instructions not emitted, because their value was
+    // already computed by an identical instruction.
+    int sharedInstructionCount() const { return shared_instruction_count_; }
+private:
+    // Used by evaluate() to build a tiny Program by hand.
+    Program() {}
+    // Number of registers of each type (position, alpha, color).
+    int position_count_ = 1;
+    int alpha_count_ = 0;
+    int color_count_ = 0;
+    // Color register holding final result.
+    int result_ = -1;
+    std::vector<Instruction> instructions_;
+    // While compiling: stack of indices of the Subset instructions enclosing
+    // the current one, and maximum depth of that stack.
+    std::vector<int> open_subsets_;
+    int max_subset_depth_ = 0;
+    // Innermost enclosing Subset (or -1 for none). Registers computed inside
+    // a Subset hold values for its gathered positions, so are shared only
+    // within the same Subset.
+    int currentScope() const
+        { return open_subsets_.empty() ? -1 : open_subsets_.back(); }
+    // While compiling: color register for each Texture (by position register
+    // and scope) and output register for each instruction (keyed by bytes of
+    // opcode, inputs, constants, operator, and scope).
+    std::map<std::tuple<const Texture*, int, int>, int> compiled_;
+    std::unordered_map<std::string, int> emitted_;
+    int shared_instruction_count_ = 0;
+    // Map "virtual" registers, one per instruction, onto as few as possible.
+    void allocateRegisters();
+    // Optimization. While compiling: whether to optimize, and the index of the
+    // instruction which wrote each virtual register (or -1 for the input).
+    bool optimize_ = true;
+    std::vector<int> position_sources_ = {-1};
+    std::vector<int> alpha_sources_;
+    std::vector<int> color_sources_;
+    // Return register holding a simpler equivalent of "instruction", or -1.
+    int fold(const Instruction& instruction);
+    // Color in register "colors", for which isConstant() is true.
+    Color constantColor(int colors) const;
+    // True if alpha register "alpha" holds the same value at every position,
+    // which is then stored in "value".
+    bool isConstantAlpha(int alpha, float& value) const;
+    // True if "position" was written by an affine transform instruction.
+    bool isAffine(int position) const;
+    // If "instruction" is an affine transform, get it as a 2×3 matrix (with
+    // rows (m[0], m[1], m[2]) and (m[3], m[4], m[5])) and the factor by which
+    // it divides SampleFootprint.
+    static bool getMatrix(const Instruction& instruction,
+                          double matrix[6],
+                          double& footprint_scale);
+    // Value of color "instruction" whose inputs are all constant.
+    Color evaluate(const Instruction& instruction) const;
+    // Remove instructions whose outputs are not used.
+    void removeDeadInstructions();
+    // A subset of a batch: its size, the size of the enclosing batch, and the
+    // indices (within the enclosing batch) of its members.
+    class Subset
+    {
+    public:
+        int count;
+        int outer_count;
+        int indices[Texture::max_batch_size];
+    };
+    // Storage for registers, each an array of Texture::max_batch_size values,
+    // the footprint (see SampleFootprint) of each position register, and the
+    // stack of nested Subsets.
+    class Registers
+    {
+    public:
+        std::vector<Vec2> positions;
+        std::vector<float> alphas;
+        std::vector<Color> colors;
+        std::vector<float> footprints;
+        std::vector<Subset> subsets;
+    };
+    // Evaluate batch of up to Texture::max_batch_size positions.
+    void runBatch(int count,
+                  const Vec2* positions,
+                  Color* colors,
+                  Registers& registers) const;
+};
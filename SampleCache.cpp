@@ -0,0 +1,124 @@
+//
+//  SampleCache.cpp
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/16/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+
+#include "SampleCache.h"
+
+std::atomic<int> SampleCache::render_pass_(0);
+std::atomic<int64_t> SampleCache::total_lookups_(0);
+std::atomic<int64_t> SampleCache::total_hits_(0);
+
+// Look up each position's grid point under its shard's lock. Compute the
+// misses (each distinct grid point once) in one batch without any lock, then
+// store them.
+void SampleCache::getColors(int count,
+                            const Vec2* positions,
+                            Color* colors) const
+{
+    assert(count <= Texture::max_batch_size);
+    int64_t keys[Texture::max_batch_size];
+    int shards[Texture::max_batch_size];
+    Vec2 points[Texture::max_batch_size];
+    for (int i = 0; i < count; i++)
+    {
+        int x = int(std::round(positions[i].x() / spacing_));
+        int y = int(std::round(positions[i].y() / spacing_));
+        keys[i] = key(x, y);
+        shards[i] = shardIndex(x, y);
+        points[i] = Vec2(x, y) * spacing_;
+    }
+    // For each position: index of its entry in the miss arrays, or -1 if hit.
+    int miss_index[Texture::max_batch_size];
+    int64_t miss_keys[Texture::max_batch_size];
+    int miss_shards[Texture::max_batch_size];
+    Vec2 miss_points[Texture::max_batch_size];
+    Color miss_colors[Texture::max_batch_size];
+    int miss_count = 0;
+    {
+        std::unique_lock<std::mutex> lock;
+        int locked = -1;
+        for (int i = 0; i < count; i++)
+        {
+            if (shards[i] != locked) lockShard(shards[i], lock);
+            locked = shards[i];
+            miss_index[i] = -1;
+            const auto& shard_colors = shards_[locked].colors;
+            auto found = shard_colors.find(keys[i]);
+            if (found != shard_colors.end())
+            {
+                colors[i] = found->second;
+                continue;
+            }
+            // Reuse an earlier miss of the same grid point in this batch.
+            for (int m = 0; m < miss_count; m++)
+                if (miss_keys[m] == keys[i]) miss_index[i] = m;
+            if (miss_index[i] == -1)
+            {
+                miss_keys[miss_count] = keys[i];
+                miss_shards[miss_count] = shards[i];
+                miss_points[miss_count] = points[i];
+                miss_index[i] = miss_count++;
+            }
+        }
+    }
+    total_lookups_ += count;
+    total_hits_ += count - miss_count;
+    if (miss_count == 0) return;
+    {
+        // Each grid point stands for a cell, so sample with at least its size.
+        float footprint = std::max(spacing_, SampleFootprint::get());
+        SampleFootprint::Scope scope(footprint);
+        texture_.getColors(miss_count, miss_points, miss_colors);
+    }
+    for (int i = 0; i < count; i++)
+        if (miss_index[i] != -1) colors[i] = miss_colors[miss_index[i]];
+    std::unique_lock<std::mutex> lock;
+    int locked = -1;
+    for (int m = 0; m < miss_count; m++)
+    {
+        if (miss_shards[m] != locked) lockShard(miss_shards[m], lock);
+        locked = miss_shards[m];
+        auto& shard_colors = shards_[locked].colors;
+        if (shard_colors.size() < max_entries / shard_count)
+            shard_colors.insert({miss_keys[m], miss_colors[m]});
+    }
+}
+
+// Lock shard "index", first releasing "lock". Discards entries from an earlier
+// render pass.
+SampleCache::Shard&
+SampleCache::lockShard(int index, std::unique_lock<std::mutex>& lock) const
+{
+    if (lock.owns_lock()) lock.unlock();
+    Shard& shard = shards_[index];
+    lock = std::unique_lock<std::mutex>(shard.mutex);
+    if (shard.render_pass != render_pass_)
+    {
+        shard.colors.clear();
+        shard.render_pass = render_pass_;
+    }
+    return shard;
+}
+
+// Grid point nearest "position".
+Vec2 SampleCache::nearestGridPoint(Vec2 position) const
+{
+    return Vec2(std::round(position.x() / spacing_),
+                std::round(position.y() / spacing_)) * spacing_;
+}
+
+// Number of colors now cached.
+int SampleCache::size() const
+{
+    int size = 0;
+    for (auto& shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.render_pass == render_pass_) size += int(shard.colors.size());
+    }
+    return size;
+}
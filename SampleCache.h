@@ -0,0 +1,85 @@
+//
+//  SampleCache.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/16/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  Memoizes a Texture's colors at positions quantized to a square grid, so
+//  that samples which land near each other are computed once. A Blur nested
+//  within another (EdgeDetect of EdgeEnhance of ...) uses one for its own
+//  colors while rendering. It would otherwise be evaluated once per subsample
+//  of every outer subsample, a cost which multiplies with each level of
+//  nesting. With the cache, each level costs about one evaluation per grid
+//  point it covers. A grid point's color is computed at the grid point itself.
+//  Blur also uses one for its input when making raster tiles.
+//
+//  Entries are kept for one render pass. SampleCache::beginRenderPass() is
+//  called at the start of each rendering; a cache holding entries from an
+//  earlier pass discards them the next time it is used. Each cache holds at
+//  most max_entries, then computes further misses without storing them.
+//
+//  Entries are divided among shard_count shards, by blocks of grid points, each
+//  with its own lock, so threads rendering different parts of an image rarely
+//  wait for each other.
+
+#pragma once
+#include "Texture.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+class SampleCache
+{
+public:
+    SampleCache(float spacing, const Texture& texture)
+      : spacing_(spacing), texture_(texture) {}
+    // Get colors at the grid points nearest the given "count" positions
+    // (which must not exceed Texture::max_batch_size) computing any which are
+    // not yet cached, in one batch, outside the lock. Thread safe.
+    void getColors(int count, const Vec2* positions, Color* colors) const;
+    // Grid point nearest "position", and distance between grid points.
+    Vec2 nearestGridPoint(Vec2 position) const;
+    float spacing() const { return spacing_; }
+    // Number of colors now cached.
+    int size() const;
+    // Start a new render pass, invalidating all entries in all caches.
+    static void beginRenderPass() { render_pass_++; }
+    // Counts, over all caches since program start, of positions looked up,
+    // and those found in the cache (including repeats within one batch).
+    static int64_t totalLookups() { return total_lookups_; }
+    static int64_t totalHits() { return total_hits_; }
+    static const int max_entries = 1 << 20;
+private:
+    // Integer grid coordinates packed into one key.
+    static int64_t key(int x, int y)
+        { return (int64_t(x) << 32) | uint32_t(y); }
+    // Shard holding grid point (x, y), by 16x16 blocks of grid points, so the
+    // nearby positions of one batch usually share a shard.
+    static int shardIndex(int x, int y)
+    {
+        uint32_t block = (uint32_t(x >> 4) * 73856093u) ^
+                         (uint32_t(y >> 4) * 19349663u);
+        return int(block % shard_count);
+    }
+    static const int shard_count = 16;
+    // Colors of some grid points, guarded by "mutex".
+    class Shard
+    {
+    public:
+        std::mutex mutex;
+        std::unordered_map<int64_t, Color> colors;
+        // Render pass for which "colors" is valid.
+        int render_pass = -1;
+    };
+    // Lock shard "index", first releasing "lock" (which may hold another) so
+    // that no thread ever holds two. Discards entries from an earlier pass.
+    Shard& lockShard(int index, std::unique_lock<std::mutex>& lock) const;
+    const float spacing_;
+    const Texture& texture_;
+    mutable Shard shards_[shard_count];
+    static std::atomic<int> render_pass_;
+    static std::atomic<int64_t> total_lookups_;
+    static std::atomic<int64_t> total_hits_;
+};
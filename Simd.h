@@ -0,0 +1,350 @@
+//
+//  Simd.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  Small portable SIMD abstraction for "packet" evaluation of textures: four
+//  samples processed at once. Float4 is four floats, Mask4 is the result of
+//  comparing two Float4s (four booleans). Vec2x4 and Color4 are packets of four
+//  Vec2s and four Colors, stored as "structure of arrays": a Float4 for each
+//  component. Uses SSE2 on x86-64, NEON on 64 bit ARM (e.g. Apple silicon),
+//  otherwise (or if TEXSYN_NO_SIMD is defined) a plain scalar implementation.
+//
+//  Operations are defined to give exactly the same float result as the
+//  corresponding scalar code in Vec2, Color, and Utilities.h. For example
+//  min(a, b) follows std::min() (including for NaN) rather than the native
+//  min instruction. One exception is Color4::luminance() which (unlike
+//  Color::luminance()) is computed in float rather than double precision.
+
+#pragma once
+#include "Vec2.h"
+#include "Color.h"
+#include <algorithm>
+#include <functional>
+
+#if defined(TEXSYN_NO_SIMD)
+    #define TEXSYN_SIMD_SCALAR
+#elif defined(__SSE2__) || defined(_M_X64)
+    #define TEXSYN_SIMD_SSE2
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #define TEXSYN_SIMD_NEON
+    #include <arm_neon.h>
+#else
+    #define TEXSYN_SIMD_SCALAR
+#endif
+
+// Four booleans, the result of comparing two Float4s. Used with select().
+class Mask4
+{
+public:
+#if defined(TEXSYN_SIMD_SSE2)
+    Mask4(__m128 m) : m_(m) {}
+    Mask4 operator&&(Mask4 m) const { return _mm_and_ps(m_, m.m_); }
+    Mask4 operator||(Mask4 m) const { return _mm_or_ps(m_, m.m_); }
+    Mask4 operator!() const
+        { return _mm_xor_ps(m_, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+    // True if any of the four booleans is true.
+    bool any() const { return _mm_movemask_ps(m_) != 0; }
+    bool lane(int i) const { return (_mm_movemask_ps(m_) >> i) & 1; }
+    __m128 m_;
+#elif defined(TEXSYN_SIMD_NEON)
+    Mask4(uint32x4_t m) : m_(m) {}
+    Mask4 operator&&(Mask4 m) const { return vandq_u32(m_, m.m_); }
+    Mask4 operator||(Mask4 m) const { return vorrq_u32(m_, m.m_); }
+    Mask4 operator!() const { return vmvnq_u32(m_); }
+    // True if any of the four booleans is true.
+    bool any() const { return vmaxvq_u32(m_) != 0; }
+    bool lane(int i) const
+    {
+        uint32_t m[4];
+        vst1q_u32(m, m_);
+        return m[i] != 0;
+    }
+    uint32x4_t m_;
+#else
+    Mask4(bool a, bool b, bool c, bool d) : m_{a, b, c, d} {}
+    Mask4 operator&&(Mask4 m) const
+        { return Mask4(m_[0] && m.m_[0], m_[1] && m.m_[1],
+                       m_[2] && m.m_[2], m_[3] && m.m_[3]); }
+    Mask4 operator||(Mask4 m) const
+        { return Mask4(m_[0] || m.m_[0], m_[1] || m.m_[1],
+                       m_[2] || m.m_[2], m_[3] || m.m_[3]); }
+    Mask4 operator!() const { return Mask4(!m_[0], !m_[1], !m_[2], !m_[3]); }
+    // True if any of the four booleans is true.
+    bool any() const { return m_[0] || m_[1] || m_[2] || m_[3]; }
+    bool lane(int i) const { return m_[i]; }
+    bool m_[4];
+#endif
+};
+
+// Four floats, operated on in parallel.
+class Float4
+{
+public:
+    static const int size = 4;
+    Float4() : Float4(0) {}
+#if defined(TEXSYN_SIMD_SSE2)
+    Float4(__m128 v) : v_(v) {}
+    Float4(float f) : v_(_mm_set1_ps(f)) {}
+    Float4(float a, float b, float c, float d) : v_(_mm_setr_ps(a, b, c, d)) {}
+    static Float4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v_); }
+    Float4 operator+(Float4 f) const { return _mm_add_ps(v_, f.v_); }
+    Float4 operator-(Float4 f) const { return _mm_sub_ps(v_, f.v_); }
+    Float4 operator*(Float4 f) const { return _mm_mul_ps(v_, f.v_); }
+    Float4 operator/(Float4 f) const { return _mm_div_ps(v_, f.v_); }
+    Mask4 operator<(Float4 f) const { return _mm_cmplt_ps(v_, f.v_); }
+    Mask4 operator>(Float4 f) const { return _mm_cmpgt_ps(v_, f.v_); }
+    Mask4 operator<=(Float4 f) const { return _mm_cmple_ps(v_, f.v_); }
+    Mask4 operator==(Float4 f) const { return _mm_cmpeq_ps(v_, f.v_); }
+    friend Float4 sqrt(Float4 f) { return _mm_sqrt_ps(f.v_); }
+    friend Float4 abs(Float4 f)
+        { return _mm_andnot_ps(_mm_set1_ps(-0.0f), f.v_); }
+    // For each lane: "mask" true selects "a", false selects "b".
+    friend Float4 select(Mask4 mask, Float4 a, Float4 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask.m_, a.v_),
+                         _mm_andnot_ps(mask.m_, b.v_));
+    }
+    // (SSE2 has no floor instruction: truncate, then adjust negative values.
+    // Floats of magnitude 2^23 or more are already integers, so are unchanged.)
+    friend Float4 floor(Float4 f)
+    {
+        Float4 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(f.v_));
+        t = select(f < t, t - 1, t);
+        return select(abs(f) < 8388608.0f, t, f);
+    }
+    __m128 v_;
+#elif defined(TEXSYN_SIMD_NEON)
+    Float4(float32x4_t v) : v_(v) {}
+    Float4(float f) : v_(vdupq_n_f32(f)) {}
+    Float4(float a, float b, float c, float d)
+    {
+        float p[4] = {a, b, c, d};
+        v_ = vld1q_f32(p);
+    }
+    static Float4 load(const float* p) { return vld1q_f32(p); }
+    void store(float* p) const { vst1q_f32(p, v_); }
+    Float4 operator+(Float4 f) const { return vaddq_f32(v_, f.v_); }
+    Float4 operator-(Float4 f) const { return vsubq_f32(v_, f.v_); }
+    Float4 operator*(Float4 f) const { return vmulq_f32(v_, f.v_); }
+    Float4 operator/(Float4 f) const { return vdivq_f32(v_, f.v_); }
+    Mask4 operator<(Float4 f) const { return vcltq_f32(v_, f.v_); }
+    Mask4 operator>(Float4 f) const { return vcgtq_f32(v_, f.v_); }
+    Mask4 operator<=(Float4 f) const { return vcleq_f32(v_, f.v_); }
+    Mask4 operator==(Float4 f) const { return vceqq_f32(v_, f.v_); }
+    friend Float4 sqrt(Float4 f) { return vsqrtq_f32(f.v_); }
+    friend Float4 abs(Float4 f) { return vabsq_f32(f.v_); }
+    // For each lane: "mask" true selects "a", false selects "b".
+    friend Float4 select(Mask4 mask, Float4 a, Float4 b)
+        { return vbslq_f32(mask.m_, a.v_, b.v_); }
+    friend Float4 floor(Float4 f) { return vrndmq_f32(f.v_); }
+    float32x4_t v_;
+#else
+    Float4(float f) : v_{f, f, f, f} {}
+    Float4(float a, float b, float c, float d) : v_{a, b, c, d} {}
+    static Float4 load(const float* p)
+        { return Float4(p[0], p[1], p[2], p[3]); }
+    void store(float* p) const { for (int i = 0; i < 4; i++) p[i] = v_[i]; }
+    Float4 operator+(Float4 f) const { return map(f, std::plus<float>()); }
+    Float4 operator-(Float4 f) const { return map(f, std::minus<float>()); }
+    Float4 operator*(Float4 f) const
+        { return map(f, std::multiplies<float>()); }
+    Float4 operator/(Float4 f) const { return map(f, std::divides<float>()); }
+    Mask4 operator<(Float4 f) const { return compare(f, std::less<float>()); }
+    Mask4 operator>(Float4 f) const
+        { return compare(f, std::greater<float>()); }
+    Mask4 operator<=(Float4 f) const
+        { return compare(f, std::less_equal<float>()); }
+    Mask4 operator==(Float4 f) const
+        { return compare(f, std::equal_to<float>()); }
+    friend Float4 sqrt(Float4 f)
+        { return f.map(f, [](float a, float){ return std::sqrt(a); }); }
+    friend Float4 abs(Float4 f)
+        { return f.map(f, [](float a, float){ return std::abs(a); }); }
+    friend Float4 floor(Float4 f)
+        { return f.map(f, [](float a, float){ return std::floor(a); }); }
+    // For each lane: "mask" true selects "a", false selects "b".
+    friend Float4 select(Mask4 mask, Float4 a, Float4 b)
+    {
+        return Float4(mask.lane(0) ? a.v_[0] : b.v_[0],
+                      mask.lane(1) ? a.v_[1] : b.v_[1],
+                      mask.lane(2) ? a.v_[2] : b.v_[2],
+                      mask.lane(3) ? a.v_[3] : b.v_[3]);
+    }
+    template <typename F> Float4 map(Float4 f, F op) const
+        { return Float4(op(v_[0], f.v_[0]), op(v_[1], f.v_[1]),
+                        op(v_[2], f.v_[2]), op(v_[3], f.v_[3])); }
+    template <typename F> Mask4 compare(Float4 f, F op) const
+        { return Mask4(op(v_[0], f.v_[0]), op(v_[1], f.v_[1]),
+                       op(v_[2], f.v_[2]), op(v_[3], f.v_[3])); }
+    float v_[4];
+#endif
+    Float4 operator-() const { return Float4(0) - *this; }
+    // Read one of the four floats.
+    float lane(int i) const
+    {
+        float p[4];
+        store(p);
+        return p[i];
+    }
+    // Like std::min() and std::max(), which differ from native instructions
+    // for NaN, or for signed zeros, so that results match scalar code.
+    friend Float4 min(Float4 a, Float4 b) { return select(b < a, b, a); }
+    friend Float4 max(Float4 a, Float4 b) { return select(a < b, b, a); }
+    // Like clip() in Utilities.h, for bounds already known to be ordered.
+    friend Float4 clip(Float4 x, Float4 min, Float4 max)
+    {
+        x = select(x < min, min, x);
+        return select(x > max, max, x);
+    }
+    // Apply a scalar function (e.g. std::pow) to each of the four floats.
+    template <typename F> Float4 apply(F function) const
+    {
+        float p[4];
+        store(p);
+        return Float4(function(p[0]), function(p[1]),
+                      function(p[2]), function(p[3]));
+    }
+};
+
+// Packet versions of clip01(), remapInterval() and remapIntervalClip().
+inline Float4 clip01(Float4 x) { return clip(x, 0, 1); }
+inline Float4 remapInterval(Float4 x,
+                            float in0, float in1,
+                            float out0, float out1)
+{
+    // Remap if input range is nonzero, otherwise blend them evenly.
+    float input_range = in1 - in0;
+    Float4 blend = ((input_range > 0) ? ((x - in0) / input_range) : 0.5);
+    return Float4(out0) * (Float4(1) - blend) + Float4(out1) * blend;
+}
+inline Float4 remapIntervalClip(Float4 x,
+                                float in0, float in1,
+                                float out0, float out1)
+{
+    return clip(remapInterval(x, in0, in1, out0, out1),
+                std::min(out0, out1),
+                std::max(out0, out1));
+}
+
+// Packet of four Vec2s.
+class Vec2x4
+{
+public:
+    Vec2x4() {}
+    Vec2x4(Float4 x, Float4 y) : x_(x), y_(y) {}
+    Vec2x4(Vec2 v) : x_(v.x()), y_(v.y()) {}
+    // Load "n" (up to 4) Vec2s from an array. Unused lanes are set to zero.
+    static Vec2x4 load(const Vec2* v, int n = 4)
+    {
+        float x[4] = {0, 0, 0, 0};
+        float y[4] = {0, 0, 0, 0};
+        for (int i = 0; i < std::min(n, 4); i++)
+        {
+            x[i] = v[i].x();
+            y[i] = v[i].y();
+        }
+        return Vec2x4(Float4::load(x), Float4::load(y));
+    }
+    Float4 x() const { return x_; }
+    Float4 y() const { return y_; }
+    Float4 dot(const Vec2x4& v) const {return x() * v.x() + y() * v.y(); }
+    Float4 length() const { return sqrt(x() * x() + y() * y()); }
+    Vec2x4 operator+(Vec2x4 v) const { return { x() + v.x(), y() + v.y() }; }
+    Vec2x4 operator-(Vec2x4 v) const { return { x() - v.x(), y() - v.y() }; }
+    Vec2x4 operator*(Float4 s) const { return { x() * s, y() * s }; }
+    Vec2x4 operator/(Float4 s) const { return { x() / s, y() / s }; }
+    // Rotation about origin by angle in radians (or by precomputed sin/cos).
+    Vec2x4 rotate(float a) const { return rotate(std::sin(a), std::cos(a)); }
+    Vec2x4 rotate(float sin, float cos) const
+        { return Vec2x4(x() * cos + y() * sin, y() * cos - x() * sin); }
+private:
+    Float4 x_;
+    Float4 y_;
+};
+
+// Packet of four Colors.
+class Color4
+{
+public:
+    Color4() {}
+    Color4(Float4 r, Float4 g, Float4 b) : r_(r), g_(g), b_(b) {}
+    Color4(Color c) : r_(c.r()), g_(c.g()), b_(c.b()) {}
+    // Load "n" (up to 4) Colors from an array. Unused lanes are set to zero.
+    static Color4 load(const Color* c, int n = 4)
+    {
+        float r[4] = {0, 0, 0, 0};
+        float g[4] = {0, 0, 0, 0};
+        float b[4] = {0, 0, 0, 0};
+        for (int i = 0; i < std::min(n, 4); i++)
+        {
+            r[i] = c[i].r();
+            g[i] = c[i].g();
+            b[i] = c[i].b();
+        }
+        return Color4(Float4::load(r), Float4::load(g), Float4::load(b));
+    }
+    // Store first "n" (up to 4) Colors from this packet into an array.
+    void store(Color* c, int n = 4) const
+    {
+        float r[4];
+        float g[4];
+        float b[4];
+        r_.store(r);
+        g_.store(g);
+        b_.store(b);
+        for (int i = 0; i < std::min(n, 4); i++) c[i] = Color(r[i], g[i], b[i]);
+    }
+    Float4 r() const { return r_; }
+    Float4 g() const { return g_; }
+    Float4 b() const { return b_; }
+    Color4 operator+(Color4 c) const
+        { return Color4(r() + c.r(), g() + c.g(), b() + c.b()); }
+    Color4 operator-(Color4 c) const
+        { return Color4(r() - c.r(), g() - c.g(), b() - c.b()); }
+    Color4 operator*(Color4 c) const
+        { return Color4(r() * c.r(), g() * c.g(), b() * c.b()); }
+    Color4 operator*(Float4 s) const
+        { return Color4(r() * s, g() * s, b() * s); }
+    Color4 operator/(Float4 s) const { return *this * (Float4(1) / s); }
+    // Note: computed in float, whereas Color::luminance() uses double.
+    Float4 luminance() const
+        { return r() * 0.2126f + g() * 0.7152f + b() * 0.0722f; }
+    Float4 length() const { return sqrt(r() * r() + g() * g() + b() * b()); }
+    // For each lane: "mask" true selects "a", false selects "b".
+    friend Color4 select(Mask4 mask, Color4 a, Color4 b)
+    {
+        return Color4(select(mask, a.r(), b.r()),
+                      select(mask, a.g(), b.g()),
+                      select(mask, a.b(), b.b()));
+    }
+    // Same as Color::clipToUnitRGB() for each of the four Colors.
+    Color4 clipToUnitRGB() const
+    {
+        Float4 zero(0);
+        Float4 one(1);
+        Color4 result(max(zero, r()), max(zero, g()), max(zero, b()));
+        result = select(result.r() > one, result / result.r(), result);
+        result = select(result.g() > one, result / result.g(), result);
+        result = select(result.b() > one, result / result.b(), result);
+        return select(zero < length(), result, *this);
+    }
+    // Same as Color::gamma() for each of the four Colors. (Note that pow() is
+    // applied one float at a time, since there is no portable packet version.)
+    Color4 gamma(float exponent) const
+    {
+        auto p = [&](float x){ return float(pow(x, exponent)); };
+        Float4 zero(0);
+        return Color4(max(r(), zero).apply(p),
+                      max(g(), zero).apply(p),
+                      max(b(), zero).apply(p));
+    }
+private:
+    Float4 r_;
+    Float4 g_;
+    Float4 b_;
+};
@@ -0,0 +1,351 @@
+//
+//  SpotLayout.cpp
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/16/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+
+#include "SpotLayout.h"
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr float SpotLayout::tile_size;
+BudgetedLru<SpotLayout::Key, SpotLayout, std::map>
+SpotLayout::cache_(64 * 1024 * 1024,
+                   [](const SpotLayout& layout) { return layout.bytes(); });
+std::mutex SpotLayout::mutex_;
+std::atomic<int64_t> SpotLayout::cache_hits_(0);
+std::atomic<int64_t> SpotLayout::cache_misses_(0);
+std::string SpotLayout::disk_cache_directory_;
+std::atomic<int64_t> SpotLayout::disk_cache_reads_(0);
+std::atomic<int64_t> SpotLayout::disk_cache_writes_(0);
+std::atomic<int64_t> SpotLayout::disk_cache_rejects_(0);
+
+// Random Disks, relaxed, indexed by the grid. The random sequence is seeded
+// from the parameters, so equal parameters always make equal layouts.
+SpotLayout::SpotLayout(float spot_density,
+                       float min_radius,
+                       float max_radius,
+                       float soft_edge_width)
+  : grid_(Vec2(-tile_size / 2, -tile_size / 2),
+          Vec2(tile_size / 2, tile_size / 2),
+          grid_side_count)
+{
+    Timer timer("SpotLayout constructor");  // TODO temp
+    size_t seed = (hash_float(spot_density) ^
+                   hash_float(min_radius) ^
+                   hash_float(max_radius) ^
+                   hash_float(soft_edge_width));
+    insertRandomSpots(spot_density, min_radius, max_radius, seed);
+    grid_.reduceDiskOverlap(relaxation_retries, spots_);
+    grid_.flatten();
+    buildCandidates();
+}
+
+// Layout from given spots, such as those read from an on-disk layout file.
+SpotLayout::SpotLayout(const std::vector<Disk>& spots)
+  : spots_(spots),
+    grid_(Vec2(-tile_size / 2, -tile_size / 2),
+          Vec2(tile_size / 2, tile_size / 2),
+          grid_side_count)
+{
+    for (Disk& spot : spots_) grid_.insertDiskWrap(spot);
+    grid_.flatten();
+    buildCandidates();
+}
+
+// For each cell, in reverse order, its spots with center tiled to be nearest
+// the cell's center. For a point in the cell within a spot's radius of that
+// image, that is also the nearest image, given that (radius + half the cell
+// diagonal) is less than half the tile size. (Were it nearer another image,
+// the two would be within 2 * (radius + half diagonal) of each other, but
+// tiled images are a tile size apart.)
+void SpotLayout::buildCandidates()
+{
+    float cell_size = tile_size / grid_side_count;
+    float half_diagonal = cell_size * std::sqrt(2.0f) / 2;
+    float max_radius = 0;
+    for (auto& spot : spots_) max_radius = std::max(max_radius, spot.radius);
+    candidates_exact_ = (max_radius + half_diagonal) < (tile_size / 2);
+    candidate_starts_.clear();
+    candidates_.clear();
+    std::vector<const Disk*> cell_disks;
+    for (int i = 0; i < grid_side_count; i++)
+    {
+        for (int j = 0; j < grid_side_count; j++)
+        {
+            Vec2 cell_center((i + 0.5f) * cell_size - tile_size / 2,
+                             (j + 0.5f) * cell_size - tile_size / 2);
+            cell_disks.clear();
+            grid_.forDisksNearPoint(cell_center, [&](const Disk& disk)
+                                    { cell_disks.push_back(&disk); });
+            candidate_starts_.push_back(int(candidates_.size()));
+            for (auto d = cell_disks.rbegin(); d != cell_disks.rend(); d++)
+            {
+                Vec2 center = grid_.nearestByTiling(cell_center,
+                                                    (*d)->position);
+                int index = int(*d - spots_.data());
+                candidates_.push_back({center, (*d)->radius, index});
+            }
+        }
+    }
+    candidate_starts_.push_back(int(candidates_.size()));
+}
+
+// Insert random Disks until density threshold is met. Disk center positions
+// are uniformly distributed across center tile. Radii are chosen from the
+// interval [min_radius, max_radius] with a preference for smaller values.
+// Then give each a random rotation on [0, 2π].
+void SpotLayout::insertRandomSpots(float spot_density,
+                                   float min_radius,
+                                   float max_radius,
+                                   size_t seed)
+{
+    float total_area = 0;
+    float half = tile_size / 2;
+    RandomSequence rs(seed);
+    // Add random Disks until density threshold is met.
+    while (total_area < (spot_density * sq(tile_size)))
+    {
+        // Select radius, preferring the low end of the range.
+        float k = rs.frandom01();
+        float i = (std::pow(k, 10) + (k / 2)) / 1.5;
+        float radius = interpolate(i, min_radius, max_radius);
+        Vec2 center(rs.frandom2(-half, half), rs.frandom2(-half, half));
+        spots_.push_back(Disk(radius, center));
+        total_area += spots_.back().area();
+    }
+    // Insert each new random Disk into the DiskOccupancyGrid.
+    // (NB: very important this happens AFTER all Disks added to std::vector
+    // spots (above). Otherwise pointers will be invalidated by reallocation.)
+    for (Disk& spot : spots_) grid_.insertDiskWrap(spot);
+    // Rotations use a new random sequence from the same seed.
+    RandomSequence rotations(seed);
+    for (auto& spot : spots_) spot.angle = rotations.frandom01() * pi * 2;
+}
+
+// Look up layout, marking it most recently used, or make it (outside the
+// lock) and insert it, dropping others as needed to stay within budget.
+std::shared_ptr<const SpotLayout> SpotLayout::get(float spot_density,
+                                                  float min_radius,
+                                                  float max_radius,
+                                                  float soft_edge_width)
+{
+    Key key(spot_density, min_radius, max_radius, soft_edge_width);
+    bool made = false;
+    auto layout = cache_.get(nullptr, key, [&]() { return make(key); }, &made);
+    (made ? cache_misses_ : cache_hits_)++;
+    return layout;
+}
+
+// Make layout for "key". If on-disk layouts are enabled, read it from its file
+// if that is valid, otherwise make it by relaxation then write the file.
+std::shared_ptr<const SpotLayout> SpotLayout::make(const Key& key)
+{
+    float spot_density, min_radius, max_radius, soft_edge_width;
+    std::tie(spot_density, min_radius, max_radius, soft_edge_width) = key;
+    std::string directory = getDiskCacheDirectory();
+    std::string pathname = directory.empty() ? "" : diskCachePathname(key);
+    std::vector<Disk> spots;
+    if (!pathname.empty() && readFile(pathname, key, spots))
+    {
+        disk_cache_reads_++;
+        return std::make_shared<const SpotLayout>(spots);
+    }
+    auto layout = std::make_shared<const SpotLayout>(spot_density,
+                                                     min_radius,
+                                                     max_radius,
+                                                     soft_edge_width);
+    if (!pathname.empty()) layout->writeFile(pathname, key);
+    return layout;
+}
+
+// Header of on-disk layout file for "key", with zero count and checksum.
+SpotLayout::FileHeader SpotLayout::makeFileHeader(const Key& key)
+{
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TSSPOTS", sizeof(header.magic));
+    header.layout_version = layout_version;
+    header.parameters[0] = std::get<0>(key);
+    header.parameters[1] = std::get<1>(key);
+    header.parameters[2] = std::get<2>(key);
+    header.parameters[3] = std::get<3>(key);
+    return header;
+}
+
+// File named by a hash of the parameters and layout version.
+std::string SpotLayout::diskCachePathname(const Key& key)
+{
+    FileHeader header = makeFileHeader(key);
+    uint64_t hash = hashBytes(&header.layout_version,
+                              sizeof(header.layout_version),
+                              hashBytes(header.parameters,
+                                        sizeof(header.parameters)));
+    std::string directory = getDiskCacheDirectory();
+    if (!directory.empty() && directory.back() != '/') directory += "/";
+    std::stringstream ss;
+    ss << directory << "spot_layout_";
+    ss << std::hex << std::setfill('0') << std::setw(16) << hash << ".bin";
+    return ss.str();
+}
+
+std::string SpotLayout::diskCachePathname(float spot_density,
+                                          float min_radius,
+                                          float max_radius,
+                                          float soft_edge_width)
+{
+    return diskCachePathname(Key(spot_density,
+                                 min_radius,
+                                 max_radius,
+                                 soft_edge_width));
+}
+
+// Memory map the file, check that its header matches "key", its size matches
+// its spot count, and its checksum matches its records. If so copy the records
+// into "spots" and return true. A missing file is not counted as a reject.
+bool SpotLayout::readFile(const std::string& pathname,
+                          const Key& key,
+                          std::vector<Disk>& spots)
+{
+    int fd = open(pathname.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = false;
+    struct stat file_stat;
+    if ((fstat(fd, &file_stat) == 0) &&
+        (size_t(file_stat.st_size) >= sizeof(FileHeader)))
+    {
+        size_t size = file_stat.st_size;
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            FileHeader header;
+            std::memcpy(&header, map, sizeof(header));
+            FileHeader expected = makeFileHeader(key);
+            size_t count = header.spot_count;
+            size_t records_size = count * sizeof(DiskRecord);
+            const DiskRecord* records = reinterpret_cast<const DiskRecord*>
+                (static_cast<const char*>(map) + sizeof(FileHeader));
+            if ((std::memcmp(header.magic,
+                             expected.magic,
+                             sizeof(header.magic)) == 0) &&
+                (header.layout_version == expected.layout_version) &&
+                (std::memcmp(header.parameters,
+                             expected.parameters,
+                             sizeof(header.parameters)) == 0) &&
+                (size == sizeof(FileHeader) + records_size) &&
+                (header.checksum == hashBytes(records, records_size)))
+            {
+                spots.clear();
+                spots.reserve(count);
+                for (size_t i = 0; i < count; i++)
+                {
+                    const DiskRecord& r = records[i];
+                    spots.push_back(Disk(r.radius, Vec2(r.x, r.y)));
+                    spots.back().angle = r.angle;
+                }
+                ok = true;
+            }
+            munmap(map, size);
+        }
+    }
+    close(fd);
+    if (!ok) disk_cache_rejects_++;
+    return ok;
+}
+
+// Write header and records to a temporary file unique to this process and
+// thread, then rename it, so readers never see a partially written file.
+void SpotLayout::writeFile(const std::string& pathname, const Key& key) const
+{
+    std::vector<DiskRecord> records;
+    for (auto& spot : spots_)
+        records.push_back({spot.radius,
+                           spot.position.x(),
+                           spot.position.y(),
+                           spot.angle});
+    size_t records_size = records.size() * sizeof(DiskRecord);
+    FileHeader header = makeFileHeader(key);
+    header.spot_count = uint32_t(records.size());
+    header.checksum = hashBytes(records.data(), records_size);
+    std::stringstream temp;
+    temp << pathname << ".tmp" << getpid() << "_";
+    temp << std::hash<std::thread::id>()(std::this_thread::get_id());
+    {
+        std::ofstream file(temp.str(), std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(records.data()),
+                   records_size);
+        if (!file)
+        {
+            file.close();
+            std::remove(temp.str().c_str());
+            return;
+        }
+    }
+    if (std::rename(temp.str().c_str(), pathname.c_str()) == 0)
+        disk_cache_writes_++;
+    else
+        std::remove(temp.str().c_str());
+}
+
+// 64 bit FNV-1a hash of "size" bytes, continuing from "hash".
+uint64_t SpotLayout::hashBytes(const void* bytes, size_t size, uint64_t hash)
+{
+    const unsigned char* b = static_cast<const unsigned char*>(bytes);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= b[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+// Approximate memory used by this layout, in bytes.
+size_t SpotLayout::bytes() const
+{
+    return (sizeof(SpotLayout) +
+            spots_.capacity() * sizeof(Disk) +
+            candidate_starts_.capacity() * sizeof(int) +
+            candidates_.capacity() * sizeof(Candidate) +
+            grid_.approximateBytes());
+}
+
+size_t SpotLayout::getMemoryBudget()
+{
+    return cache_.getMemoryBudget();
+}
+
+void SpotLayout::setMemoryBudget(size_t bytes)
+{
+    cache_.setMemoryBudget(bytes);
+}
+
+size_t SpotLayout::getMemoryUsed()
+{
+    return cache_.getMemoryUsed();
+}
+
+int SpotLayout::cacheSize()
+{
+    return cache_.size();
+}
+
+std::string SpotLayout::getDiskCacheDirectory()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return disk_cache_directory_;
+}
+
+void SpotLayout::setDiskCacheDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    disk_cache_directory_ = directory;
+}
@@ -0,0 +1,176 @@
+//
+//  SpotLayout.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/16/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  The arrangement of spots used by LotsOfSpots, ColoredSpots and
+//  LotsOfButtons: random Disks on one 10x10 tile, relaxed to reduce overlap,
+//  in a (flattened) DiskOccupancyGrid, each with a random rotation angle. A
+//  layout depends only on spot density, radius range (including margin) and
+//  soft edge width, which seed its random sequence. A layout is immutable once
+//  made, so may be shared between any number of textures and threads.
+//
+//  SpotLayout::get() returns the layout for given parameters from a process
+//  wide cache, making it on a miss. Evolved populations contain many spot
+//  textures which differ only in their input textures, so these share one
+//  layout rather than each repeating the (costly) relaxation. The cache holds
+//  layouts up to a memory budget, beyond which least recently used ones are
+//  dropped. Textures using a dropped layout keep it until they are deleted.
+//
+//  Optionally, layouts may also be stored on disk, so later runs need not
+//  remake them. See setDiskCacheDirectory(). Each layout is one small binary
+//  file, named by a hash of its parameters and "layout_version", which is read
+//  by memory mapping. A file which does not match (parameters, version, size,
+//  or checksum) is ignored, then replaced by a newly made layout.
+
+#pragma once
+#include "Disk.h"
+#include "BudgetedLru.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+class SpotLayout
+{
+public:
+    // Make a new layout. (Normally use get() instead.)
+    SpotLayout(float spot_density,
+               float min_radius,
+               float max_radius,
+               float soft_edge_width);
+    // Make a layout from given (already relaxed) spots.
+    SpotLayout(const std::vector<Disk>& spots);
+    SpotLayout(const SpotLayout&) = delete;
+    SpotLayout& operator=(const SpotLayout&) = delete;
+    // Get a shared layout for these parameters, from cache or newly made.
+    // Thread safe. On a miss the layout is made outside the lock.
+    static std::shared_ptr<const SpotLayout> get(float spot_density,
+                                                 float min_radius,
+                                                 float max_radius,
+                                                 float soft_edge_width);
+    // Spots and the (flattened) occupancy grid which indexes them.
+    const std::vector<Disk>& spots() const { return spots_; }
+    const DiskOccupancyGrid& grid() const { return grid_; }
+    // For nearest spot queries: each grid cell's candidates are the spots
+    // which overlap it, with "center" already moved (by tiling) to the image
+    // of the spot nearest the cell. They are in the reverse of the flat grid's
+    // order. candidatesNearPoint() returns the [begin, end) range of them for
+    // the cell containing "point" (which should be on the center tile).
+    class Candidate
+    {
+    public:
+        Vec2 center;
+        float radius;
+        int index;
+    };
+    std::pair<const Candidate*, const Candidate*>
+    candidatesNearPoint(Vec2 point) const
+    {
+        if (!grid_.gridOverlapsDisk(Disk(0, point))) return {nullptr, nullptr};
+        int cell = (grid_.xToI(point.x()) * grid_side_count) +
+                   grid_.xToI(point.y());
+        const Candidate* first = candidates_.data();
+        return {first + candidate_starts_[cell],
+                first + candidate_starts_[cell + 1]};
+    }
+    // True when candidate centers are exact for every point in their cell:
+    // no spot is so large (near half the tile size) that some point in the
+    // cell is nearer another of its tiled images. Otherwise use the grid.
+    bool candidatesExact() const { return candidates_exact_; }
+    // Approximate memory used by this layout, in bytes.
+    size_t bytes() const;
+    // Get/set memory budget (in bytes) for cached layouts, and get the amount
+    // now used. Setting a smaller budget drops layouts as needed.
+    static size_t getMemoryBudget();
+    static void setMemoryBudget(size_t bytes);
+    static size_t getMemoryUsed();
+    // Number of layouts now cached, and counts of get() calls since program
+    // start which found their layout in the cache, or had to make it.
+    static int cacheSize();
+    static int64_t cacheHits() { return cache_hits_; }
+    static int64_t cacheMisses() { return cache_misses_; }
+    // Get/set directory for on-disk layouts. Empty (the default) disables it.
+    static std::string getDiskCacheDirectory();
+    static void setDiskCacheDirectory(const std::string& directory);
+    // Counts of layouts read from disk, written to disk, and disk files
+    // rejected (because they did not match) since program start.
+    static int64_t diskCacheReads() { return disk_cache_reads_; }
+    static int64_t diskCacheWrites() { return disk_cache_writes_; }
+    static int64_t diskCacheRejects() { return disk_cache_rejects_; }
+    // Pathname of on-disk layout file for given parameters.
+    static std::string diskCachePathname(float spot_density,
+                                         float min_radius,
+                                         float max_radius,
+                                         float soft_edge_width);
+    // Increment this when a code change alters layouts made from given
+    // parameters, so old on-disk layouts are no longer used.
+    static const uint32_t layout_version = 1;
+    static constexpr float tile_size = 10;
+    static const int grid_side_count = 60;
+    static const int relaxation_retries = 200;
+private:
+    // Insert random Disks until density threshold is met. Disk center
+    // positions are uniformly distributed across center tile. Radii are chosen
+    // from the interval [min_radius, max_radius] with a preference for smaller
+    // values. Then give each a random rotation on [0, 2π].
+    void insertRandomSpots(float spot_density,
+                           float min_radius,
+                           float max_radius,
+                           size_t seed);
+    // Fill "candidates_" from the flat grid.
+    void buildCandidates();
+    std::vector<Disk> spots_;
+    DiskOccupancyGrid grid_;
+    std::vector<int> candidate_starts_;
+    std::vector<Candidate> candidates_;
+    bool candidates_exact_ = false;
+    // Layout parameters: density, min and max radius, soft edge width.
+    typedef std::tuple<float, float, float, float> Key;
+    // Make layout for "key", from disk if possible, else by relaxation.
+    static std::shared_ptr<const SpotLayout> make(const Key& key);
+    // On-disk layout file: this header then "spot_count" DiskRecords.
+    class FileHeader
+    {
+    public:
+        char magic[8];
+        uint32_t layout_version;
+        uint32_t spot_count;
+        float parameters[4];
+        uint64_t checksum;
+    };
+    class DiskRecord
+    {
+    public:
+        float radius;
+        float x;
+        float y;
+        float angle;
+    };
+    static FileHeader makeFileHeader(const Key& key);
+    static std::string diskCachePathname(const Key& key);
+    // Read spots from layout file, returning false if missing or mismatched.
+    static bool readFile(const std::string& pathname,
+                         const Key& key,
+                         std::vector<Disk>& spots);
+    // Write this layout's file (to a temporary, renamed when complete).
+    void writeFile(const std::string& pathname, const Key& key) const;
+    // 64 bit FNV-1a hash of "size" bytes, continuing from "hash".
+    static uint64_t hashBytes(const void* bytes,
+                              size_t size,
+                              uint64_t hash = 14695981039346656037ull);
+    // Cache of layouts, keyed by parameters (owner is always nullptr).
+    static BudgetedLru<Key, SpotLayout, std::map> cache_;
+    // Guards "disk_cache_directory_".
+    static std::mutex mutex_;
+    static std::atomic<int64_t> cache_hits_;
+    static std::atomic<int64_t> cache_misses_;
+    static std::string disk_cache_directory_;
+    static std::atomic<int64_t> disk_cache_reads_;
+    static std::atomic<int64_t> disk_cache_writes_;
+    static std::atomic<int64_t> disk_cache_rejects_;
+};
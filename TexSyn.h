@@ -9,4 +9,7 @@
 
 #pragma once
 #include "Operators.h"
+#include "Parser.h"
+#include "ThreadPool.h"
 #include "UnitTests.h"
+#include "Benchmarks.h"
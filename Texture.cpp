@@ -7,7 +7,10 @@
 //
 
 #include "Texture.h"
-#include <thread>
+#include "ThreadPool.h"
+#include "Simd.h"
+#include "Program.h"
+#include "SampleCache.h"
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdocumentation"
@@ -15,6 +18,20 @@
 #include <opencv2/highgui/highgui.hpp>
 #pragma clang diagnostic pop
 
+namespace
+{
+    // Samples and pixels rasterized in the current rendering, on all threads.
+    std::atomic<int64_t> render_sample_count(0);
+    std::atomic<int64_t> render_pixel_count(0);
+    // Largest difference in any RGB component between two colors.
+    float maxComponentDifference(Color a, Color b)
+    {
+        return std::max({std::abs(a.r() - b.r()),
+                         std::abs(a.g() - b.g()),
+                         std::abs(a.b() - b.b())});
+    }
+}
+
 // Utility for getColor(), special-cased for when alpha is 0 or 1.
 Color Texture::interpolatePointOnTextures(float alpha,
                                           Vec2 position0,
@@ -34,6 +51,109 @@ Color Texture::interpolatePointOnTextures(float alpha,
                          t1.getColor(position1))));
 }
 
+// Emit Program instructions for this texture. Operators without their own
+// Program opcodes use this default, which calls their getColors().
+int Texture::compile(Program& program, int position) const
+{
+    return program.emit(Program::Opcode::Fallback, {position}, {}, this);
+}
+
+// Batch version for getColors(): interpolate between t0 and t1 at "count"
+// positions with per-position alphas. As in interpolatePointOnTextures(),
+// t0 is sampled only where alpha is not 1, and t1 only where alpha is not 0.
+// Positions needing each texture are gathered, then sampled in one batch.
+void Texture::interpolatePointsOnTextures(int count,
+                                          const float* alphas,
+                                          const Vec2* positions,
+                                          const Texture& t0,
+                                          const Texture& t1,
+                                          Color* colors) const
+{
+    assert(count <= max_batch_size);
+    Vec2 gathered[max_batch_size];
+    Color colors0[max_batch_size];
+    Color colors1[max_batch_size];
+    // Sample t0 at positions where alpha is not 1.
+    int n0 = 0;
+    for (int i = 0; i < count; i++)
+        if (alphas[i] != 1) gathered[n0++] = positions[i];
+    if (n0 > 0) t0.getColors(n0, gathered, colors0);
+    // Sample t1 at positions where alpha is not 0.
+    int n1 = 0;
+    for (int i = 0; i < count; i++)
+        if (alphas[i] != 0) gathered[n1++] = positions[i];
+    if (n1 > 0) t1.getColors(n1, gathered, colors1);
+    // Scatter results, interpolating where both textures were sampled.
+    n0 = 0;
+    n1 = 0;
+    for (int i = 0; i < count; i++)
+    {
+        float alpha = alphas[i];
+        colors[i] = ((alpha == 0) ?
+                     colors0[n0++] :
+                     ((alpha == 1) ?
+                      colors1[n1++] :
+                      interpolate(alpha, colors0[n0++], colors1[n1++])));
+    }
+}
+
+// Batch utility for Max and Min: set "colors" to whichever of "colors0" or
+// "colors1" has greater (or if "greater" is false, lesser) luminance. Uses
+// SIMD packets. Color4::luminance() is computed in float, Color::luminance()
+// in double, so where the two are too close to call, the comparison is
+// redone in scalar code to get exactly the same result as Max::getColor().
+void Texture::selectByLuminance(int count,
+                                bool greater,
+                                const Color* colors0,
+                                const Color* colors1,
+                                Color* colors)
+{
+    for (int i = 0; i < count; i += 4)
+    {
+        int n = std::min(4, count - i);
+        Color4 c0 = Color4::load(colors0 + i, n);
+        Color4 c1 = Color4::load(colors1 + i, n);
+        Float4 l0 = c0.luminance();
+        Float4 l1 = c1.luminance();
+        Color result[4];
+        select(greater ? l0 > l1 : l0 < l1, c0, c1).store(result, n);
+        // Tolerance is far larger than the rounding error of float luminance.
+        Float4 sum = (abs(c0.r()) + abs(c0.g()) + abs(c0.b()) +
+                      abs(c1.r()) + abs(c1.g()) + abs(c1.b()));
+        Mask4 close = !(abs(l0 - l1) > sum * 0.00001f);
+        if (close.any())
+        {
+            for (int k = 0; k < n; k++)
+            {
+                if (close.lane(k))
+                {
+                    Color a = colors0[i + k];
+                    Color b = colors1[i + k];
+                    float la = a.luminance();
+                    float lb = b.luminance();
+                    result[k] = (greater ? la > lb : la < lb) ? a : b;
+                }
+            }
+        }
+        // (Copy at end since "colors" may be the same array as an input.)
+        std::copy(result, result + n, colors + i);
+    }
+}
+
+// Batch version of getColorClipped(), for any "count", split into batches.
+void Texture::getColorsClipped(int count,
+                               const Vec2* positions,
+                               Color* colors) const
+{
+    for (int first = 0; first < count; first += max_batch_size)
+    {
+        int n = std::min(count - first, int(max_batch_size));
+        getColors(n, positions + first, colors + first);
+        for (int i = first; i < first + n; i++)
+            colors[i] = colors[i].clipToUnitRGB();
+    }
+}
+
 // Rasterize this texture into size² OpenCV image, display in pop-up window.
 void Texture::displayInWindow(int size, bool wait) const
 {
@@ -60,7 +180,7 @@ void Texture::windowPlacementTool(cv::Mat& mat)
 }
 
 // Rasterize this texture into a size² OpenCV image. Arg "disk" true means
-// draw a round image, otherwise a square. Run parallel threads for speed.
+// draw a round image, otherwise a square. Uses ThreadPool tasks for speed.
 void Texture::rasterizeToImageCache(int size, bool disk) const
 {
     Timer t("rasterizeToImageCache");
@@ -72,74 +192,419 @@ void Texture::rasterizeToImageCache(int size, bool disk) const
         raster_->create(size, size, CV_32FC3);
         // TODO Code assumes disk center at window center, so size must be odd.
         assert(((!disk) || (size % 2 == 1)) && "For disk, size must be odd.");
-        // Synchronizes access to opencv_image by multiple row threads.
-        std::mutex ocv_image_mutex;
-        // Collection of all row threads.
-        std::vector<std::thread> all_threads;
-        // Loop all image rows, bottom to top. For each, launch a thread running
-        // rasterizeRowOfDisk() to compute pixels, write to image via mutex.
-        for (int j = -(size / 2); j <= (size / 2); j++)
+        // Pixels outside the disk are set to middle gray.
+        raster_->setTo(cv::Scalar(0.5, 0.5, 0.5));
+        // Split image into square tiles, listed in Hilbert curve order. Each
+        // worker thread on the shared ThreadPool repeatedly takes the next
+        // tile from the list and calls rasterizeTile() to compute its pixels,
+        // writing them directly into the image. Tiles are disjoint, so no
+        // locking is required. Nearby tiles are rendered at nearby times, so
+        // the data they read tends to stay in cache. Returns when all done.
+        int tile_size = getRenderTileSize();
+        std::vector<std::pair<int, int>> tiles;
+        tilesInCurveOrder(size, tile_size, disk, tiles);
+        std::atomic<int> next_tile(0);
+        // Samples cached during an earlier rendering are not reused.
+        SampleCache::beginRenderPass();
+        render_sample_count = 0;
+        render_pixel_count = 0;
+        std::unique_ptr<Program> program;
+        if (getRenderCompiled()) program = std::make_unique<Program>(*this);
+        ThreadPool& pool = ThreadPool::getInstance();
+        pool.parallelFor(pool.getWorkerCount(), [&](int)
+        {
+            int k;
+            while ((k = next_tile++) < int(tiles.size()))
+                rasterizeTile(tiles[k].first, tiles[k].second, tile_size,
+                              size, disk, *raster_, program.get());
+        });
+        // Average samples per pixel, see getRenderSamplesPerPixel().
+        render_samples_per_pixel_ = (float(render_sample_count) /
+                                     std::max(int64_t(1),
+                                              int64_t(render_pixel_count)));
+    }
+}
+
+// Progressive version of rasterizeToImageCache(): a sequence of stages, from
+// 1/16 of the pixels up to all pixels with anti-aliasing, each written into
+// the raster cache as a complete image. See comment in Texture.h.
+bool Texture::rasterizeProgressively(int size,
+                                     bool disk,
+                                     const StageFunction& stage_done,
+                                     const std::atomic<bool>* cancel) const
+{
+    Timer t("rasterizeProgressively");
+    assert(((!disk) || (size % 2 == 1)) && "For disk, size must be odd.");
+    raster_->create(size, size, CV_32FC3);
+    raster_->setTo(cv::Scalar(0.5, 0.5, 0.5));
+    SampleCache::beginRenderPass();
+    int tile_size = getRenderTileSize();
+    std::vector<std::pair<int, int>> tiles;
+    tilesInCurveOrder(size, tile_size, disk, tiles);
+    std::unique_ptr<Program> program;
+    if (getRenderCompiled()) program = std::make_unique<Program>(*this);
+    ThreadPool& pool = ThreadPool::getInstance();
+    int stage_count = (sqrt_of_aa_subsample_count > 1) ? 4 : 3;
+    for (int stage = 0; stage < stage_count; stage++)
+    {
+        if (cancel && *cancel)
+        {
+            // Empty the cache so a later rendering does not think it valid.
+            *raster_ = cv::Mat();
+            return false;
+        }
+        // Stages 0 to 2 at strides 4, 2 and 1, stage 3 is anti-aliased.
+        int stride = 4 >> stage;
+        std::atomic<int> next_tile(0);
+        pool.parallelFor(pool.getWorkerCount(), [&](int)
+        {
+            int k;
+            while ((k = next_tile++) < int(tiles.size()))
+            {
+                int column = tiles[k].first;
+                int row = tiles[k].second;
+                if (stage < 3)
+                    rasterizeTileAtStride(column, row, tile_size, size, disk,
+                                          stride, stage > 0, *raster_,
+                                          program.get());
+                else
+                    rasterizeTile(column, row, tile_size, size, disk,
+                                  *raster_, program.get());
+            }
+        });
+        if (stage_done) stage_done(stage, *raster_);
+    }
+    return true;
+}
+
+// For progressive rendering: rasterize the pixels of one tile whose column and
+// row are multiples of "stride" (skipping multiples of 2*stride if requested)
+// with one sample per pixel, and fill the stride² block below and to the right
+// of each with its color. Blocks never overlap, so tasks need no locking.
+void Texture::rasterizeTileAtStride(int column, int row, int tile_size,
+                                    int size, bool disk, int stride,
+                                    bool skip_coarser, cv::Mat& opencv_image,
+                                    const Program* program) const
+{
+    int half = size / 2;
+    // Same footprint as rasterizeRowSegment() without anti-aliasing, so each
+    // pixel's color is the same at every stage.
+    float pixel_width = 1.0f / half;
+    SampleFootprint::Scope scope(getRenderFootprint() ? pixel_width : 0);
+    bool was_rendering = rendering_;
+    rendering_ = true;
+    // Half width of the image in row j (as offsets from center).
+    auto xLimit = [&](int j)
+        { return disk ? int(std::sqrt(sq(half) - sq(j))) : half; };
+    int row_end = std::min(row + tile_size, size);
+    int column_end = std::min(column + tile_size, size);
+    int first_row = ((row + stride - 1) / stride) * stride;
+    int first_column = ((column + stride - 1) / stride) * stride;
+    // A batch of pixels to sample (as image column and row) and their
+    // positions, filled across rows of the tile, so no allocation is needed.
+    int count = 0;
+    int columns[max_batch_size];
+    int rows[max_batch_size];
+    Vec2 positions[max_batch_size];
+    // Sample the batch, filling each pixel's stride² block with its color.
+    auto sampleBatch = [&]()
+    {
+        Color colors[max_batch_size];
+        if (program)
+            program->run(count, positions, colors);
+        else
+            getColors(count, positions, colors);
+        for (int p = 0; p < count; p++)
+        {
+            Color color = colors[p].clipToUnitRGB();
+            color = color.gamma(1 / defaultGamma());
+            cv::Vec3f pixel(color.b(), color.g(), color.r());
+            int c = columns[p];
+            int r = rows[p];
+            for (int rr = r; rr < std::min(r + stride, size); rr++)
+            {
+                int limit = xLimit(half - rr);
+                cv::Vec3f* row_pixels = opencv_image.ptr<cv::Vec3f>(rr);
+                for (int cc = c; cc < std::min(c + stride, size); cc++)
+                    if (std::abs(cc - half) <= limit) row_pixels[cc] = pixel;
+            }
+        }
+        count = 0;
+    };
+    for (int r = first_row; r < row_end; r += stride)
+    {
+        int j = half - r;
+        int x_limit = xLimit(j);
+        for (int c = first_column; c < column_end; c += stride)
         {
-            // This requires some unpacking. It creates a thread which is pushed
-            // (using && move semantics, I think) onto the back of std::vector
-            // all_row_threads. Because the initial/toplevel thread function is
-            // member function of this instance, it is specified as two values,
-            // a function pointer AND an instance pointer. The other four values
-            // are args to rasterizeRowOfDisk(row, size, disk, image, mutex).
-            all_threads.push_back(std::thread(&Texture::rasterizeRowOfDisk, this,
-                                              j, size, disk,
-                                              std::ref(*raster_),
-                                              std::ref(ocv_image_mutex)));
+            bool coarser = ((c % (2 * stride) == 0) &&
+                            (r % (2 * stride) == 0));
+            int i = c - half;
+            if ((i >= -x_limit) && (i <= x_limit) &&
+                !(skip_coarser && coarser))
+            {
+                columns[count] = c;
+                rows[count] = r;
+                positions[count] = Vec2(i, j) / half;
+                if (++count == max_batch_size) sampleBatch();
+            }
         }
-        // Wait for all row threads to finish.
-        for (auto& t : all_threads) t.join();
+    }
+    if (count > 0) sampleBatch();
+    rendering_ = was_rendering;
+}
+
+// List the tiles (of tile_size² pixels, given as the image column and row of
+// their top left pixel) covering a size² image, ordered along a Hilbert curve.
+// When "disk" is true, tiles which fall entirely outside the disk are omitted.
+void Texture::tilesInCurveOrder(int size,
+                                int tile_size,
+                                bool disk,
+                                std::vector<std::pair<int, int>>& tiles)
+{
+    tiles.clear();
+    int half = size / 2;
+    int tiles_per_side = (size + tile_size - 1) / tile_size;
+    // Hilbert curve is defined on grid whose size is a power of 2.
+    int grid_size = 1;
+    while (grid_size < tiles_per_side) grid_size *= 2;
+    for (int d = 0; d < sq(grid_size); d++)
+    {
+        int x, y;
+        hilbertCurveIndexToXY(grid_size, d, x, y);
+        if ((x < tiles_per_side) && (y < tiles_per_side))
+        {
+            int column = x * tile_size;
+            int row = y * tile_size;
+            // Pixel (within tile) nearest the disk center, as offset (i, j).
+            auto nearest = [&](int first, int last)
+                { return std::max(first, std::min(last, half)) - half; };
+            int i = nearest(column, std::min(column + tile_size, size) - 1);
+            int j = nearest(row, std::min(row + tile_size, size) - 1);
+            if ((!disk) || (sq(i) + sq(j) <= sq(half)))
+                tiles.push_back(std::make_pair(column, row));
+        }
+    }
+}
+
+// Rasterize one tile_size² tile (whose top left pixel is at the given column
+// and row) into a size² OpenCV image. Expects to run on a ThreadPool worker.
+// Only pixels inside the tile (and inside the disk, if "disk") are written.
+void Texture::rasterizeTile(int column, int row, int tile_size,
+                            int size, bool disk, cv::Mat& opencv_image,
+                            const Program* program) const
+{
+    int half = size / 2;
+    // Adaptive anti-aliasing probes, shared by the tile's rows, spanning its
+    // columns plus one on each side.
+    std::unique_ptr<ProbeRows> probe_rows;
+    if ((sqrt_of_aa_subsample_count > 2) && (getAdaptiveAAThreshold() > 0))
+        probe_rows = std::make_unique<ProbeRows>(column - half - 1,
+                                                 column + tile_size - half);
+    for (int r = row; r < std::min(row + tile_size, size); r++)
+    {
+        int j = half - r;
+        int x_limit = disk ? std::sqrt(sq(half) - sq(j)) : half;
+        rasterizeRowSegment(j,
+                            std::max(-x_limit, column - half),
+                            std::min(std::min(x_limit, size - 1 - half),
+                                     column + tile_size - 1 - half),
+                            size, opencv_image, program, probe_rows.get());
     }
 }
 
-// Rasterize the j-th row of this texture into a size² OpenCV image. Expects
-// to run in its own thread, uses mutex to synchonize access to the image.
-void Texture::rasterizeRowOfDisk(int j, int size, bool disk,
-                                 cv::Mat& opencv_image,
-                                 std::mutex& ocv_image_mutex) const
+// Rasterize pixels i_first through i_last (inclusive, as offsets from center)
+// of the j-th row of this texture, writing them directly into opencv_image.
+void Texture::rasterizeRowSegment(int j, int i_first, int i_last, int size,
+                                  cv::Mat& opencv_image,
+                                  const Program* program,
+                                  ProbeRows* probe_rows) const
 {
     // Half the rendering's size corresponds to the disk's center.
     int half = size / 2;
-    // First and last pixels on j-th row of time
-    int x_limit = disk ? std::sqrt(sq(half) - sq(j)) : half;
-    cv::Mat row_image(1, size, CV_32FC3, cv::Scalar(0.5, 0.5, 0.5));
-    for (int i = -x_limit; i <= x_limit; i++)
+    // Pointer to the first pixel of the j-th row of opencv_image.
+    cv::Vec3f* row_pixels = opencv_image.ptr<cv::Vec3f>(half - j);
+    // Footprint of each sample (pixel, or subpixel when anti-aliasing) in
+    // texture space, where pixels are 1/half apart. 0 means "unknown".
+    float pixel_width = 1.0f / half;
+    float footprint = pixel_width / sqrt_of_aa_subsample_count;
+    SampleFootprint::Scope scope(getRenderFootprint() ? footprint : 0);
+    // Note that this thread is rendering, restored at end of function.
+    bool was_rendering = rendering_;
+    rendering_ = true;
+    // Count of samples taken for this segment, to report samples per pixel.
+    int64_t sample_count = 0;
+    // Get clipped colors at given positions, from this texture or "program".
+    auto sample = [&](int count, const Vec2* positions, Color* colors)
+    {
+        if (!program) return getColorsClipped(count, positions, colors);
+        program->run(count, positions, colors);
+        for (int i = 0; i < count; i++) colors[i] = colors[i].clipToUnitRGB();
+    };
+    // Subsample positions, their colors, and jitter offsets. Reused by each
+    // call on this thread, so anti-aliasing does not allocate per pixel. A
+    // nested call (made while sampling) uses its own.
+    class Buffers
+    {
+    public:
+        std::vector<Vec2> positions;
+        std::vector<Color> subsamples;
+        std::vector<Vec2> offsets;
+    };
+    thread_local Buffers reused;
+    thread_local bool reused_busy = false;
+    Buffers nested;
+    bool nested_call = reused_busy;
+    Buffers& buffers = nested_call ? nested : reused;
+    reused_busy = true;
+    std::vector<Vec2>& positions = buffers.positions;
+    std::vector<Color>& subsamples = buffers.subsamples;
+    // Append positions of an NxN jittered grid of subsamples within the pixel
+    // at (column, row) to "positions".
+    auto addSubsamplePositions = [&](int column, int row, int n,
+                                     std::vector<Vec2>& positions)
     {
-        // Read TexSyn Color from Texture at (i, j).
+        Vec2 pixel_center = Vec2(column, row) / half;
+        float pixel_radius = 2.0 / size;
+        RandomSequence rs(pixel_center.hash());
+        jittered_grid_NxN_in_square(n, pixel_radius * 2, rs, buffers.offsets);
+        for (Vec2& offset : buffers.offsets)
+            positions.push_back(offset + pixel_center);
+    };
+    // Average colors of an NxN jittered grid of subsamples within the pixel at
+    // (column, row).
+    auto supersample = [&](int column, int row, int n)
+    {
+        positions.clear();
+        addSubsamplePositions(column, row, n, positions);
+        subsamples.resize(positions.size());
+        sample(int(positions.size()), positions.data(), subsamples.data());
+        sample_count += positions.size();
         Color color(0, 0, 0);
-        Vec2 pixel_center = Vec2(i, j) / half;
+        for (Color subsample : subsamples) color += subsample;
+        return color / sq(n);
+    };
+    // For adaptive anti-aliasing, probe each pixel of rows j+1, j and j-1
+    // with 2x2 subsamples, skipping rows already in "probe_rows".
+    int n = sqrt_of_aa_subsample_count;
+    float threshold = getAdaptiveAAThreshold();
+    bool adaptive = ((threshold > 0) && (n > 2));
+    std::unique_ptr<ProbeRows> segment_probe_rows;
+    if (adaptive && !probe_rows)
+    {
+        segment_probe_rows = std::make_unique<ProbeRows>(i_first - 1,
+                                                         i_last + 1);
+        probe_rows = segment_probe_rows.get();
+    }
+    for (int r = j + 1; adaptive && (r >= j - 1); r--)
+    {
+        ProbeRows& pr = *probe_rows;
+        assert((i_first > pr.i_first) && (i_last < pr.i_first + pr.width - 1));
+        if (pr.rows[ProbeRows::slot(r)] == r) continue;
+        pr.rows[ProbeRows::slot(r)] = r;
+        positions.clear();
+        for (int p = 0; p < pr.width; p++)
+            addSubsamplePositions(pr.i_first + p, r, 2, positions);
+        subsamples.resize(positions.size());
+        sample(int(positions.size()), positions.data(), subsamples.data());
+        sample_count += positions.size();
+        for (int p = 0; p < pr.width; p++)
+        {
+            const Color* s = &subsamples[p * 4];
+            int k = pr.index(pr.i_first + p, r);
+            pr.averages[k] = (s[0] + s[1] + s[2] + s[3]) / 4;
+            pr.contrasty[k] = false;
+            for (int a = 0; a < 4; a++)
+                for (int b = a + 1; b < 4; b++)
+                    if (maxComponentDifference(s[a], s[b]) > threshold)
+                        pr.contrasty[k] = true;
+        }
+    }
+    // Process segment in batches of up to max_batch_size pixels.
+    for (int first = i_first; first <= i_last; first += max_batch_size)
+    {
+        int count = std::min(i_last + 1 - first, int(max_batch_size));
+        Color colors[max_batch_size];
         if (sqrt_of_aa_subsample_count > 1) // anti-alaising?
         {
-            float pixel_radius = 2.0 / size;
-            std::vector<Vec2> offsets;
-            RandomSequence rs(pixel_center.hash());
-            jittered_grid_NxN_in_square(sqrt_of_aa_subsample_count,
-                                        pixel_radius * 2, rs, offsets);
-            for (Vec2 offset : offsets)
-                color += getColorClipped(pixel_center + offset);
-            color = color / sq(sqrt_of_aa_subsample_count);
+            if (adaptive)
+            {
+                // Use the NxN grid (same as non-adaptive) only for pixels
+                // whose probe subsamples, or probe averages of any of their
+                // eight neighbors, differ from its own by more than
+                // "threshold". Otherwise use its probe average.
+                const ProbeRows& pr = *probe_rows;
+                for (int p = 0; p < count; p++)
+                {
+                    int i = first + p;
+                    Color center = pr.averages[pr.index(i, j)];
+                    bool refine = pr.contrasty[pr.index(i, j)];
+                    for (int r = j - 1; r <= j + 1; r++)
+                        for (int q = i - 1; q <= i + 1; q++)
+                        {
+                            Color neighbor = pr.averages[pr.index(q, r)];
+                            if (maxComponentDifference(neighbor, center) >
+                                threshold) refine = true;
+                        }
+                    colors[p] = (refine ? supersample(i, j, n) : center);
+                }
+            }
+            else
+            {
+                for (int p = 0; p < count; p++)
+                    colors[p] = supersample(first + p, j, n);
+            }
         }
         else
         {
-            color = getColorClipped(pixel_center);
+            // Read TexSyn Colors from Texture for a batch of pixel centers.
+            Vec2 pixel_centers[max_batch_size];
+            for (int p = 0; p < count; p++)
+                pixel_centers[p] = Vec2(first + p, j) / half;
+            sample(count, pixel_centers, colors);
+            sample_count += count;
+        }
+        for (int p = 0; p < count; p++)
+        {
+            // Adjust for display gamma.
+            Color color = colors[p].gamma(1 / defaultGamma());
+            // Write OpenCV color, with reversed component order, to pixel.
+            row_pixels[half + first + p] = cv::Vec3f(color.b(),
+                                                     color.g(),
+                                                     color.r());
         }
-        // Adjust for display gamma.
-        color = color.gamma(1 / defaultGamma());
-        // Make OpenCV color, with reversed component order.
-        cv::Vec3f opencv_color(color.b(), color.g(), color.r());
-        // Write OpenCV color to corresponding pixel on row image:
-        row_image.at<cv::Vec3f>(cv::Point(half + i, 0)) = opencv_color;
     }
-    // Define a new image which is a "pointer" to j-th row of opencv_image.
-    cv::Mat row_in_full_image(opencv_image, cv::Rect(0, half - j, size, 1));
-    // Wait to grab lock for access to image. (Lock released at end of block)
-    const std::lock_guard<std::mutex> lock(ocv_image_mutex);
-    // Copy line_image into the j-th row of opencv_image.
-    row_image.copyTo(row_in_full_image);
+    render_sample_count += sample_count;
+    render_pixel_count += std::max(0, i_last + 1 - i_first);
+    if (!nested_call) reused_busy = false;
+    rendering_ = was_rendering;
+}
+
+// Largest difference in any RGB component between the cached rasters of two
+// textures, which must have been rendered at the same size.
+float Texture::maxRasterDifference(const Texture& t0, const Texture& t1)
+{
+    const cv::Mat& r0 = *t0.raster_;
+    const cv::Mat& r1 = *t1.raster_;
+    assert((r0.rows == r1.rows) && (r0.cols == r1.cols));
+    float max_difference = 0;
+    for (int row = 0; row < r0.rows; row++)
+    {
+        const cv::Vec3f* p0 = r0.ptr<cv::Vec3f>(row);
+        const cv::Vec3f* p1 = r1.ptr<cv::Vec3f>(row);
+        for (int column = 0; column < r0.cols; column++)
+            for (int k = 0; k < 3; k++)
+                max_difference = std::max(max_difference,
+                                          std::abs(p0[column][k] -
+                                                   p1[column][k]));
+    }
+    return max_difference;
+}
+
+// True if this texture's raster cache holds no image.
+bool Texture::rasterCacheEmpty() const
+{
+    return raster_->empty();
 }
 
 // Display a collection of Textures, each in a window, then wait for a char.
@@ -293,8 +758,32 @@ void Texture::displayAndFile3(const Texture& t1,
 // Each rendered pixel uses an NxN jittered grid of subsamples, where N is:
 int Texture::sqrt_of_aa_subsample_count = 1;
 
+// Global "adaptive anti-aliasing" threshold, 0 means always use NxN.
+float Texture::adaptive_aa_threshold_ = 0;
+
+// Average samples per pixel in most recent rasterizeToImageCache().
+float Texture::render_samples_per_pixel_ = 0;
+
 // Global default render size.
 int Texture::render_size_ = 511;
 
 // Global default "render as disk" flag: disk if true, else square.
 bool Texture::render_as_disk_ = true;
+
+// Global default width (and height) of tiles used in rasterizeToImageCache().
+int Texture::render_tile_size_ = 32;
+
+// Global "render footprint" flag: use pixel size as SampleFootprint.
+bool Texture::render_footprint_ = false;
+
+// Global "render compiled" flag: rasterize through a compiled Program.
+bool Texture::render_compiled_ = false;
+
+// Global "render blur raster" flag: Blur samples a blurred raster of input.
+bool Texture::render_blur_raster_ = false;
+
+// Global "render blur cache" flag: nested Blurs memoize their colors.
+bool Texture::render_blur_cache_ = true;
+
+// Set on each thread while it rasterizes pixels for a rendering.
+thread_local bool Texture::rendering_ = false;
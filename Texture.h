@@ -10,17 +10,41 @@
 #include "Vec2.h"
 #include "Color.h"
 #include "Utilities.h"
+#include <atomic>
+#include <climits>
+#include <functional>
 #include <vector>
 namespace cv {class Mat;}
+class Program;
 
 // Nickname for the type of PixelFunction used for rasterization.
 typedef std::function<void(int i, int j, Vec2 position)> PixelFunction;
+// Called after each stage of progressive rendering, with the stage index and
+// the image (a Texture's raster cache) as completed by that stage.
+typedef std::function<void(int stage, const cv::Mat& image)> StageFunction;
 
 class AbstractTexture
 {
 public:
     AbstractTexture(){}
     virtual Color getColor(Vec2 position) const = 0;
+    // Batch version of getColor(): evaluate texture at "count" positions,
+    // writing colors to a parallel array. The default version just calls
+    // getColor() on each. Common operators override it so the cost of virtual
+    // dispatch, per node of the texture tree, is paid once per batch instead
+    // of once per sample. Overrides use fixed size temporary arrays on the
+    // stack, so "count" must not exceed max_batch_size.
+    virtual void getColors(int count,
+                           const Vec2* positions,
+                           Color* colors) const
+    {
+        assert(count <= max_batch_size);
+        for (int i = 0; i < count; i++) colors[i] = getColor(positions[i]);
+    }
+    // Largest number of positions passed to a single call to getColors().
+    // (A multiple of 4, so batches can be processed as SIMD packets.)
+    static const int max_batch_size = 64;
+    static_assert(max_batch_size % 4 == 0, "max_batch_size must be 4*n");
 };
 
 class Texture : public AbstractTexture
@@ -32,9 +56,34 @@ public:
     Color getColor(Vec2 position) const override { return Color(0, 0, 0); }
     // Get color at position, clipping to unit RGB color cube.
     Color getColorClipped(Vec2 p) const { return getColor(p).clipToUnitRGB(); }
+    // Emit Program instructions to evaluate this texture at the positions in
+    // the given position register, return the color register for the result.
+    // Default is a Fallback instruction which calls getColors(). See Program.h
+    // Overrides compile subtextures with Program::compile(), not directly.
+    virtual int compile(Program& program, int position) const;
     // Utility for getColor(), special-cased for when alpha is 0 or 1.
     Color interpolatePointOnTextures(float alpha, Vec2 position0, Vec2 position1,
                                      const Texture& t0, const Texture& t1) const;
+    // Batch version for getColors(): interpolate between t0 and t1 at "count"
+    // positions with per-position alphas. Samples t0 only where alpha is not
+    // 1 and t1 only where alpha is not 0, making a batch call to each.
+    void interpolatePointsOnTextures(int count,
+                                     const float* alphas,
+                                     const Vec2* positions,
+                                     const Texture& t0,
+                                     const Texture& t1,
+                                     Color* colors) const;
+    // Batch utility for Max and Min: set "colors" to whichever of "colors0" or
+    // "colors1" has greater (or if "greater" is false, lesser) luminance.
+    static void selectByLuminance(int count,
+                                  bool greater,
+                                  const Color* colors0,
+                                  const Color* colors1,
+                                  Color* colors);
+    // Batch version of getColorClipped(), any "count", split into batches.
+    void getColorsClipped(int count,
+                          const Vec2* positions,
+                          Color* colors) const;
     // Rasterize this texture into size² OpenCV image, display in pop-up window.
     void displayInWindow(int size = getDefaultRenderSize(),
                          bool wait = true) const;
@@ -45,13 +94,80 @@ public:
     // Display cv::Mat in pop-up window. Stack diagonally from upper left.
     static void windowPlacementTool(cv::Mat& mat);
     // Rasterize this texture into a size² OpenCV image. Arg "disk" true means
-    // draw a round image, otherwise a square. Run parallel threads for speed.
+    // draw a round image, otherwise a square. Uses ThreadPool tasks for speed.
     void rasterizeToImageCache(int size, bool disk) const;
-    // Rasterize the j-th row of this texture into a size² OpenCV image. Expects
-    // to run in its own thread, uses mutex to synchonize access to the image.
-    void rasterizeRowOfDisk(int j, int size, bool disk,
-                            cv::Mat& opencv_image,
-                            std::mutex& ocv_image_mutex) const;
+    // Progressive version of rasterizeToImageCache(). Renders in stages, each
+    // leaving a complete image in the raster cache: stage 0 samples every 4th
+    // pixel of every 4th row (1/16 of them) filling a 4x4 block with each,
+    // stage 1 samples every 2nd (filling 2x2 blocks), stage 2 samples all
+    // pixels, and (if sqrt_of_aa_subsample_count is more than 1) stage 3
+    // resamples all pixels with anti-aliasing. Stages 1 and 2 sample only the
+    // pixels not sampled by earlier stages. Stage 2's image is identical to a
+    // rendering without anti-aliasing, and the last to rasterizeToImageCache().
+    // After each stage "stage_done" (if any) is called. If "cancel" (if any)
+    // is true between stages, rendering stops, the raster cache is emptied,
+    // and false is returned. Otherwise returns true.
+    bool rasterizeProgressively(int size,
+                                bool disk,
+                                const StageFunction& stage_done = nullptr,
+                                const std::atomic<bool>* cancel = nullptr)
+                                const;
+    // For adaptive anti-aliasing: 2x2 probes of the pixels in columns i_first
+    // to i_last (as offsets from center) of three consecutive rows, j+1, j and
+    // j-1, where row j is being rasterized. Each is stored in slot (r mod 3)
+    // for the pixel's row r. When kept across the rows of a tile, rasterized
+    // from top down, only row j-1 is new for each row, so is probed once.
+    class ProbeRows
+    {
+    public:
+        ProbeRows(int i_first, int i_last)
+          : i_first(i_first),
+            width(i_last + 1 - i_first),
+            averages(3 * width),
+            contrasty(3 * width) {}
+        // Slot for row r, and index of the pixel at column i of row r in the
+        // arrays below.
+        static int slot(int r) { return ((r % 3) + 3) % 3; }
+        int index(int i, int r) const
+            { return slot(r) * width + i - i_first; }
+        const int i_first;
+        const int width;
+        // Row r now in each slot, or none.
+        int rows[3] = {INT_MIN, INT_MIN, INT_MIN};
+        // Per pixel: average of its probes, and whether they differ by more
+        // than the adaptive anti-aliasing threshold.
+        std::vector<Color> averages;
+        std::vector<bool> contrasty;
+    };
+    // Rasterize pixels i_first through i_last (inclusive, as offsets from
+    // center) of the j-th row of this texture, directly into opencv_image.
+    // If a "program" compiled from this texture is given, it is used instead.
+    // For adaptive anti-aliasing, probes of this row and those either side
+    // are taken from (or added to) "probe_rows" if given, which must span
+    // i_first-1 to i_last+1. Otherwise they are probed just for this segment.
+    void rasterizeRowSegment(int j, int i_first, int i_last, int size,
+                             cv::Mat& opencv_image,
+                             const Program* program = nullptr,
+                             ProbeRows* probe_rows = nullptr) const;
+    // Rasterize one tile_size² tile (top left pixel at given column and row)
+    // into a size² OpenCV image. Pixels outside the disk (if any) are skipped.
+    void rasterizeTile(int column, int row, int tile_size,
+                       int size, bool disk, cv::Mat& opencv_image,
+                       const Program* program = nullptr) const;
+    // For progressive rendering: rasterize pixels of one tile whose column and
+    // row are multiples of "stride", filling a stride² block with each. When
+    // "skip_coarser" is true, pixels which are multiples of 2*stride (already
+    // done by the previous stage) are skipped.
+    void rasterizeTileAtStride(int column, int row, int tile_size,
+                               int size, bool disk, int stride,
+                               bool skip_coarser, cv::Mat& opencv_image,
+                               const Program* program) const;
+    // List tiles (as column and row of top left pixel) covering a size² image,
+    // ordered along a Hilbert curve, omitting those entirely outside the disk.
+    static void tilesInCurveOrder(int size,
+                                  int tile_size,
+                                  bool disk,
+                                  std::vector<std::pair<int, int>>& tiles);
     // Writes Texture to a file using cv::imwrite(). Generally used with JPEG
     // codec, but pathname's extension names the format to be used. Converts to
     // "24 bit" image (8 bit unsigned values for each of red, green and blue
@@ -95,6 +211,10 @@ public:
         { diff(t0, t1, pathname, getDiffSize()); }
     static void diff(const Texture& t0, const Texture& t1)
         { diff(t0, t1, "", getDiffSize()); }
+    // Compare textures over a disk "size" pixels in diameter, optionally
+    // printing statistics. Returns largest difference in any RGB component.
+    static float diffStatistics(const Texture& t0, const Texture& t1,
+                                int size, bool print);
     static void displayAndFile3(const Texture& t1,
                                 const Texture& t2,
                                 const Texture& t3,
@@ -110,6 +230,58 @@ public:
     // Get/set global default "render as disk" flag: disk if true, else square.
     static bool getDefaultRenderAsDisk() { return render_as_disk_; }
     static void setDefaultRenderAsDisk(bool disk) { render_as_disk_ = disk; }
+    // Get/set global default width (and height) of tiles, in pixels, used to
+    // schedule work in rasterizeToImageCache(). Typically 32 or 64.
+    static int getRenderTileSize() { return render_tile_size_; }
+    static void setRenderTileSize(int size)
+        { render_tile_size_ = std::max(1, size); }
+    // Get/set global "render footprint" flag. When true, rasterization sets
+    // the SampleFootprint to the pixel size, so noise can skip tiny octaves.
+    // Off by default: culled octaves slightly change the rendered image.
+    static bool getRenderFootprint() { return render_footprint_; }
+    static void setRenderFootprint(bool enable) { render_footprint_ = enable; }
+    // Get/set global "render compiled" flag. When true, rasterization first
+    // compiles the Texture into a Program (see Program.h) so that subtrees it
+    // shares (e.g. from ParsedTexture) are evaluated once per batch. Off by
+    // default: its results are not bit-identical to evaluating the tree (for
+    // example fused transforms round differently), so the image may change.
+    static bool getRenderCompiled() { return render_compiled_; }
+    static void setRenderCompiled(bool enable) { render_compiled_ = enable; }
+    // Get/set global "render blur raster" flag. When true, Blur (so also
+    // EdgeDetect and EdgeEnhance) samples a cached, blurred raster of its
+    // input while rendering, instead of averaging many subsamples per pixel.
+    // Off by default: its kernel differs slightly from the subsampled one.
+    static bool getRenderBlurRaster() { return render_blur_raster_; }
+    static void setRenderBlurRaster(bool enable)
+        { render_blur_raster_ = enable; }
+    // Get/set global "render blur cache" flag. When true, a Blur evaluated
+    // within the subsamples of another Blur (as in EdgeDetect of EdgeEnhance)
+    // memoizes its colors on a grid while rendering. See Blur::useNestedCache.
+    static bool getRenderBlurCache() { return render_blur_cache_; }
+    static void setRenderBlurCache(bool enable)
+        { render_blur_cache_ = enable; }
+    // True while this thread is rasterizing pixels for a rendering.
+    static bool rendering() { return rendering_; }
+    // Get/set global "adaptive anti-aliasing" threshold. When greater than 0
+    // (and sqrt_of_aa_subsample_count is more than 2) each pixel is probed by
+    // a 2x2 jittered grid of subsamples. It uses the full NxN grid only where
+    // those differ by more than this threshold in any RGB component, or where
+    // their average differs that much from any of its eight neighbors. Other
+    // pixels use that average, so differ from the NxN rendering, typically by
+    // less than twice the threshold (as tested by adaptive_anti_aliasing() in
+    // UnitTests.cpp). Probes are shared by the rows of a render tile, so cost
+    // a little over 4 samples per pixel.
+    static float getAdaptiveAAThreshold() { return adaptive_aa_threshold_; }
+    static void setAdaptiveAAThreshold(float threshold)
+        { adaptive_aa_threshold_ = threshold; }
+    // Average number of samples per pixel in the most recent rendering.
+    static float getRenderSamplesPerPixel()
+        { return render_samples_per_pixel_; }
+    // Largest difference in any RGB component between the cached rasters of
+    // two textures, which must have been rendered at the same size.
+    static float maxRasterDifference(const Texture& t0, const Texture& t1);
+    // True if this texture's raster cache holds no image.
+    bool rasterCacheEmpty() const;
 private:
     // TODO maybe we need a OOBB Bounds2d class?
     // TODO maybe should be stored in external std::map keyed on Texture pointer
@@ -125,4 +297,20 @@ private:
     static int render_size_;
     // Global default "render as disk" flag: disk if true, else square.
     static bool render_as_disk_;
+    // Global default width (and height) of tiles used for rasterization.
+    static int render_tile_size_;
+    // Global "render footprint" flag: use pixel size as SampleFootprint.
+    static bool render_footprint_;
+    // Global "render compiled" flag: rasterize by running a Program.
+    static bool render_compiled_;
+    // Global "render blur raster" flag: Blur samples a raster when rendering.
+    static bool render_blur_raster_;
+    // Global "render blur cache" flag: nested Blurs memoize while rendering.
+    static bool render_blur_cache_;
+    // Set during rasterizeRowSegment(), on the thread running it.
+    static thread_local bool rendering_;
+    // Global "adaptive anti-aliasing" threshold, 0 means always use NxN.
+    static float adaptive_aa_threshold_;
+    // Average samples per pixel in most recent rasterizeToImageCache().
+    static float render_samples_per_pixel_;
 };
@@ -0,0 +1,198 @@
+//
+//  ThreadPool.cpp
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    // Identifies the pool (if any) that owns the current thread, and its index.
+    thread_local const ThreadPool* current_pool = nullptr;
+    thread_local int current_worker_index = -1;
+}
+
+// The process-wide pool, initially sized to std::hardware_concurrency().
+ThreadPool& ThreadPool::getInstance()
+{
+    static ThreadPool pool(defaultWorkerCount());
+    return pool;
+}
+
+// Default number of workers: one per hardware thread (at least one).
+int ThreadPool::defaultWorkerCount()
+{
+    return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+// Set number of worker threads: finish queued work, then restart workers.
+void ThreadPool::setWorkerCount(int worker_count)
+{
+    stopWorkers();
+    startWorkers(worker_count);
+}
+
+// Launch worker threads, each with its own queue of tasks.
+void ThreadPool::startWorkers(int worker_count)
+{
+    worker_count = std::max(1, worker_count);
+    exit_ = false;
+    for (int i = 0; i < worker_count; i++)
+        queues_.push_back(std::make_unique<WorkQueue>());
+    for (int i = 0; i < worker_count; i++)
+        workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+// Tell workers to exit (once queues are empty) and wait for them to finish.
+void ThreadPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        exit_ = true;
+    }
+    wake_.notify_all();
+    for (auto& w : workers_) w.join();
+    workers_.clear();
+    queues_.clear();
+}
+
+// Top level function for each worker thread: run tasks until told to exit.
+void ThreadPool::workerLoop(int worker_index)
+{
+    current_pool = this;
+    current_worker_index = worker_index;
+    while (true)
+    {
+        if (runOneTask(worker_index)) continue;
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [&]{ return exit_ || queued_task_count_ > 0; });
+        if (exit_ && queued_task_count_ == 0) break;
+    }
+}
+
+// Index of current thread's worker in this pool, or -1 if not a worker.
+int ThreadPool::currentWorkerIndex() const
+{
+    return (current_pool == this) ? current_worker_index : -1;
+}
+
+// Add a group of tasks to the queues, spread across workers, wake workers.
+// Tasks submitted by a worker go on its own queue (it will likely run them
+// itself, while other workers can steal them), others are dealt round-robin.
+void ThreadPool::submit(std::vector<Task>& tasks)
+{
+    int worker_index = currentWorkerIndex();
+    int queue_count = int(queues_.size());
+    for (auto& task : tasks)
+    {
+        int q = ((worker_index >= 0) ?
+                 worker_index :
+                 int(next_queue_++ % queue_count));
+        std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+        queues_[q]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        queued_task_count_ += int(tasks.size());
+    }
+    wake_.notify_all();
+}
+
+// Look for a task: first from the back of this worker's own queue, otherwise
+// steal one from the front of another queue. Run it and return true if found.
+bool ThreadPool::runOneTask(int worker_index)
+{
+    Task task;
+    bool found = false;
+    int queue_count = int(queues_.size());
+    if (worker_index >= 0)
+    {
+        WorkQueue& own = *queues_[worker_index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for (int i = 1; (!found) && (i <= queue_count); i++)
+    {
+        int victim = (std::max(0, worker_index) + i) % queue_count;
+        WorkQueue& other = *queues_[victim];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty())
+        {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (found)
+    {
+        queued_task_count_--;
+        task();
+    }
+    return found;
+}
+
+// Apply "function" to all indices on [0, count) in chunks of "chunk_size".
+// The calling thread helps run tasks until every chunk has completed.
+void ThreadPool::parallelFor(int count,
+                             int chunk_size,
+                             std::function<void(int first_index,
+                                                int index_count)> function)
+{
+    if (count <= 0) return;
+    chunk_size = std::max(1, chunk_size);
+    // Shared (by reference) between this call and its tasks.
+    int remaining = (count + chunk_size - 1) / chunk_size;
+    std::mutex batch_mutex;
+    std::condition_variable batch_done;
+    std::vector<Task> tasks;
+    for (int first = 0; first < count; first += chunk_size)
+    {
+        int index_count = std::min(chunk_size, count - first);
+        tasks.push_back([&, first, index_count]()
+        {
+            function(first, index_count);
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            if (--remaining == 0) batch_done.notify_all();
+        });
+    }
+    submit(tasks);
+    // Help run tasks (from any queue) until this batch is done.
+    int worker_index = currentWorkerIndex();
+    auto batch_finished = [&]()
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        return remaining == 0;
+    };
+    while (!batch_finished())
+    {
+        if (!runOneTask(worker_index))
+        {
+            // Nothing to steal, so wait (briefly, since a nested parallelFor
+            // may yet add tasks we could help with) for the batch to finish.
+            std::unique_lock<std::mutex> lock(batch_mutex);
+            batch_done.wait_for(lock,
+                                std::chrono::milliseconds(1),
+                                [&]{ return remaining == 0; });
+        }
+    }
+}
+
+// Simpler version which calls function(index) once per task.
+void ThreadPool::parallelFor(int count, std::function<void(int index)> function)
+{
+    parallelFor(count, 1, [&](int first_index, int index_count)
+    {
+        for (int i = first_index; i < first_index + index_count; i++)
+            function(i);
+    });
+}
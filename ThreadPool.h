@@ -0,0 +1,83 @@
+//
+//  ThreadPool.h
+//  texsyn
+//
+//  Created by Craig Reynolds on 10/15/26.
+//  Copyright © 2026 Craig Reynolds. All rights reserved.
+//
+//  A persistent pool of worker threads, shared process-wide, used for parallel
+//  work like rasterization, Texture::diff() and Disk relaxation. Previously
+//  each of those created (then joined and discarded) its own threads, one per
+//  image row in the case of rasterization. Each worker has its own queue of
+//  tasks. It takes work from the back of its own queue, and when that is empty
+//  "steals" from the front of other workers' queues. A thread which submits a
+//  batch of work also helps run tasks until its batch is complete, so nested
+//  calls (a task which itself calls parallelFor()) do not deadlock.
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // Construct pool with given number of worker threads.
+    ThreadPool(int worker_count) { startWorkers(worker_count); }
+    ~ThreadPool() { stopWorkers(); }
+    // The process-wide pool, initially sized to std::hardware_concurrency().
+    static ThreadPool& getInstance();
+    // Get/set number of worker threads. Setting waits for current workers to
+    // finish their queued tasks, then starts "worker_count" new ones. Should
+    // not be called while parallelFor() is running on another thread.
+    int getWorkerCount() const { return int(workers_.size()); }
+    void setWorkerCount(int worker_count);
+    // Apply "function" to all indices on [0, count), split into chunks of (up
+    // to) "chunk_size" consecutive indices. Each chunk is a task, run on some
+    // worker thread, as function(first_index, index_count). Returns when all
+    // chunks have completed.
+    void parallelFor(int count,
+                     int chunk_size,
+                     std::function<void(int first_index,
+                                        int index_count)> function);
+    // Simpler version which calls function(index) once per task.
+    void parallelFor(int count, std::function<void(int index)> function);
+    // Default number of workers: one per hardware thread (at least one).
+    static int defaultWorkerCount();
+private:
+    typedef std::function<void()> Task;
+    // Each worker has one of these, a queue of tasks with a mutex to lock it.
+    class WorkQueue
+    {
+    public:
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    // Launch/terminate worker threads.
+    void startWorkers(int worker_count);
+    void stopWorkers();
+    // Top level function for each worker thread.
+    void workerLoop(int worker_index);
+    // Add a group of tasks to the queues, spread across workers, wake workers.
+    void submit(std::vector<Task>& tasks);
+    // Look for a task: first in the given worker's queue (-1 means caller is
+    // not a worker) then try to steal one from another worker's queue. Runs
+    // the task and returns true if one was found.
+    bool runOneTask(int worker_index);
+    // Index of current thread's worker in this pool, or -1 if not a worker.
+    int currentWorkerIndex() const;
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    // Workers sleep on this condition variable when all queues are empty.
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<int> queued_task_count_{0};
+    std::atomic<bool> exit_{false};
+    // Round robin index for tasks submitted from outside the pool.
+    std::atomic<unsigned int> next_queue_{0};
+};
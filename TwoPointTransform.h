@@ -14,6 +14,7 @@
 
 #pragma once
 #include "Vec2.h"
+#include "Simd.h"
 
 class TwoPointTransform
 {
@@ -38,6 +39,13 @@ public:
         return Vec2((v - origin()).dot(xBasis() / sq(scale())),
                     (v - origin()).dot(yBasis() / sq(scale())));
     }
+    // Packet version of localize(), for four Vec2s at once.
+    Vec2x4 localize(const Vec2x4& v) const
+    {
+        Vec2x4 offset = v - Vec2x4(origin());
+        return Vec2x4(offset.dot(Vec2x4(xBasis() / sq(scale()))),
+                      offset.dot(Vec2x4(yBasis() / sq(scale()))));
+    }
     // "Globalize" a Vec2 from this transform's "local space" to "global space".
     Vec2 globalize(Vec2 v) const
     {
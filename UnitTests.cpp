@@ -13,6 +13,7 @@
 // The main entry point is UnitTests::allTestsOK()
 
 #include "TexSyn.h"
+#include <fstream>
 
 // This "sub-test" wrapper macro just returns the value of the given expression
 // "e". If the value is NOT TRUE, the st() macro will also log the specific
@@ -536,6 +537,1324 @@ bool two_point_transform()
             true);
 }
 
+bool thread_pool()
+{
+    ThreadPool& pool = ThreadPool::getInstance();
+    int original_worker_count = pool.getWorkerCount();
+    // Each index visited exactly once, for a couple of chunk sizes.
+    auto visits_each_index_once = [&](int count, int chunk_size)
+    {
+        std::vector<int> visits(count, 0);
+        pool.parallelFor(count, chunk_size, [&](int first, int n)
+        {
+            for (int i = first; i < first + n; i++) visits[i]++;
+        });
+        for (int v : visits) if (v != 1) return false;
+        return true;
+    };
+    // Nested parallelFor (task which calls parallelFor) must not deadlock.
+    auto nested_sum = [&]()
+    {
+        std::atomic<int> sum(0);
+        pool.parallelFor(20, [&](int)
+        {
+            pool.parallelFor(50, [&](int j){ sum += j; });
+        });
+        return sum.load();
+    };
+    bool ok = (st(visits_each_index_once(1000, 1)) &&
+               st(visits_each_index_once(1000, 7)) &&
+               st(visits_each_index_once(3, 100)) &&
+               st(nested_sum() == 20 * (49 * 50 / 2)));
+    pool.setWorkerCount(3);
+    ok = ok && (st(pool.getWorkerCount() == 3) &&
+                st(visits_each_index_once(1000, 1)));
+    pool.setWorkerCount(original_worker_count);
+    return ok && st(pool.getWorkerCount() == original_worker_count);
+}
+
+bool tiled_rasterization()
+{
+    // Hilbert curve visits each cell once, each step to an adjacent cell.
+    auto hilbert_ok = [](int n)
+    {
+        std::vector<int> visits(n * n, 0);
+        int px = 0;
+        int py = 0;
+        for (int d = 0; d < n * n; d++)
+        {
+            int x, y;
+            hilbertCurveIndexToXY(n, d, x, y);
+            if ((x < 0) || (x >= n) || (y < 0) || (y >= n)) return false;
+            if ((d > 0) && ((std::abs(x - px) + std::abs(y - py)) != 1))
+                return false;
+            visits[x + (y * n)]++;
+            px = x;
+            py = y;
+        }
+        for (int v : visits) if (v != 1) return false;
+        return true;
+    };
+    // Tiles cover each pixel (of square or inside disk) exactly once.
+    auto tiles_cover_image = [](int size, int tile_size, bool disk)
+    {
+        std::vector<std::pair<int, int>> tiles;
+        Texture::tilesInCurveOrder(size, tile_size, disk, tiles);
+        std::vector<int> visits(size * size, 0);
+        for (auto& tile : tiles)
+            for (int r = tile.second; r < tile.second + tile_size; r++)
+                for (int c = tile.first; c < tile.first + tile_size; c++)
+                    if ((r < size) && (c < size)) visits[c + (r * size)]++;
+        int half = size / 2;
+        for (int r = 0; r < size; r++)
+        {
+            for (int c = 0; c < size; c++)
+            {
+                bool inside = sq(c - half) + sq(r - half) <= sq(half);
+                int v = visits[c + (r * size)];
+                if ((v > 1) || (((!disk) || inside) && (v != 1))) return false;
+            }
+        }
+        return true;
+    };
+    return (st(hilbert_ok(1)) &&
+            st(hilbert_ok(2)) &&
+            st(hilbert_ok(16)) &&
+            st(tiles_cover_image(101, 32, false)) &&
+            st(tiles_cover_image(101, 32, true)) &&
+            st(tiles_cover_image(511, 64, true)) &&
+            st(tiles_cover_image(64, 16, false)) &&
+            st(tiles_cover_image(7, 100, true)));
+}
+
+bool batch_get_colors()
+{
+    Uniform black(0);
+    Uniform white(1);
+    Uniform cyan(0, 1, 1);
+    Grating t1(Vec2(0, 0.2), white, Vec2(0, 0), cyan, 0.1, 0.5);
+    ColorNoise t2(Vec2(0.1, 0.2), Vec2(0.3, 0.5), 0.3);
+    Spot spot(Vec2(0.1, 0), 0.2, t1, 0.6, t2);
+    Gradation gradation(Vec2(-0.2, 0), t1, Vec2(0.2, 0), t2);
+    Grating grating(Vec2(0.1, 0), t2, Vec2(0.3, 0.1), black, 0.2, 0.3);
+    SoftMatte soft_matte(spot, grating, gradation);
+    Add add(t1, t2);
+    Multiply multiply(t1, t2);
+    Noise noise(Vec2(0, 0), Vec2(0.2, 0.1), t1, t2);
+    Brownian brownian(Vec2(0, 0), Vec2(0.3, 0.1), t1, t2);
+    MultiNoise multi_noise(Vec2(0, 0), Vec2(0.2, 0.1), t1, t2, 0.7);
+    Affine affine(Vec2(0.1, 0.2), Vec2(0.4, 0.3), soft_matte);
+    Scale scale(0.3, add);
+    Rotate rotate(1, multiply);
+    Translate translate(Vec2(0.2, -0.1), noise);
+    Subtract subtract(t1, t2);
+    Max max(t1, t2);
+    Min min(t1, spot);
+    AbsDiff abs_diff(spot, t2);
+    AdjustBrightness adjust_brightness(0.7, soft_matte);
+    Gamma gamma(1.6, subtract);
+    RgbBox rgb_box(0.2, 0.7, 0.1, 0.9, 0.3, 0.6, add);
+    Blur blur(0.1, spot);  // Not overridden, uses default getColors().
+    std::vector<const Texture*> textures =
+    {
+        &black, &spot, &gradation, &grating, &soft_matte, &add, &multiply,
+        &noise, &brownian, &multi_noise, &t2, &affine, &scale, &rotate,
+        &translate, &subtract, &max, &min, &abs_diff, &adjust_brightness,
+        &gamma, &rgb_box, &blur
+    };
+    // Batch results must match those from per-sample getColor(): exactly,
+    // except that SIMD packet code (see Simd.h) does not use the fused
+    // multiply-add some compilers generate for scalar code, so allow a tiny
+    // epsilon. (Max and Min are nonetheless exact for these inputs.)
+    float e = 0.00001;
+    RandomSequence rs(82736451);
+    auto batch_matches = [&](const Texture& texture, int count)
+    {
+        Vec2 positions[Texture::max_batch_size];
+        Color colors[Texture::max_batch_size];
+        for (int i = 0; i < count; i++)
+            positions[i] = rs.randomPointInUnitDiameterCircle() * 2;
+        texture.getColors(count, positions, colors);
+        for (int i = 0; i < count; i++)
+            if (!withinEpsilon(colors[i], texture.getColor(positions[i]), e))
+                return false;
+        return true;
+    };
+    bool ok = true;
+    for (auto t : textures)
+    {
+        ok = ok && (st(batch_matches(*t, 1)) &&
+                    st(batch_matches(*t, 17)) &&
+                    st(batch_matches(*t, Texture::max_batch_size)));
+    }
+    return ok;
+}
+
+bool simd_packets()
+{
+    // Packet operations on Float4, Vec2x4, and Color4 compared to scalar code.
+    RandomSequence rs(39482203);
+    float e = 0.000001;
+    auto lanes_match = [&](Float4 packet, std::function<float(int)> scalar)
+    {
+        for (int k = 0; k < 4; k++)
+            if (!withinEpsilon(packet.lane(k), scalar(k), e)) return false;
+        return true;
+    };
+    auto colors_match = [](Color4 packet, std::function<Color(int)> scalar)
+    {
+        Color colors[4];
+        packet.store(colors);
+        for (int k = 0; k < 4; k++) if (colors[k] != scalar(k)) return false;
+        return true;
+    };
+    bool ok = true;
+    for (int trial = 0; trial < 100; trial++)
+    {
+        float a[4];
+        float b[4];
+        Vec2 v[4];
+        Color c[4];
+        for (int k = 0; k < 4; k++)
+        {
+            a[k] = rs.frandom2(-2, 2);
+            b[k] = rs.frandom2(-2, 2);
+            v[k] = rs.randomPointInUnitDiameterCircle() * 3;
+            c[k] = Color(rs.frandom2(-0.5, 2),
+                         rs.frandom2(-0.5, 2),
+                         rs.frandom2(-0.5, 2));
+        }
+        Float4 fa = Float4::load(a);
+        Float4 fb = Float4::load(b);
+        Color4 c4 = Color4::load(c);
+        TwoPointTransform tpt(Vec2(0.1, 0.3), Vec2(-0.2, 0.5));
+        Vec2x4 local = tpt.localize(Vec2x4::load(v));
+        // Scalar versions, for lane k, of the packet operations tested below.
+        auto add = [&](int k){ return a[k] + b[k]; };
+        auto mul = [&](int k){ return a[k] * b[k]; };
+        auto div = [&](int k){ return a[k] / b[k]; };
+        auto min_ab = [&](int k){ return std::min(a[k], b[k]); };
+        auto max_ab = [&](int k){ return std::max(a[k], b[k]); };
+        auto clip_a = [&](int k){ return clip01(a[k]); };
+        auto remap = [&](int k){ return remapIntervalClip(a[k], -1, 0.5,
+                                                          0.2, 0.8); };
+        auto local_x = [&](int k){ return tpt.localize(v[k]).x(); };
+        auto local_y = [&](int k){ return tpt.localize(v[k]).y(); };
+        auto clip_c = [&](int k){ return c[k].clipToUnitRGB(); };
+        auto gamma_c = [&](int k){ return c[k].gamma(2.2); };
+        auto scale_c = [&](int k){ return c[k] - c[k] * a[k]; };
+        ok = ok && (st(lanes_match(fa + fb, add)) &&
+                    st(lanes_match(fa * fb, mul)) &&
+                    st(lanes_match(fa / fb, div)) &&
+                    st(lanes_match(min(fa, fb), min_ab)) &&
+                    st(lanes_match(max(fa, fb), max_ab)) &&
+                    st(lanes_match(clip01(fa), clip_a)) &&
+                    st(lanes_match(remapIntervalClip(fa, -1, 0.5, 0.2, 0.8),
+                                   remap)) &&
+                    st(lanes_match(local.x(), local_x)) &&
+                    st(lanes_match(local.y(), local_y)) &&
+                    st(colors_match(c4.clipToUnitRGB(), clip_c)) &&
+                    st(colors_match(c4.gamma(2.2), gamma_c)) &&
+                    st(colors_match(c4 - c4 * fa, scale_c)));
+    }
+    // Loading fewer than four values leaves unused lanes zero.
+    Color c3[3] = {Color(1, 2, 3), Color(4, 5, 6), Color(7, 8, 9)};
+    Color4 partial = Color4::load(c3, 3);
+    return (ok &&
+            st(partial.r().lane(2) == 7) &&
+            st(partial.b().lane(3) == 0) &&
+            st((Float4(1, 2, 3, 4) < Float4(2)).lane(0)) &&
+            st(!(Float4(1, 2, 3, 4) < Float4(2)).lane(1)) &&
+            st((Float4(1, 2, 3, 4) < Float4(2)).any()) &&
+            st(!(Float4(1, 2, 3, 4) > Float4(5)).any()));
+}
+
+bool noise_packets()
+{
+    // Packet (x4) noise functions match scalar versions, to within rounding.
+    // (Scalar furbulence2d() and wrapulence2d() have double intermediates.)
+    float e = 0.000001;
+    RandomSequence rs(57483920);
+    auto packet_matches = [&](std::function<float(Vec2)> scalar,
+                              std::function<Float4(Vec2x4)> packet)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            Vec2 v[4];
+            for (int k = 0; k < 4; k++)
+                v[k] = rs.randomPointInUnitDiameterCircle() * 100;
+            Float4 p = packet(Vec2x4::load(v));
+            for (int k = 0; k < 4; k++)
+                if (!withinEpsilon(p.lane(k), scalar(v[k]), e)) return false;
+        }
+        return true;
+    };
+    bool ok = true;
+    for (float which : {0.0f, 0.2f, 0.4f, 0.6f, 0.8f})
+    {
+        auto scalar = [&](Vec2 v)
+            { return PerlinNoise::multiNoise2d(v, which); };
+        auto packet = [&](Vec2x4 v)
+            { return PerlinNoise::multiNoise2dx4(v, which); };
+        ok = ok && st(packet_matches(scalar, packet));
+    }
+    return (ok &&
+            st(packet_matches(PerlinNoise::noise2d,
+                              PerlinNoise::noise2dx4)) &&
+            st(packet_matches(PerlinNoise::unitNoise2d,
+                              PerlinNoise::unitNoise2dx4)) &&
+            st(packet_matches(PerlinNoise::turbulence2d,
+                              PerlinNoise::turbulence2dx4)) &&
+            st(packet_matches(PerlinNoise::brownian2d,
+                              PerlinNoise::brownian2dx4)) &&
+            st(packet_matches(PerlinNoise::furbulence2d,
+                              PerlinNoise::furbulence2dx4)) &&
+            st(packet_matches(PerlinNoise::wrapulence2d,
+                              PerlinNoise::wrapulence2dx4)));
+}
+
+bool noise_thread_safety()
+{
+    // Many threads evaluating noise at once all get the same values as a
+    // single thread. (Also intended to be run under ThreadSanitizer, which
+    // reported a data race on the lazily initialized permutation table.)
+    int thread_count = 16;
+    int sample_count = 2000;
+    RandomSequence rs(73920184);
+    std::vector<Vec2> positions;
+    for (int i = 0; i < sample_count; i++)
+        positions.push_back(rs.randomPointInUnitDiameterCircle() * 100);
+    // Cycle through all five kinds of noise in multiNoise2d().
+    auto noise = [&](int i)
+        { return PerlinNoise::multiNoise2d(positions[i], (i % 5) * 0.2); };
+    std::vector<float> expected;
+    for (int i = 0; i < sample_count; i++) expected.push_back(noise(i));
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++)
+    {
+        threads.push_back(std::thread([&]()
+        {
+            for (int i = 0; i < sample_count; i++)
+                if (noise(i) != expected[i]) mismatches++;
+        }));
+    }
+    for (auto& thread : threads) thread.join();
+    return st(mismatches == 0);
+}
+
+bool sample_footprint()
+{
+    // Texture whose red component is the SampleFootprint it was called with.
+    class FootprintProbe : public Texture
+    {
+    public:
+        Color getColor(Vec2 position) const override
+            { return Color(SampleFootprint::get(), 0, 0); }
+    };
+    FootprintProbe probe;
+    auto seen = [](const Texture& texture)
+    {
+        SampleFootprint::Scope footprint(0.1);
+        return texture.getColor(Vec2(0.3, 0.2)).r();
+    };
+    float e = 0.000001;
+    bool geometry_ok = (st(withinEpsilon(seen(probe), 0.1, e)) &&
+                        st(withinEpsilon(seen(Scale(2, probe)), 0.05, e)) &&
+                        st(withinEpsilon(seen(Rotate(1, probe)), 0.1, e)) &&
+                        st(withinEpsilon(seen(Affine(Vec2(0.1, 0.2),
+                                                     Vec2(0.1, 0.7),
+                                                     probe)), 0.2, e)) &&
+                        st(seen(Twist(1, 1, Vec2(), probe)) == 0) &&
+                        st(SampleFootprint::get() == 0));
+    // Culling octaves of fractal noise changes each value only a little, and
+    // preserves the average. Packet versions still match scalar versions.
+    RandomSequence rs(48305721);
+    bool noise_ok = true;
+    for (float which : {0.2f, 0.4f, 0.6f, 0.8f})
+    {
+        double sum_all = 0;
+        double sum_culled = 0;
+        for (int i = 0; i < 2000; i++)
+        {
+            Vec2 v[4];
+            for (int k = 0; k < 4; k++)
+                v[k] = rs.randomPointInUnitDiameterCircle() * 100;
+            float all = PerlinNoise::multiNoise2d(v[0], which);
+            SampleFootprint::Scope footprint(0.1);
+            float culled = PerlinNoise::multiNoise2d(v[0], which);
+            Float4 packet = PerlinNoise::multiNoise2dx4(Vec2x4::load(v), which);
+            sum_all += all;
+            sum_culled += culled;
+            noise_ok = (noise_ok &&
+                        st(std::abs(all - culled) < 0.1) &&
+                        st(withinEpsilon(packet.lane(0), culled, e)));
+        }
+        noise_ok = noise_ok && st(std::abs(sum_all - sum_culled) / 2000 < 0.01);
+    }
+    return geometry_ok && noise_ok;
+}
+
+bool compiled_program()
+{
+    // A compiled Program gives exactly the same colors as getColors(), with
+    // and without a SampleFootprint, for each type of Texture and for some
+    // nested trees which exercise all opcodes. When optimized (for example
+    // by fusing transforms) colors may differ by rounding error.
+    RandomSequence rs(60293847);
+    std::vector<Vec2> positions;
+    for (int i = 0; i < 300; i++)
+        positions.push_back(rs.randomPointInUnitDiameterCircle() * 2.2);
+    auto same_colors = [&](const Texture& texture)
+    {
+        Program program(texture, false);
+        Program optimized(texture);
+        for (float footprint : {0.0f, 0.02f})
+        {
+            SampleFootprint::Scope scope(footprint);
+            std::vector<Color> expected(positions.size());
+            texture.getColorsClipped(int(positions.size()),
+                                     positions.data(),
+                                     expected.data());
+            std::vector<Color> colors(positions.size());
+            program.run(int(positions.size()), positions.data(), colors.data());
+            for (size_t i = 0; i < positions.size(); i++)
+                if (colors[i].clipToUnitRGB() != expected[i]) return false;
+            optimized.run(int(positions.size()),
+                          positions.data(),
+                          colors.data());
+            for (size_t i = 0; i < positions.size(); i++)
+                if (!withinEpsilon(colors[i].clipToUnitRGB(), expected[i],
+                                   0.0001)) return false;
+        }
+        return true;
+    };
+    bool all_types_ok = true;
+    UnitTests::forAllTextureTypes([&](const Texture& texture)
+        { all_types_ok = all_types_ok && st(same_colors(texture)); });
+    Uniform gray(0.5);
+    Uniform blue(0, 0, 1);
+    Grating grating(Vec2(), gray, Vec2(0.1, 0.1), blue, 0.3, 0.4);
+    Turbulence turbulence(Vec2(), Vec2(0.3, 0.1), grating, blue);
+    Scale scale(0.7, turbulence);
+    Rotate rotate(0.4, scale);
+    Translate translate(Vec2(0.1, 0.2), rotate);
+    Affine affine(Vec2(0.2, 0.1), Vec2(0.5, 0.3), translate);
+    Spot spot(Vec2(0.1, 0), 0.2, affine, 0.6, grating);
+    Gradation gradation(Vec2(-0.5, 0), spot, Vec2(0.5, 0.2), turbulence);
+    Max max(spot, gray);
+    SoftMatte matte(grating, gradation, max);
+    AdjustBrightness bright(1.5, matte);
+    Gamma gamma(0.7, bright);
+    RgbBox box(0.2, 0.9, 0.1, 0.8, 0.3, 1, gamma);
+    Multiply multiply(spot, grating);
+    AbsDiff abs_diff(spot, gray);
+    Subtract subtract(multiply, abs_diff);
+    Add add(box, subtract);
+    Blur blur(0.1, spot);
+    Brownian brownian(Vec2(0.2, 0), Vec2(0.4, 0.3), blur, box);
+    Min min(add, brownian);
+    return (all_types_ok &&
+            st(same_colors(min)) &&
+            st(same_colors(Affine(Vec2(), Vec2(), min))) &&
+            st(same_colors(Scale(-2, min))));
+}
+
+bool parsed_texture()
+{
+    // Parse the text of two of the random programs at the end of main.cpp,
+    // compare with the same trees written in C++.
+    std::string text2 =
+        ("Ring(3.11535, Vec2(3.03757, 0.967017), Vec2(-1.42594, -1.81315), "
+         "SliceShear(Vec2(-4.01977, -3.029), Vec2(-3.63676, 2.93948), "
+         "Hyperbolic(Vec2(-4.63751, 3.72073), 8.21554, 9.18318, 4.19357, "
+         "Uniform(0.642181, 0.261001, 0.428011), "
+         "ColorNoise(Vec2(-4.05045, -1.65673), Vec2(-3.66899, 1.61807), "
+         "0.792373)), Vec2(-0.478021, 4.5042), Vec2(4.56995, 0.0112824), "
+         "ColorNoise(Vec2(3.34685, 3.47989), Vec2(-0.249423, -0.262976), "
+         "0.175241)))");
+    Uniform u2(0.642181, 0.261001, 0.428011);
+    ColorNoise cn2a(Vec2(-4.05045, -1.65673), Vec2(-3.66899, 1.61807),
+                    0.792373);
+    Hyperbolic hyperbolic(Vec2(-4.63751, 3.72073), 8.21554, 9.18318, 4.19357,
+                          u2, cn2a);
+    ColorNoise cn2b(Vec2(3.34685, 3.47989), Vec2(-0.249423, -0.262976),
+                    0.175241);
+    SliceShear slice_shear(Vec2(-4.01977, -3.029), Vec2(-3.63676, 2.93948),
+                           hyperbolic,
+                           Vec2(-0.478021, 4.5042), Vec2(4.56995, 0.0112824),
+                           cn2b);
+    Ring ring(3.11535, Vec2(3.03757, 0.967017), Vec2(-1.42594, -1.81315),
+              slice_shear);
+    std::string text3 =
+        ("Grating(Vec2(-1.47541, -0.86595), AdjustBrightness(0.0384087, "
+         "BrightnessWrap(0.805273, 0.469073, BrightnessWrap(0.401083, "
+         "0.670738, HueOnly(0.281567, 0.0632304, Min(Uniform(0.427763, "
+         "0.769109, 0.859361), ColorNoise(Vec2(2.44752, -4.46087), "
+         "Vec2(-2.27331, 4.02469), 0.0391472)))))), Vec2(-2.13785, "
+         "-3.31639), Gamma(1.47854, SliceToRadial(Vec2(-3.44811, -2.35952), "
+         "Vec2(-3.74908, 1.89859), ColorNoise(Vec2(-2.45512, 3.92944), "
+         "Vec2(1.00124, 3.80463), 0.657286))), 0.965485, 0.55324)");
+    Uniform u3(0.427763, 0.769109, 0.859361);
+    ColorNoise cn3a(Vec2(2.44752, -4.46087), Vec2(-2.27331, 4.02469),
+                    0.0391472);
+    Min min(u3, cn3a);
+    HueOnly hue_only(0.281567, 0.0632304, min);
+    BrightnessWrap bw1(0.401083, 0.670738, hue_only);
+    BrightnessWrap bw2(0.805273, 0.469073, bw1);
+    AdjustBrightness adjust_brightness(0.0384087, bw2);
+    ColorNoise cn3b(Vec2(-2.45512, 3.92944), Vec2(1.00124, 3.80463), 0.657286);
+    SliceToRadial slice_to_radial(Vec2(-3.44811, -2.35952),
+                                  Vec2(-3.74908, 1.89859),
+                                  cn3b);
+    Gamma gamma(1.47854, slice_to_radial);
+    Grating grating(Vec2(-1.47541, -0.86595), adjust_brightness,
+                    Vec2(-2.13785, -3.31639), gamma,
+                    0.965485, 0.55324);
+    RandomSequence rs(23948576);
+    auto same_colors = [&](const Texture& t0, const Texture& t1)
+    {
+        for (int i = 0; i < 300; i++)
+        {
+            Vec2 position = rs.randomPointInUnitDiameterCircle() * 2;
+            if (t0.getColor(position) != t1.getColor(position)) return false;
+        }
+        return true;
+    };
+    ParsedTexture parsed2(text2);
+    ParsedTexture parsed3(text3);
+    bool programs_ok = (st(parsed2.valid()) &&
+                        st(parsed3.valid()) &&
+                        st(parsed2.operatorCount() == 6) &&
+                        st(parsed3.operatorCount() == 11) &&
+                        st(same_colors(parsed2.texture(), ring)) &&
+                        st(same_colors(parsed3.texture(), grating)));
+    // Malformed programs are rejected with an error message.
+    auto rejected = [](const std::string& text)
+    {
+        ParsedTexture parsed(text);
+        return !parsed.valid() && !parsed.error().empty();
+    };
+    bool errors_ok = (st(rejected("")) &&
+                      st(rejected("Foo(1)")) &&
+                      st(rejected("Uniform(1, 2)")) &&
+                      st(rejected("Uniform(1) Uniform(2)")) &&
+                      st(rejected("Scale(2, Uniform(1)")) &&
+                      st(rejected("Scale(Vec2(1, 2), Uniform(1))")) &&
+                      st(rejected("Add(Uniform(1), Uniform(x))")) &&
+                      st(ParsedTexture(" Uniform ( 1 ) ").valid()));
+    return programs_ok && errors_ok;
+}
+
+bool shared_subtrees()
+{
+    // Count instructions with given opcode in a Program.
+    auto count_opcodes = [](const Program& program, Program::Opcode opcode)
+    {
+        int count = 0;
+        for (auto& i : program.instructions()) if (i.opcode == opcode) count++;
+        return count;
+    };
+    // Program for a texture gives the same colors as getColorsClipped().
+    RandomSequence rs(98723465);
+    auto same_colors = [&](const Program& program, const Texture& texture)
+    {
+        std::vector<Vec2> positions;
+        for (int i = 0; i < 300; i++)
+            positions.push_back(rs.randomPointInUnitDiameterCircle() * 2);
+        std::vector<Color> expected(positions.size());
+        std::vector<Color> colors(positions.size());
+        texture.getColorsClipped(int(positions.size()),
+                                 positions.data(),
+                                 expected.data());
+        program.run(int(positions.size()), positions.data(), colors.data());
+        // Within rounding: getColor() of operators without their own batch
+        // getColors() calls getColor() (scalar noise) on their subtextures.
+        for (size_t i = 0; i < positions.size(); i++)
+            if (!withinEpsilon(colors[i].clipToUnitRGB(), expected[i], 0.00001))
+                return false;
+        return true;
+    };
+    // Repeated subtrees in text are merged by ParsedTexture, then compiled
+    // once, beneath a Twist (a Warp instruction). Inside the Subsets of Spot
+    // and Grating, their colors are gathered from the enclosing batch.
+    std::string noise = "ColorNoise(Vec2(-1.3, 2.4), Vec2(-1.9, 0.9), 0.8)";
+    std::string spot = ("Spot(Vec2(0.2, 0.1), 0.3, " + noise +
+                        ", 0.6, Uniform(0.4, 0.2, 0.1))");
+    ParsedTexture parsed("Twist(2, 3, Vec2(0.1, 0.2), Add(HueOnly(0.5, 0.5, " +
+                         noise + "), Multiply(" + spot +
+                         ", Grating(Vec2(0.1, 0.2), " + spot +
+                         ", Vec2(0.3, 0.1), Uniform(0.4, 0.2, 0.1), 0.5, " +
+                         "0.5))))");
+    Program program(parsed.texture());
+    bool parsed_ok = (st(parsed.operatorCount() == 8) &&
+                      st(count_opcodes(program, Program::Opcode::Fallback) ==
+                         1) &&
+                      st(count_opcodes(program, Program::Opcode::Gather) ==
+                         2) &&
+                      st(count_opcodes(program, Program::Opcode::Warp) ==
+                         1) &&
+                      st(count_opcodes(program, Program::Opcode::MapColor) ==
+                         1) &&
+                      st(same_colors(program, parsed.texture())));
+    // Equal but separate operators with opcodes share instructions. (Here
+    // the Scale and Uniform, leaving a Scale whose output is unused. Without
+    // optimization, which would fold the whole Program into one Uniform.)
+    Uniform gray0(0.5);
+    Uniform gray1(0.5);
+    Scale scale0(2, gray0);
+    Scale scale1(2, gray1);
+    Add add(scale0, scale1);
+    Program add_program(add, false);
+    bool instructions_ok = (st(add_program.sharedInstructionCount() == 2) &&
+                            st(add_program.instructions().size() == 3) &&
+                            st(same_colors(add_program, add)));
+    return parsed_ok && instructions_ok;
+}
+
+bool optimized_program()
+{
+    auto count_opcodes = [](const Program& program, Program::Opcode opcode)
+    {
+        int count = 0;
+        for (auto& i : program.instructions()) if (i.opcode == opcode) count++;
+        return count;
+    };
+    // Constant subtrees fold to Uniforms (including Blur of a constant), and
+    // identities (Rotate by 0, AdjustBrightness by 1, Multiply by white) are
+    // removed. SoftMatte by black needs only its first texture, and by gray
+    // needs both everywhere, so neither needs a Subset. Gamma of 1 remains,
+    // since it clips negative colors. Left are the Fallback for ColorNoise,
+    // gray and its Luminance, the constant Blur, Interpolate and Gamma.
+    ColorNoise noise(Vec2(-1.3, 2.4), Vec2(-1.9, 0.9), 0.8);
+    Uniform black(0);
+    Uniform white(1);
+    Uniform gray(0.5);
+    Uniform color0(0.2, 0.3, 0.4);
+    Uniform color1(0.1, 0.2, 0.05);
+    Add constant(color0, color1);
+    Blur blur(0.1, constant);
+    AdjustBrightness brightness(1, noise);
+    Multiply multiply(brightness, white);
+    Rotate rotate(0, multiply);
+    SoftMatte matte0(black, rotate, gray);
+    SoftMatte matte1(gray, matte0, blur);
+    Gamma gamma(1, matte1);
+    Program optimized(gamma);
+    Program unoptimized(gamma, false);
+    const auto& instructions = optimized.instructions();
+    bool folded_ok =
+        (st(instructions.size() == 6) &&
+         st(unoptimized.instructions().size() > 12) &&
+         st(count_opcodes(optimized, Program::Opcode::Fallback) == 1) &&
+         st(count_opcodes(optimized, Program::Opcode::Subset) == 0) &&
+         st(count_opcodes(optimized, Program::Opcode::Uniform) == 2) &&
+         st(instructions[3].opcode == Program::Opcode::Uniform) &&
+         st(Color(instructions[3].constants[0],
+                  instructions[3].constants[1],
+                  instructions[3].constants[2]) ==
+            Color(0.2, 0.3, 0.4) + Color(0.1, 0.2, 0.05)) &&
+         st(Program::verify(gamma, 51, false) < 0.00001));
+    // A tree computing a constant becomes a single Uniform instruction.
+    Uniform gray0(0.5);
+    Uniform gray1(0.5);
+    Scale scale0(2, gray0);
+    Scale scale1(2, gray1);
+    Add add(scale0, scale1);
+    Program add_program(add);
+    bool constant_ok =
+        (st(add_program.instructions().size() == 1) &&
+         st(add_program.instructions()[0].opcode == Program::Opcode::Uniform) &&
+         st(Program::verify(add, 51, false) == 0));
+    return folded_ok && constant_ok;
+}
+
+bool fused_transforms()
+{
+    auto count_opcodes = [](const Program& program, Program::Opcode opcode)
+    {
+        int count = 0;
+        for (auto& i : program.instructions()) if (i.opcode == opcode) count++;
+        return count;
+    };
+    // A chain of affine operators above a Noise, whose own TwoPointTransform
+    // is fused with them, becomes a single Matrix instruction. The chain
+    // above the Grating is also fused but leaves a Matrix for its Uniforms.
+    Uniform black(0);
+    Uniform white(1);
+    Noise noise(Vec2(0.1, 0.2), Vec2(0.3, 0.1), black, white);
+    Affine affine(Vec2(0.2, 0.3), Vec2(0.5, -0.1), noise);
+    Stretch stretch(Vec2(1.5, 0.5), Vec2(0.1, -0.2), affine);
+    Translate translate(Vec2(0.3, -0.4), stretch);
+    Rotate rotate(0.7, translate);
+    Scale scale(1.3, rotate);
+    Program program(scale);
+    const auto& instructions = program.instructions();
+    bool noise_ok =
+        (st(count_opcodes(program, Program::Opcode::Matrix) == 1) &&
+         st(instructions[0].opcode == Program::Opcode::Matrix) &&
+         st(instructions[1].opcode == Program::Opcode::NoiseAlpha) &&
+         st(instructions[1].constants[0] == 1) &&
+         st(count_opcodes(program, Program::Opcode::Fallback) == 0) &&
+         st(Program::verify(scale, 51, false) < 0.0001));
+    Grating grating(Vec2(0.1, 0.2), black, Vec2(0.3, 0.1), white, 0.5, 0.5);
+    Rotate rotate_grating(0.3, grating);
+    Scale scale_grating(0.7, rotate_grating);
+    Program grating_program(scale_grating);
+    bool grating_ok =
+        (st(count_opcodes(grating_program, Program::Opcode::Matrix) == 1) &&
+         st(count_opcodes(grating_program, Program::Opcode::Rotate) == 0) &&
+         st(count_opcodes(grating_program, Program::Opcode::Scale) == 0) &&
+         st(Program::verify(scale_grating, 51, false) < 0.0001));
+    return noise_ok && grating_ok;
+}
+
+bool precomputed_invariants()
+{
+    // Values precomputed at construction (Wrap, Ring, COTS) or inlined (Mobius)
+    // give exactly the same results, over a grid of positions, as the original
+    // per-sample formulas written out below.
+    Uniform gray(0.5);
+    float width = 2;
+    Vec2 center(0.1, 0.2);
+    Vec2 fixed_ray(0.3, 1);
+    Wrap wrap(width, center, fixed_ray, gray);
+    float copies = 5;
+    Vec2 basis(1, 0.4);
+    Ring ring(copies, basis, center, gray);
+    Vec2 ma(1, 0.3);
+    Vec2 mb(0.2, 1);
+    Vec2 mc(0.5, 0.1);
+    Vec2 md(0.8, 1);
+    MobiusTransform mobius(ma, mb, mc, md, gray);
+    auto complex = [](Vec2 v) { return Complex(v.x(), v.y()); };
+    COTS cots(Vec2(-0.1, 0.2), Vec2(0.1, 0.2), Vec2(0.4, 0.6), Vec2(-1, -1));
+    // Original COTS::Inverse(), recomputing its parameters per sample.
+    auto cots_inverse = [&](Vec2 M)
+    {
+        Vec2 A = cots.getA();
+        Vec2 B = cots.getB();
+        Vec2 C = cots.getC();
+        Vec2 D = cots.getD();
+        float au = cots.spiralAngle(A, B, D, C);
+        float mu = cots.spiralScale(A, B, D, C);
+        float av = cots.spiralAngle(A, D, B, C);
+        float mv = cots.spiralScale(A, D, B, C);
+        Vec2 F = cots.getF();
+        Vec2 Mi;
+        float x, y;
+        float amin = std::min(std::min(0.0f, au + av), std::min(au, av));
+        float amax = std::max(std::max(0.0f, au + av), std::max(au, av));
+        float mmin = std::min(std::min(1.0f, mu * mv), std::min(mu, mv));
+        float pm = cots.distance(F, M) / cots.distance(F, A);
+        float pa = cots.angle(A - F, M - F);
+        auto MapInv = [&](float a, float m)
+        {
+            float u = (log(m)*av-log(mv)*a) / (log(mu)*av-log(mv)*au);
+            float v = (a-u*au)/av;
+            return Vec2(u, v);
+        };
+        for (int i = -2; i <= 2; i++)
+        {
+            float ppa = pa + (2 * pi * i);
+            Mi = MapInv(ppa, pm);
+            x = Mi.x(); y = Mi.y();
+            if((amin < ppa) && (ppa < amax) && (mmin < pm) &&
+               (0 <= x) && (x <= 1) && (0 <= y) && (y <= 1))
+            {
+                return Mi;
+            }
+        }
+        return MapInv(pa, pm);
+    };
+    bool wrap_ok = true;
+    bool ring_ok = true;
+    bool mobius_ok = true;
+    bool cots_ok = true;
+    for (float x = -2; x <= 2; x += 0.05)
+    {
+        for (float y = -2; y <= 2; y += 0.05)
+        {
+            Vec2 position(x, y);
+            // Wrap
+            Vec2 p = position - center;
+            Vec2 new_y = fixed_ray.normalize();
+            Vec2 new_x = new_y.rotate90degCW();
+            float angle = Vec2(p.dot(new_x), p.dot(new_y)).atan2();
+            Vec2 wrapped = (center +
+                            new_x * remapInterval(angle, -pi, pi,
+                                                  -width, width) +
+                            new_y * p.length());
+            if (wrap.warp(position) != wrapped) wrap_ok = false;
+            // Ring
+            Vec2 offset = position - center;
+            float ring_angle = offset.atan2() - basis.atan2();
+            float segment_angle = 2 * pi / copies;
+            int segment_index = std::round(ring_angle / segment_angle);
+            float lookup_angle = ring_angle - (segment_angle * segment_index);
+            Vec2 spoke = (basis.rotate(lookup_angle).normalize() *
+                          offset.length());
+            if (ring.warp(position) != center + spoke) ring_ok = false;
+            // MobiusTransform
+            Complex z = inverse_mobius_transform(complex(position),
+                                                 complex(ma),
+                                                 complex(mb),
+                                                 complex(mc),
+                                                 complex(md));
+            if (mobius.warp(position) != Vec2(z.real(), z.imag()))
+                mobius_ok = false;
+            // COTS
+            if (cots.Inverse(position) != cots_inverse(position))
+                cots_ok = false;
+        }
+    }
+    return (st(wrap_ok) && st(ring_ok) && st(mobius_ok) && st(cots_ok));
+}
+
+bool blur_jitter_bank()
+{
+    // Each pattern in the bank has most of the NxN subsamples (those inside
+    // the disk), with weights on [0, 1] and their sum precomputed. Patterns
+    // differ, and are selected by hash.
+    int n = Blur::sqrt_of_subsample_count;
+    const Blur::JitterBank& bank = Blur::JitterBank::get(n);
+    bool patterns_ok = true;
+    for (int i = 0; i < Blur::JitterBank::pattern_count; i++)
+    {
+        const auto& pattern = bank.pattern(i);
+        float sum = 0;
+        for (auto& subsample : pattern.subsamples)
+        {
+            if (subsample.offset.length() > 0.5 ||
+                !between(subsample.weight, 0, 1)) patterns_ok = false;
+            sum += subsample.weight;
+        }
+        if (pattern.subsamples.size() < sq(n) / 2 ||
+            pattern.subsamples.size() > sq(n) ||
+            sum != pattern.sum_of_weights) patterns_ok = false;
+    }
+    bool distinct = (bank.pattern(0).subsamples[0].offset !=
+                     bank.pattern(1).subsamples[0].offset);
+    // The same bank is shared, Blur of a Uniform is (within rounding) the
+    // same Uniform, and Blur of a Grating is repeatable.
+    Uniform color(0.1, 0.5, 0.9);
+    Uniform black(0);
+    Blur blur_uniform(0.2, color);
+    Grating grating(Vec2(), color, Vec2(0.1, 0.1), black, 0.5, 0.5);
+    Blur blur_grating(0.2, grating);
+    bool blurs_ok = true;
+    RandomSequence rs(2309487);
+    for (int i = 0; i < 100; i++)
+    {
+        Vec2 position = rs.randomPointInUnitDiameterCircle() * 3;
+        if (!withinEpsilon(blur_uniform.getColor(position),
+                           Color(0.1, 0.5, 0.9), 0.000001) ||
+            (blur_grating.getColor(position) !=
+             blur_grating.getColor(position))) blurs_ok = false;
+    }
+    return (st(&bank == &Blur::JitterBank::get(n)) &&
+            st(patterns_ok) &&
+            st(distinct) &&
+            st(blurs_ok));
+}
+
+bool blur_raster()
+{
+    // Outside of rendering Blur uses subsamples. Its raster (computed here
+    // on demand, as if rendering) of a Uniform is that Uniform, and of smooth
+    // Noise is close to the subsampled blur, and continuous across tile
+    // edges, including those at 0 where tile indices change sign.
+    Uniform color(0.1, 0.5, 0.9);
+    Uniform black(0);
+    Blur blur_uniform(0.2, color);
+    Noise noise(Vec2(), Vec2(1, 0), black, color);
+    Blur blur_noise(0.1, noise);
+    bool not_rendering = !Texture::rendering();
+    bool uniform_ok = true;
+    bool noise_ok = true;
+    RandomSequence rs(98734521);
+    for (int i = 0; i < 100; i++)
+    {
+        Vec2 position = rs.randomPointInUnitDiameterCircle() * 3;
+        Color raster = blur_noise.rasterColor(position);
+        if (!withinEpsilon(blur_uniform.rasterColor(position),
+                           Color(0.1, 0.5, 0.9), 0.00001)) uniform_ok = false;
+        Color subsampled = blur_noise.subsampledColor(position);
+        if (!withinEpsilon(raster, subsampled, 0.02) ||
+            (blur_noise.getColor(position) !=
+             blur_noise.subsampledColor(position))) noise_ok = false;
+    }
+    std::vector<Color> first_rasters;
+    RandomSequence rs2(98734521);
+    for (int i = 0; i < 100; i++)
+        first_rasters.push_back(blur_noise.rasterColor
+                                (rs2.randomPointInUnitDiameterCircle() * 3));
+    bool continuous = true;
+    float tile_width = 0.1 * Blur::raster_tile_cells /
+                       Blur::raster_cells_per_width;
+    for (float edge : {-tile_width, 0.0f, tile_width})
+    {
+        // Points just either side of a vertical, then a horizontal, edge.
+        Vec2 a(edge - 0.0001, 0.13);
+        Vec2 b(edge + 0.0001, 0.13);
+        if (!withinEpsilon(blur_noise.rasterColor(a),
+                           blur_noise.rasterColor(b), 0.001) ||
+            !withinEpsilon(blur_noise.rasterColor(Vec2(a.y(), a.x())),
+                           blur_noise.rasterColor(Vec2(b.y(), b.x())),
+                           0.001)) continuous = false;
+    }
+    // Tiles share a global budget. With room for only a few, the least
+    // recently used are evicted, and recomputed (identically) when needed.
+    int tiles_before = blur_noise.rasterTileCount();
+    size_t budget = Blur::getRasterMemoryBudget();
+    size_t two_tiles = 2 * Blur::raster_tile_bytes;
+    Blur::setRasterMemoryBudget(two_tiles);
+    bool evicted = ((blur_noise.rasterTileCount() <= 2) &&
+                    (Blur::getRasterMemoryUsed() <= two_tiles));
+    bool recomputed = true;
+    RandomSequence rs3(98734521);
+    for (int i = 0; i < 100; i++)
+    {
+        Vec2 position = rs3.randomPointInUnitDiameterCircle() * 3;
+        if (blur_noise.rasterColor(position) != first_rasters[i])
+            recomputed = false;
+    }
+    bool within_budget = (blur_noise.rasterTileCount() <= 2);
+    Blur::setRasterMemoryBudget(budget);
+    return (st(not_rendering) &&
+            st(!Texture::getRenderBlurRaster()) &&
+            st(uniform_ok) &&
+            st(noise_ok) &&
+            st(continuous) &&
+            st(tiles_before > 2) &&
+            st(evicted) &&
+            st(recomputed) &&
+            st(within_budget));
+}
+
+bool blur_nested_cache()
+{
+    // While rendering, a Blur nested within another memoizes its colors on a
+    // grid, within a small error of rendering without that cache. A Blur not
+    // nested in another is unchanged. Outside of Blur subsamples, depth is 0.
+    int save_aa = Texture::sqrt_of_aa_subsample_count;
+    Texture::sqrt_of_aa_subsample_count = 1;
+    Uniform black(0);
+    Uniform color(0.1, 0.5, 0.9);
+    Noise noise(Vec2(), Vec2(0.2, 0), black, color);
+    EdgeEnhance enhance0(0.2, 1, noise);
+    EdgeEnhance enhance1(0.2, 1, noise);
+    EdgeDetect nested0(0.2, enhance0);
+    EdgeDetect nested1(0.2, enhance1);
+    EdgeDetect single0(0.2, noise);
+    EdgeDetect single1(0.2, noise);
+    nested0.rasterizeToImageCache(21, true);
+    single0.rasterizeToImageCache(21, true);
+    Texture::setRenderBlurCache(false);
+    nested1.rasterizeToImageCache(21, true);
+    single1.rasterizeToImageCache(21, true);
+    Texture::setRenderBlurCache(true);
+    Texture::sqrt_of_aa_subsample_count = save_aa;
+    float nested_error = Texture::maxRasterDifference(nested0, nested1);
+    return (st(Texture::getRenderBlurCache()) &&
+            st(Blur::nestingDepth() == 0) &&
+            st(nested_error > 0) &&
+            st(nested_error < 0.015) &&
+            st(Texture::maxRasterDifference(single0, single1) == 0));
+}
+
+bool sample_cache()
+{
+    // Colors come from the nearest grid point, are computed once, shared by
+    // nearby positions, and discarded at the start of a new render pass.
+    Uniform color(0.1, 0.5, 0.9);
+    Uniform black(0);
+    Noise noise(Vec2(), Vec2(1, 0), black, color);
+    SampleCache cache(0.01, noise);
+    Vec2 positions[] = {Vec2(0.101, 0.2), Vec2(0.099, 0.2), Vec2(-0.3, 0.52)};
+    Color colors[3];
+    int64_t lookups = SampleCache::totalLookups();
+    int64_t hits = SampleCache::totalHits();
+    cache.getColors(3, positions, colors);
+    bool first_ok = ((SampleCache::totalLookups() - lookups == 3) &&
+                     (SampleCache::totalHits() - hits == 1) &&
+                     (cache.size() == 2));
+    bool colors_ok = true;
+    for (int i = 0; i < 3; i++)
+    {
+        Vec2 point = cache.nearestGridPoint(positions[i]);
+        if (colors[i] != noise.getColor(point)) colors_ok = false;
+    }
+    cache.getColors(3, positions, colors);
+    bool second_ok = ((SampleCache::totalHits() - hits == 4) &&
+                      (cache.size() == 2));
+    SampleCache::beginRenderPass();
+    cache.getColors(1, positions, colors);
+    bool new_pass_ok = (cache.size() == 1);
+    Vec2 nearest = cache.nearestGridPoint(Vec2(0.101, 0.2));
+    return (st(withinEpsilon(nearest, Vec2(0.1, 0.2), 0.000001)) &&
+            st(first_ok) &&
+            st(colors_ok) &&
+            st(second_ok) &&
+            st(new_pass_ok));
+}
+
+bool mip_cache()
+{
+    // With unknown footprint MipCache samples its input directly. Otherwise
+    // it looks up a level chosen by footprint: a Uniform stays uniform and
+    // smooth Noise stays close to the original.
+    Uniform color(0.1, 0.5, 0.9);
+    Uniform black(0);
+    Noise noise(Vec2(), Vec2(1, 0), black, color);
+    MipCache mip_uniform(color);
+    MipCache mip_noise(noise);
+    float spacing = mip_noise.finestSpacing();
+    bool direct_ok = true;
+    bool uniform_ok = true;
+    bool noise_ok = true;
+    RandomSequence rs(5427390);
+    for (int i = 0; i < 50; i++)
+    {
+        Vec2 position = rs.randomPointInUnitDiameterCircle() * 3;
+        if (mip_noise.getColor(position) != noise.getColor(position))
+            direct_ok = false;
+        for (float footprint : {1.5f, 3.0f, 20.0f})
+        {
+            SampleFootprint::Scope scope(spacing * footprint);
+            if (!withinEpsilon(mip_uniform.getColor(position),
+                               Color(0.1, 0.5, 0.9), 0.00001))
+                uniform_ok = false;
+            if ((footprint < 5) &&
+                !withinEpsilon(mip_noise.getColor(position),
+                               noise.getColor(position), 0.02))
+                noise_ok = false;
+        }
+    }
+    // Tiles of all MipCaches share a budget, least recently used is evicted.
+    size_t saved_budget = MipCache::getMemoryBudget();
+    MipCache::setMemoryBudget(2 * MipCache::tile_bytes);
+    MipCache mip_a(color);
+    MipCache mip_b(color);
+    float tile_width = spacing * MipCache::tile_texels;
+    {
+        SampleFootprint::Scope scope(spacing * 1.5);
+        mip_a.getColor(Vec2(0.5, 0.5) * tile_width);
+        mip_b.getColor(Vec2(0.5, 0.5) * tile_width);
+        mip_a.getColor(Vec2(0.5, 0.5) * tile_width);
+        mip_b.getColor(Vec2(10.5, 0.5) * tile_width);
+    }
+    // Level 0 and 1 tile for each lookup: only the two newest are kept.
+    bool lru_ok = ((mip_a.tileCount() == 0) &&
+                   (mip_b.tileCount() == 2) &&
+                   (MipCache::getMemoryUsed() == 2 * MipCache::tile_bytes));
+    MipCache::setMemoryBudget(saved_budget);
+    return (st(direct_ok) &&
+            st(uniform_ok) &&
+            st(noise_ok) &&
+            st(mip_noise.levelForFootprint(spacing * 4) == 2) &&
+            st(lru_ok));
+}
+
+bool adaptive_anti_aliasing()
+{
+    // With a threshold, pixels differ from the NxN (threshold 0) rendering by
+    // less than twice that threshold, for fewer samples per pixel: for smooth
+    // Noise, little more than the 4 probes. Probes shared across tile rows
+    // give the same image for any render tile size.
+    int save_aa = Texture::sqrt_of_aa_subsample_count;
+    float save_threshold = Texture::getAdaptiveAAThreshold();
+    int save_tile_size = Texture::getRenderTileSize();
+    Texture::sqrt_of_aa_subsample_count = 8;
+    float threshold = 0.05;
+    Uniform black(0);
+    Uniform white(1);
+    ColorNoise noise(Vec2(), Vec2(0.2, 0), 0.3);
+    Grating grating(Vec2(), black, Vec2(0.1, 0.2), white, 0, 0.5);
+    Spot spot(Vec2(), 0.4, noise, 0.45, black);
+    Noise smooth(Vec2(), Vec2(1, 0), black, white);
+    bool within_bound = true;
+    bool fewer_samples = true;
+    bool tile_size_ok = true;
+    // Each texture and its limit on samples per pixel.
+    std::vector<std::pair<const Texture*, float>> cases =
+        {{&grating, 64}, {&spot, 64}, {&smooth, 10}};
+    for (auto& c : cases)
+    {
+        const Texture* texture = c.first;
+        Add fixed(*texture, black);
+        Add adaptive(*texture, black);
+        Add small_tiles(*texture, black);
+        Texture::setAdaptiveAAThreshold(0);
+        fixed.rasterizeToImageCache(101, true);
+        Texture::setAdaptiveAAThreshold(threshold);
+        adaptive.rasterizeToImageCache(101, true);
+        float samples_per_pixel = Texture::getRenderSamplesPerPixel();
+        Texture::setRenderTileSize(5);
+        small_tiles.rasterizeToImageCache(101, true);
+        Texture::setRenderTileSize(save_tile_size);
+        if (Texture::maxRasterDifference(fixed, adaptive) > 2 * threshold)
+            within_bound = false;
+        if (samples_per_pixel >= c.second) fewer_samples = false;
+        if (Texture::maxRasterDifference(adaptive, small_tiles) != 0)
+            tile_size_ok = false;
+    }
+    Texture::setAdaptiveAAThreshold(save_threshold);
+    Texture::sqrt_of_aa_subsample_count = save_aa;
+    return (st(within_bound) && st(fewer_samples) && st(tile_size_ok));
+}
+
+bool progressive_rendering()
+{
+    // Stage 2 matches a rendering without anti-aliasing, and the last stage
+    // matches rasterizeToImageCache() with it. "stage_done" is called once
+    // per stage, in order. A cancel returns false, leaving the cache empty.
+    int save_aa = Texture::sqrt_of_aa_subsample_count;
+    Uniform black(0);
+    ColorNoise noise(Vec2(), Vec2(0.2, 0), 0.3);
+    Spot spot(Vec2(), 0.4, noise, 0.45, black);
+    Add plain(spot, black);
+    Add anti_aliased(spot, black);
+    Add progressive(spot, black);
+    Add cancelled(spot, black);
+    Texture::sqrt_of_aa_subsample_count = 1;
+    plain.rasterizeToImageCache(61, true);
+    Texture::sqrt_of_aa_subsample_count = 3;
+    anti_aliased.rasterizeToImageCache(61, true);
+    std::vector<int> stages;
+    float stage_2_difference = 1;
+    bool completed = progressive.rasterizeProgressively
+        (61, true,
+         [&](int stage, const cv::Mat&)
+         {
+             stages.push_back(stage);
+             if (stage == 2)
+                 stage_2_difference =
+                     Texture::maxRasterDifference(progressive, plain);
+         });
+    float final_difference = Texture::maxRasterDifference(progressive,
+                                                          anti_aliased);
+    std::atomic<bool> cancel(false);
+    int cancelled_stages = 0;
+    bool not_cancelled = cancelled.rasterizeProgressively
+        (61, true,
+         [&](int stage, const cv::Mat&)
+         {
+             cancelled_stages++;
+             if (stage == 1) cancel = true;
+         },
+         &cancel);
+    Texture::sqrt_of_aa_subsample_count = save_aa;
+    return (st(completed) &&
+            st(stages == std::vector<int>({0, 1, 2, 3})) &&
+            st(stage_2_difference == 0) &&
+            st(final_difference == 0) &&
+            st(!not_cancelled) &&
+            st(cancelled_stages == 2) &&
+            st(cancelled.rasterCacheEmpty()) &&
+            st(!progressive.rasterCacheEmpty()));
+}
+
+bool flat_occupancy_grid()
+{
+    // For random points, the flat grid visits the same Disks, in the same
+    // order, as the std::set returned by findNearbyDisks().
+    RandomSequence rs(7654321);
+    std::vector<Disk> disks;
+    for (int i = 0; i < 500; i++)
+        disks.push_back(Disk(rs.frandom2(0.05, 0.5),
+                             Vec2(rs.frandom2(-5, 5), rs.frandom2(-5, 5))));
+    DiskOccupancyGrid grid(Vec2(-5, -5), Vec2(5, 5), 20);
+    for (Disk& disk : disks) grid.insertDiskWrap(disk);
+    bool not_yet_flat = !grid.isFlattened();
+    grid.flatten();
+    bool same = true;
+    int total = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        Vec2 point(rs.frandom2(-5, 5), rs.frandom2(-5, 5));
+        std::set<Disk*> set;
+        grid.findNearbyDisks(point, set);
+        std::vector<const Disk*> flat;
+        auto add = [&](const Disk& d){ flat.push_back(&d); };
+        grid.forDisksNearPoint(point, add);
+        if (!std::equal(set.begin(), set.end(), flat.begin(), flat.end()))
+            same = false;
+        total += flat.size();
+    }
+    return (st(not_yet_flat) &&
+            st(grid.isFlattened()) &&
+            st(same) &&
+            st(total > 0));
+}
+
+bool disk_relaxation()
+{
+    // Total overlap depth between pairs of Disks, allowing for tiling.
+    DiskOccupancyGrid tiling(Vec2(-5, -5), Vec2(5, 5), 20);
+    auto total_overlap = [&](const std::vector<Disk>& disks)
+    {
+        float total = 0;
+        for (auto& a : disks)
+        {
+            for (auto& b : disks)
+            {
+                Vec2 b_tile = tiling.nearestByTiling(a.position, b.position);
+                float d = (a.position - b_tile).length();
+                if (&a != &b) total += std::max(0.0f, a.radius + b.radius - d);
+            }
+        }
+        return total;
+    };
+    RandomSequence rs(1234567);
+    std::vector<Disk> initial;
+    for (int i = 0; i < 300; i++)
+        initial.push_back(Disk(rs.frandom2(0.05, 0.3),
+                               Vec2(rs.frandom2(-5, 5), rs.frandom2(-5, 5))));
+    // Relax two copies, check they agree, are on center tile, have less
+    // overlap than before, and are each found in the grid where they ended.
+    std::vector<Disk> disks = initial;
+    std::vector<Disk> again = initial;
+    DiskOccupancyGrid grid(Vec2(-5, -5), Vec2(5, 5), 20);
+    DiskOccupancyGrid grid_again(Vec2(-5, -5), Vec2(5, 5), 20);
+    for (Disk& disk : disks) grid.insertDiskWrap(disk);
+    for (Disk& disk : again) grid_again.insertDiskWrap(disk);
+    grid.reduceDiskOverlap(100, disks);
+    grid_again.reduceDiskOverlap(100, again);
+    bool same = true;
+    bool centered = true;
+    bool in_grid = true;
+    for (size_t i = 0; i < disks.size(); i++)
+    {
+        Disk& disk = disks[i];
+        if (disk.position != again[i].position) same = false;
+        if (disk.position != grid.wrapToCenterTile(disk.position))
+            centered = false;
+        std::set<Disk*> set;
+        grid.findNearbyDisks(disk.position, set);
+        if (set.find(&disk) == set.end()) in_grid = false;
+    }
+    return (st(same) &&
+            st(centered) &&
+            st(in_grid) &&
+            st(total_overlap(disks) < total_overlap(initial) * 0.1));
+}
+
+bool spot_layout_cache()
+{
+    // Spot textures with equal layout parameters share one SpotLayout.
+    Uniform black(0);
+    Uniform white(1);
+    int64_t hits = SpotLayout::cacheHits();
+    int64_t misses = SpotLayout::cacheMisses();
+    LotsOfSpots a(0.3, 0.12, 0.34, 0.05, 0.01, white, black);
+    ColoredSpots b(0.3, 0.12, 0.34, 0.05, 0.01, white, black);
+    LotsOfButtons c(0.3, 0.12, 0.34, 0.05, 0.01, Vec2(), white, 1, black);
+    LotsOfSpots d(0.3, 0.12, 0.34, 0.06, 0.01, white, black);
+    bool shared = ((a.spotLayout() == b.spotLayout()) &&
+                   (a.spotLayout() == c.spotLayout()));
+    bool distinct = (a.spotLayout() != d.spotLayout());
+    bool counted = ((SpotLayout::cacheHits() >= hits + 2) &&
+                    (SpotLayout::cacheMisses() >= misses + 1));
+    // Cached layout matches one made directly.
+    SpotLayout direct(0.3, 0.12 + 0.01, 0.34 + 0.01, 0.05);
+    bool same = (int(direct.spots().size()) == a.spotCount());
+    for (int i = 0; same && i < a.spotCount(); i++)
+        if ((direct.spots()[i].position != a.spot(i).position) ||
+            (direct.spots()[i].angle != a.spot(i).angle)) same = false;
+    // A zero budget empties the cache, textures keep their layouts.
+    size_t budget = SpotLayout::getMemoryBudget();
+    SpotLayout::setMemoryBudget(0);
+    bool emptied = ((SpotLayout::cacheSize() == 0) &&
+                    (SpotLayout::getMemoryUsed() == 0));
+    Color color = a.getColor(a.spot(0).position);
+    SpotLayout::setMemoryBudget(budget);
+    return (st(shared) &&
+            st(distinct) &&
+            st(counted) &&
+            st(same) &&
+            st(emptied) &&
+            st(color == Color(1, 1, 1)) &&
+            st(a.spotLayout()->bytes() > 0));
+}
+
+bool spot_layout_disk_cache()
+{
+    // Layout written to disk by one get(), read by the next (after the memory
+    // cache is emptied), then after corruption rejected and remade.
+    const char* tmpdir = std::getenv("TMPDIR");
+    std::string saved_directory = SpotLayout::getDiskCacheDirectory();
+    size_t saved_budget = SpotLayout::getMemoryBudget();
+    SpotLayout::setDiskCacheDirectory(tmpdir ? tmpdir : "/tmp");
+    float p[] = {0.4, 0.15, 0.3, 0.0432};
+    std::string pathname = SpotLayout::diskCachePathname(p[0], p[1],
+                                                         p[2], p[3]);
+    std::remove(pathname.c_str());
+    auto layout = [&]()
+    {
+        SpotLayout::setMemoryBudget(0);
+        return SpotLayout::get(p[0], p[1], p[2], p[3]);
+    };
+    auto same = [](const SpotLayout& a, const SpotLayout& b)
+    {
+        bool s = (a.spots().size() == b.spots().size());
+        for (size_t i = 0; s && i < a.spots().size(); i++)
+            if ((a.spots()[i].radius != b.spots()[i].radius) ||
+                (a.spots()[i].position != b.spots()[i].position) ||
+                (a.spots()[i].angle != b.spots()[i].angle)) s = false;
+        return s;
+    };
+    int64_t reads = SpotLayout::diskCacheReads();
+    int64_t writes = SpotLayout::diskCacheWrites();
+    int64_t rejects = SpotLayout::diskCacheRejects();
+    auto made = layout();
+    bool written = (SpotLayout::diskCacheWrites() == writes + 1);
+    auto read = layout();
+    bool was_read = (SpotLayout::diskCacheReads() == reads + 1);
+    // Invert the bits of one byte of the last record.
+    {
+        std::fstream file(pathname, std::ios::in | std::ios::out);
+        file.seekg(-1, std::ios::end);
+        char byte = file.get();
+        file.seekp(-1, std::ios::end);
+        file.put(~byte);
+    }
+    auto remade = layout();
+    bool rejected = ((SpotLayout::diskCacheRejects() == rejects + 1) &&
+                     (SpotLayout::diskCacheWrites() == writes + 2));
+    std::remove(pathname.c_str());
+    SpotLayout::setDiskCacheDirectory(saved_directory);
+    SpotLayout::setMemoryBudget(saved_budget);
+    return (st(written) &&
+            st(was_read) &&
+            st(rejected) &&
+            st(made != read) &&
+            st(same(*made, *read)) &&
+            st(same(*made, *remade)) &&
+            st(made->grid().isFlattened() && read->grid().isFlattened()));
+}
+
+bool spot_candidates()
+{
+    // getSpot() via precomputed candidates matches the occupancy grid search.
+    Uniform black(0);
+    Uniform white(1);
+    LotsOfSpots spots(0.8, 0.05, 0.3, 0.05, 0.02, white, black);
+    DiskOccupancyGrid tiling(Vec2(-5, -5), Vec2(5, 5), 1);
+    RandomSequence rs(8765432);
+    bool same = true;
+    for (int i = 0; i < 10000; i++)
+    {
+        Vec2 p(rs.frandom2(-7, 7), rs.frandom2(-7, 7));
+        auto a = spots.getSpot(p);
+        auto b = spots.getSpotFromGrid(tiling.wrapToCenterTile(p));
+        if ((a.second != b.second) ||
+            (a.first.position != b.first.position) ||
+            (a.first.radius != b.first.radius)) same = false;
+    }
+    return (st(spots.spotLayout()->candidatesExact()) && st(same));
+}
+
 // Used only in UnitTests::allTestsOK()
 #define logAndTally(e)                       \
 {                                            \
@@ -573,6 +1892,31 @@ bool UnitTests::allTestsOK()
     logAndTally(noise_ranges);
     logAndTally(interpolate_float_rounding);
     logAndTally(two_point_transform);
+    logAndTally(thread_pool);
+    logAndTally(tiled_rasterization);
+    logAndTally(batch_get_colors);
+    logAndTally(simd_packets);
+    logAndTally(noise_packets);
+    logAndTally(noise_thread_safety);
+    logAndTally(sample_footprint);
+    logAndTally(compiled_program);
+    logAndTally(parsed_texture);
+    logAndTally(shared_subtrees);
+    logAndTally(optimized_program);
+    logAndTally(fused_transforms);
+    logAndTally(precomputed_invariants);
+    logAndTally(blur_jitter_bank);
+    logAndTally(blur_raster);
+    logAndTally(blur_nested_cache);
+    logAndTally(sample_cache);
+    logAndTally(mip_cache);
+    logAndTally(adaptive_anti_aliasing);
+    logAndTally(progressive_rendering);
+    logAndTally(flat_occupancy_grid);
+    logAndTally(disk_relaxation);
+    logAndTally(spot_layout_cache);
+    logAndTally(spot_layout_disk_cache);
+    logAndTally(spot_candidates);
     std::cout << std::endl;
     std::cout << (all_tests_passed ? "All tests PASS." : "Some tests FAIL.");
     std::cout << std::endl << std::endl;
@@ -587,6 +1931,23 @@ bool UnitTests::allTestsOK()
 // manually, which of course reduces its effectiveness for catching (e.g.)
 // accidentally deleted definitions.
 void UnitTests::instantiateAllTextureTypes()
+{
+    std::string path = "/Users/cwr/Desktop/TexSyn_temp/20200607_";
+    int counter = 0;
+    forAllTextureTypes([&](const Texture& texture)
+    {
+        std::string s = path + "thumbnail_" + std::to_string(counter++);
+        // TODO TEMP
+        s = "";
+        Texture::displayAndFile(texture, s, 101);
+    });
+    std::cout << "Total thumbnails constructed: " << counter << std::endl;
+}
+
+// Construct one instance of each texture type (the "thumbnail suite" used by
+// instantiateAllTextureTypes()) and pass each to the given function.
+void UnitTests::forAllTextureTypes(std::function<void(const Texture&)>
+                                   do_thumbnail)
 {
     Vec2 p1(-0.1, 0);
     Vec2 p2(0.1, 0);
@@ -600,17 +1961,6 @@ void UnitTests::instantiateAllTextureTypes()
     Grating& t1 = white_cyan;
     Grating& t2 = black_red;
     ColorNoise t3(p1, p3, 0.2);
-    
-    std::string path = "/Users/cwr/Desktop/TexSyn_temp/20200607_";
-    int counter = 0;
-    
-    auto do_thumbnail = [&](const Texture& texture)
-    {
-        std::string s = path + "thumbnail_" + std::to_string(counter++);
-        // TODO TEMP
-        s = "";
-        Texture::displayAndFile(texture, s, 101);
-    };
 
     do_thumbnail(Uniform(0.5));
     do_thumbnail(Spot(p1, 0.1, t1, 0.2, t2));
@@ -664,6 +2014,4 @@ void UnitTests::instantiateAllTextureTypes()
     do_thumbnail(Hyperbolic(p3, 1.5, 4, 2, black_red, white_cyan));
     do_thumbnail(Affine(p3, p3 + Vec2(0.3, 0.3), white_cyan));
     do_thumbnail(HueOnly(1, 1, AdjustBrightness(0.1, Add(white_cyan, white))));
-
-    std::cout << "Total thumbnails constructed: " << counter << std::endl;
 }
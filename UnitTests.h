@@ -7,6 +7,8 @@
 //
 
 #pragma once
+#include <functional>
+class Texture;
 
 namespace UnitTests
 {
@@ -14,4 +16,7 @@ namespace UnitTests
     bool allTestsOK();
     // Ad hoc utility to verify all texture types build and run.
     void instantiateAllTextureTypes();
+    // Construct one instance of each texture type (the "thumbnail suite" used
+    // by instantiateAllTextureTypes()) and pass each to the given function.
+    void forAllTextureTypes(std::function<void(const Texture&)> function);
 }
@@ -8,6 +8,10 @@
 
 #include "Utilities.h"
 #include "Vec2.h"
+#include "Simd.h"
+
+// Footprint of current texture sample, per thread. Initially 0 ("unknown").
+thread_local float SampleFootprint::footprint_ = 0;
 
 // Perlin Noise
 // Ken Perlin's 2002 "Improved Noise": http://mrl.nyu.edu/~perlin/noise/
@@ -15,10 +19,8 @@
 // http://www.fundza.com/c4serious/noise/perlin/perlin.html
 namespace PerlinNoise
 {
-    // Static data structure, initialized once (needs mutex for multi-threading)
-    bool initialized = false;  // would need mutex for multi-threading
-    std::vector<int> p(512, 0);
-    std::vector<int> permutation = { 151,160,137,91,90,15,131,13,201,95,96,53,
+    // Ken Perlin's permutation of the integers [0, 255].
+    constexpr int permutation[256] = { 151,160,137,91,90,15,131,13,201,95,96,53,
         194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,190,6,148,247,
         120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,88,237,149,
         56,87,174,20,125,136,171,168,68,175,74,165,71,134,139,48,27,166,77,146,
@@ -32,16 +34,27 @@ namespace PerlinNoise
         145,235,249,14,239,107,49,192,214,31,181,199,106,157,184,84,204,176,115,
         121,50,45,127,4,150,254,138,236,205,93,222,114,67,29,24,72,243,141,128,
         195,78,66,215,61,156,180 };
-    void init()
+    // Table "p" is two copies of the permutation, end to end. It is built at
+    // compile time, so is read-only and safe to share between threads. (This
+    // replaces a table filled in by the first call to noise2d(), which raced
+    // when called from many rendering threads at once.)
+    struct PermutationTable
     {
-        if (!initialized)
+        constexpr PermutationTable() : p{}
+        {
             for (int i = 0; i < 256 ; i++) p[256+i] = p[i] = permutation[i];
-        initialized = true;
-    }
+        }
+        int p[512];
+    };
+    constexpr PermutationTable permutation_table;
+    constexpr auto& p = permutation_table.p;
+    static_assert(p[0] == 151 && p[256] == 151 && p[511] == 180,
+                  "PerlinNoise permutation table built at compile time.");
     // Helper functions.
-    float fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
-    float lerp(float t, float a, float b) { return a + t * (b - a); }
-    float grad(int hash, float x, float y, float z)
+    constexpr float fade(float t)
+        { return t * t * t * (t * (t * 6 - 15) + 10); }
+    constexpr float lerp(float t, float a, float b) { return a + t * (b - a); }
+    constexpr float grad(int hash, float x, float y, float z)
     {
         int h = hash & 15;        // CONVERT LO 4 BITS OF HASH CODE
         float u = h < 8 ? x : y;  // INTO 12 GRADIENT DIRECTIONS.
@@ -53,7 +66,6 @@ namespace PerlinNoise
     // Based on "Improved Noise" (Ken Perlin, 2002)
     float noise2d(Vec2 position)
     {
-        init();
         float x = position.x();
         float y = position.y();
         // Find unit square that contains position.
@@ -85,9 +97,29 @@ namespace PerlinNoise
         return remapIntervalClip(noise2d(position), -1, 1, 0, 1);
     }
 
-    // For 1/f subdivision recursion from "image scale" to "pixel scale"
-    // TODO this recursion criteria should be pixel-aware like Perlin's
+    // For 1/f subdivision recursion from "image scale" to "pixel scale". This
+    // is the maximum, see octavesForFootprint().
     int recursion_levels = 10;
+
+    // Number of octaves to compute for the current SampleFootprint: those
+    // whose noise lattice spacing (1/frequency) is at least the footprint, up
+    // to recursion_levels. Finer octaves are smaller than a pixel and would
+    // only cause aliasing, so callers add their (measured) average value in
+    // their place. Sets "culled" to the sum of 1/frequency over those octaves.
+    int octavesForFootprint(float& culled)
+    {
+        float footprint = SampleFootprint::get();
+        int levels = 1;
+        float spacing = 0.5;
+        culled = 0;
+        for (int i = 1; i < recursion_levels; i++)
+        {
+            if (spacing < footprint) culled += spacing; else levels++;
+            spacing /= 2;
+        }
+        return levels;
+    }
+
     // For disalignment rotation of two radians at each recursion level.
     float dis_sin = std::sin(2);
     float dis_cos = std::cos(2);
@@ -98,12 +130,15 @@ namespace PerlinNoise
     {
         float value = 0.0f;
         float octave = 1.0f;
-        for (int i = 0; i < recursion_levels; i++)
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
         {
             value += fabs(noise2d(position * octave) / octave);
             octave *= 2;
             position = disalignment_rotation(position);
         }
+        value += culled * 0.3f;  // Average of fabs(noise2d()).
         return remapIntervalClip(value, 0.1, 1.5, 0, 1);
     }
 
@@ -112,12 +147,15 @@ namespace PerlinNoise
     {
         float value = 0.0f;
         float octave = 1.0f;
-        for (int i = 0; i < recursion_levels; i++)
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
         {
             value += noise2d(position * octave) / octave;
             octave *= 2;
             position = disalignment_rotation(position);
         }
+        // (Average of noise2d() is zero, so nothing to add for culled octaves.)
         return remapIntervalClip(value, -1.3, 1.3, 0, 1);
     }
 
@@ -127,13 +165,16 @@ namespace PerlinNoise
     {
         float value = 0.0f;
         float octave = 1.0f;
-        for (int i = 0; i < recursion_levels; i++)
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
         {
             float pn = noise2d(position * octave);
             value += fabs (0.66f - fabs(pn + 0.33f)) * 1.5f / octave;
             octave *= 2;
             position = disalignment_rotation(position);
         }
+        value += culled * 0.5f;  // Average of fold term.
         return remapIntervalClip(value, 0.16, 1.8, 0, 1);
     }
 
@@ -144,7 +185,9 @@ namespace PerlinNoise
     {
         float value = 0.0f;
         float octave = 1.0f;
-        for (int i = 0; i < recursion_levels; i++)
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
         {
             float pn = noise2d(position * octave);
             float sn = pn * 3;
@@ -152,6 +195,7 @@ namespace PerlinNoise
             octave *= 2;
             position = disalignment_rotation(position);
         }
+        value += culled * 0.5f;  // Average of wrap term.
         return remapIntervalClip(value, 0.11, 1.8, 0, 1);
     }
 
@@ -170,6 +214,174 @@ namespace PerlinNoise
         }
     }
 
+    // Packet versions of the noise functions above, for four positions at
+    // once. Floating point arithmetic is done on Float4s, in the same order
+    // as the scalar versions, so results match them. (But for example, in
+    // scalar code, fabs() may return a double, so some intermediate values
+    // could be rounded differently.) There is no portable SIMD "gather", so
+    // table lookups are done one lane at a time.
+
+    // Gradient, as coefficients of x and y, for each of the 16 "hash" values
+    // in grad() above (where z is always 0 for 2d noise).
+    struct GradientTable
+    {
+        constexpr GradientTable() : x{}, y{}
+        {
+            for (int h = 0; h < 16; h++)
+            {
+                x[h] = grad(h, 1, 0, 0);
+                y[h] = grad(h, 0, 1, 0);
+            }
+        }
+        float x[16];
+        float y[16];
+    };
+    constexpr GradientTable gradient_table;
+
+    // Packet version of grad(): for four hashes and four (x, y) offsets.
+    Float4 grad(const int* hash, Float4 x, Float4 y)
+    {
+        auto gx = [&](int k){ return gradient_table.x[hash[k] & 15]; };
+        auto gy = [&](int k){ return gradient_table.y[hash[k] & 15]; };
+        Float4 grad_x(gx(0), gx(1), gx(2), gx(3));
+        Float4 grad_y(gy(0), gy(1), gy(2), gy(3));
+        return grad_x * x + grad_y * y;
+    }
+    Float4 fade(Float4 t) { return t * t * t * (t * (t * 6 - 15) + 10); }
+    Float4 lerp(Float4 t, Float4 a, Float4 b) { return a + t * (b - a); }
+
+    // Packet version of noise2d(), output range approximately on [-1, 1].
+    Float4 noise2dx4(Vec2x4 position)
+    {
+        Float4 x = position.x();
+        Float4 y = position.y();
+        // Find unit squares that contain positions.
+        Float4 floor_x = floor(x);
+        Float4 floor_y = floor(y);
+        float fx[4];
+        float fy[4];
+        floor_x.store(fx);
+        floor_y.store(fy);
+        // Relative xy of positions inside squares
+        x = x - floor_x;
+        y = y - floor_y;
+        // Compute fade curves for each of x and y.
+        Float4 u = fade(x);
+        Float4 v = fade(y);
+        // Hash coordinates of the 4 corners of each square.
+        int hash_aa[4];
+        int hash_ba[4];
+        int hash_ab[4];
+        int hash_bb[4];
+        for (int k = 0; k < 4; k++)
+        {
+            int X = int(fx[k]) & 255;
+            int Y = int(fy[k]) & 255;
+            int  A = p[X  ]+Y, AA = p[A], AB = p[A+1];
+            int  B = p[X+1]+Y, BA = p[B], BB = p[B+1];
+            hash_aa[k] = p[AA];
+            hash_ba[k] = p[BA];
+            hash_ab[k] = p[AB];
+            hash_bb[k] = p[BB];
+        }
+        // And add blended results from 4 corners of each square.
+        Float4 raw = lerp(v, lerp(u, grad(hash_aa, x  , y  ),
+                                     grad(hash_ba, x-1, y  )),
+                             lerp(u, grad(hash_ab, x  , y-1),
+                                     grad(hash_bb, x-1, y-1)));
+        return remapIntervalClip(raw, -0.70, 0.70, -1, 1);
+    }
+
+    // Packet version of unitNoise2d(), output range on [0, 1].
+    Float4 unitNoise2dx4(Vec2x4 position)
+    {
+        return remapIntervalClip(noise2dx4(position), -1, 1, 0, 1);
+    }
+
+    // Packet version of turbulence2d(), output range on [0, 1].
+    Float4 turbulence2dx4(Vec2x4 position)
+    {
+        Float4 value = 0.0f;
+        float octave = 1.0f;
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
+        {
+            value = value + abs(noise2dx4(position * octave) / octave);
+            octave *= 2;
+            position = position.rotate(dis_sin, dis_cos);
+        }
+        value = value + culled * 0.3f;
+        return remapIntervalClip(value, 0.1, 1.5, 0, 1);
+    }
+
+    // Packet version of brownian2d(), output range on [0, 1].
+    Float4 brownian2dx4(Vec2x4 position)
+    {
+        Float4 value = 0.0f;
+        float octave = 1.0f;
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
+        {
+            value = value + noise2dx4(position * octave) / octave;
+            octave *= 2;
+            position = position.rotate(dis_sin, dis_cos);
+        }
+        return remapIntervalClip(value, -1.3, 1.3, 0, 1);
+    }
+
+    // Packet version of furbulence2d(), output range on [0, 1].
+    Float4 furbulence2dx4(Vec2x4 position)
+    {
+        Float4 value = 0.0f;
+        float octave = 1.0f;
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
+        {
+            Float4 pn = noise2dx4(position * octave);
+            Float4 fold = abs(Float4(0.66f) - abs(pn + 0.33f));
+            value = value + fold * 1.5f / octave;
+            octave *= 2;
+            position = position.rotate(dis_sin, dis_cos);
+        }
+        value = value + culled * 0.5f;
+        return remapIntervalClip(value, 0.16, 1.8, 0, 1);
+    }
+
+    // Packet version of wrapulence2d(), output range on [0, 1].
+    Float4 wrapulence2dx4(Vec2x4 position)
+    {
+        Float4 value = 0.0f;
+        float octave = 1.0f;
+        float culled;
+        int levels = octavesForFootprint(culled);
+        for (int i = 0; i < levels; i++)
+        {
+            Float4 pn = noise2dx4(position * octave);
+            Float4 sn = pn * 3;
+            value = value + (sn - floor(sn)) / octave;
+            octave *= 2;
+            position = position.rotate(dis_sin, dis_cos);
+        }
+        value = value + culled * 0.5f;
+        return remapIntervalClip(value, 0.11, 1.8, 0, 1);
+    }
+
+    // Packet version of multiNoise2d(), selected according to "which".
+    Float4 multiNoise2dx4(Vec2x4 position, float which)
+    {
+        switch(int(fmod_floor(which, 1) * 5))
+        {
+            case  0: return PerlinNoise::unitNoise2dx4(position);  // which 0
+            case  1: return PerlinNoise::brownian2dx4(position);   // which 0.2
+            case  2: return PerlinNoise::turbulence2dx4(position); // which 0.4
+            case  3: return PerlinNoise::furbulence2dx4(position); // which 0.6
+            default: return PerlinNoise::wrapulence2dx4(position); // which 0.8
+        }
+    }
+
     // Tool to measure typical range of a noise function. Returns min and max
     // range from calling given noise function 100000 times for random points
     // in a circle at origin with diameter of 100.
@@ -398,3 +610,31 @@ void jittered_grid_NxN_in_square(int n,
                               Vec2(rs.frandom01() * cell_width,  // jitter
                                    rs.frandom01() * cell_width));
 }
+
+// Map index "d" along a Hilbert curve, which fills an n×n grid of cells (n
+// must be a power of 2), to the (x, y) integer coordinates of the d-th cell.
+// (After the "d2xy" function in https://en.wikipedia.org/wiki/Hilbert_curve)
+void hilbertCurveIndexToXY(int n, int d, int& x, int& y)
+{
+    assert(((n & (n - 1)) == 0) && "Hilbert curve grid size must be 2^k.");
+    x = 0;
+    y = 0;
+    for (int s = 1; s < n; s *= 2)
+    {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        // Rotate/flip this quadrant as needed.
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
@@ -17,6 +17,8 @@
 #include <chrono>
 class Vec2;
 class Color;
+class Float4;
+class Vec2x4;
 
 // for debugging: prints one line with a given C expression, an equals sign,
 // and the value of the expression.  For example "angle = 35.6"
@@ -179,6 +181,29 @@ inline float fmod_floor(float x, float y)
     return std::fmod(x, y) + ((x < 0) ? y : 0);
 }
 
+// The "footprint" of the texture sample now being computed: its approximate
+// width in the local space of the code now running, for example the width of
+// a pixel, in texture space, during rasterization. Zero means unknown. Each
+// thread has its own. Operators which scale space adjust it with a Scope, so
+// that fractal noise can omit octaves too fine to be seen.
+class SampleFootprint
+{
+public:
+    static float get() { return footprint_; }
+    // During the lifetime of a Scope the footprint is set to the given value.
+    // Its previous value is restored when the Scope is destroyed.
+    class Scope
+    {
+    public:
+        Scope(float footprint) : saved_(footprint_) { footprint_ = footprint; }
+        ~Scope() { footprint_ = saved_; }
+    private:
+        const float saved_;
+    };
+private:
+    static thread_local float footprint_;
+};
+
 // Perlin Noise
 // Ken Perlin's 2002 "Improved Noise": http://mrl.nyu.edu/~perlin/noise/
 // This code based on a transliteration by Malcolm Kesson from Java to c:
@@ -189,6 +214,8 @@ namespace PerlinNoise
     float noise2d(Vec2 position);
     // Classic Perlin noise, in 2d, output range on [0, 1].
     float unitNoise2d(Vec2 position);
+    // The fractal noise functions below (turbulence2d() through wrapulence2d()
+    // and their packet versions) omit octaves finer than the SampleFootprint.
     // Classic Perlin turbulence, in 2d, output range on [0, 1].
     float turbulence2d(Vec2 position);
     // Brownian Noise, fractal 1/f Perlin noise, output range on [0, 1].
@@ -204,6 +231,16 @@ namespace PerlinNoise
     // brownian2d, furbulence2d, wrapulence2d -- selected according to "which")
     // applied to "position".
     float multiNoise2d(Vec2 position, float which);
+    // Packet versions (see Simd.h) of the noise functions above, named with an
+    // "x4" suffix. Each takes four positions (as a Vec2x4) and returns their
+    // four noise values (as a Float4).
+    Float4 noise2dx4(Vec2x4 position);
+    Float4 unitNoise2dx4(Vec2x4 position);
+    Float4 turbulence2dx4(Vec2x4 position);
+    Float4 brownian2dx4(Vec2x4 position);
+    Float4 furbulence2dx4(Vec2x4 position);
+    Float4 wrapulence2dx4(Vec2x4 position);
+    Float4 multiNoise2dx4(Vec2x4 position, float which);
     // Tool to measure typical range of a noise function. Returns min and max
     // range from calling given noise function 100000 times for random points
     // in a circle at origin with diameter of 100.
@@ -408,3 +445,10 @@ void jittered_grid_NxN_in_square(int n,
 
 // Map/round a float value (including negative) to the nearest odd integer.
 inline int nearestOddInt(float x) { return (floor(x / 2) * 2) + 1; }
+
+// Map index "d" along a Hilbert curve, which fills an n×n grid of cells (n
+// must be a power of 2), to the (x, y) integer coordinates of the d-th cell.
+// Consecutive indices are always adjacent cells, so walking the curve visits
+// the grid in a spatially coherent order. Used to order rasterization tiles.
+// (See https://en.wikipedia.org/wiki/Hilbert_curve)
+void hilbertCurveIndexToXY(int n, int d, int& x, int& y);
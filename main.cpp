@@ -9,10 +9,12 @@
 #include "TexSyn.h"
 
 bool run_unit_tests = true;
+bool run_benchmarks = false;
 
 int main(int argc, const char * argv[])
 {
     if (run_unit_tests) UnitTests::allTestsOK();
+    if (run_benchmarks) Benchmarks::allBenchmarks();
     
     //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 